@@ -0,0 +1,327 @@
+
+#include <cmath>
+#include <cstring>
+#include <cstdint>
+#include <cstdio>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <algorithm>
+#include <functional>
+
+#include "matrix.h"
+
+using namespace std;
+using namespace vmatrixlib;
+
+/*
+ * Benchmarks of the matrix.h algorithms and of the frac / complex_frac
+ * arithmetic, over a few sizes and number types.
+ *
+ *    benchmain [--quick] [--filter <text>] [--json <file>]
+ *
+ * Inputs are generated from fixed seeds, so two runs time the same work.
+ * Each benchmark is run a few times unmeasured (warmup), then measured
+ * until it reaches bench_min_runs runs and bench_min_seconds seconds (or
+ * bench_max_runs runs). Median and p99 are reported, as a table on stdout
+ * (stderr with --json -) and optionally as JSON, for comparisons between
+ * builds.
+ */
+
+typedef frac<int32_t, double> small_frac;
+
+constexpr const int bench_warmup_runs = 2;
+constexpr const int bench_min_runs = 5;
+constexpr const int bench_max_runs = 200;
+constexpr const double bench_min_seconds = 0.3;
+
+struct bench_result {
+
+   string name;
+   string type;
+   int size;
+   int runs;
+   double median;    // seconds
+   double p99;
+   double min;
+};
+
+struct bench_options {
+
+   bool quick = false;
+   string filter;
+   string jsonFile;
+
+   // stderr when the JSON goes to stdout (--json -), to keep it parsable.
+   FILE *table = stdout;
+};
+
+static bench_options options;
+static vector<bench_result> results;
+
+// Written by every benchmark, so that the compiler can't drop the work.
+static volatile double bench_sink;
+
+template <class T>
+double sink_value(const T& x) {
+   return static_cast<double>(to_float(real_part(x)));
+}
+
+inline double sink_value(double x) { return x; }
+
+template <class T>
+double sink_value(const matrix<T>& m) {
+   return m.size() ? sink_value(m(0)) + m.rows() : 0.0;
+}
+
+template <class T>
+vector<T> seeded_numbers(int n, unsigned seed)
+{
+   mt19937 e(seed);
+   uniform_int_distribution<> dist(1, 999);
+
+   vector<T> res(n);
+
+   // Two statements: the order of the draws must not depend on the compiler.
+   for (int i = 0; i < n; i++) {
+      const long double num = dist(e);
+      const long double den = dist(e);
+      res[i] = T(num / den);
+   }
+
+   return res;
+}
+
+// Nearest rank: the smallest sample with at least p*n samples <= it.
+double percentile(const vector<double>& sorted, double p)
+{
+   const int n = static_cast<int>(sorted.size());
+   const int rank = static_cast<int>(ceil(p * n));
+
+   return sorted[max(0, min(n, rank) - 1)];
+}
+
+void run_bench(const string& name, const string& type, int size,
+               const function<void()>& body)
+{
+   typedef chrono::steady_clock clock;
+
+   const string fullName = name + "/" + type + "/" + to_string(size);
+
+   if (!options.filter.empty() && fullName.find(options.filter) == string::npos)
+      return;
+
+   for (int i = 0; i < bench_warmup_runs; i++)
+      body();
+
+   vector<double> samples;
+   double total = 0;
+
+   while (samples.size() < bench_max_runs &&
+          (samples.size() < bench_min_runs || total < bench_min_seconds))
+   {
+      const auto start = clock::now();
+      body();
+      const chrono::duration<double> elapsed = clock::now() - start;
+
+      samples.push_back(elapsed.count());
+      total += elapsed.count();
+
+      if (options.quick && samples.size() >= bench_min_runs)
+         break;
+   }
+
+   sort(samples.begin(), samples.end());
+
+   const int n = static_cast<int>(samples.size());
+   const double median = percentile(samples, 0.5);
+   const double p99 = percentile(samples, 0.99);
+
+   results.push_back(bench_result{ name, type, size, n, median, p99, samples[0] });
+
+   fprintf(options.table, "%-18s %-22s %5d %6d %12.3f %12.3f\n", name.c_str(),
+           type.c_str(), size, n, median * 1e3, p99 * 1e3);
+   fflush(options.table);
+}
+
+template <class T>
+void bench_matrix_algorithms(const string& type, const vector<int>& sizes)
+{
+   for (int n : sizes) {
+
+      // Numbers in [-9, 9] with one decimal keep exact fractions exact for a while.
+      const matrix<T> A = matrix<T>::random(n, n, -9, 9, 1, 0.0, 1000 + n);
+      const matrix<T> B = matrix<T>::random(n, n, -9, 9, 1, 0.0, 2000 + n);
+      const matrix<T> W = matrix<T>::random(n / 2, n, -9, 9, 1, 0.0, 3000 + n);
+
+      run_bench("random", type, n, [&]() {
+         bench_sink = sink_value(matrix<T>::random(n, n, -9, 9, 1, 0.0, n));
+      });
+
+      run_bench("operator*", type, n, [&]() {
+         bench_sink = sink_value(A * B);
+      });
+
+      run_bench("transpose", type, n, [&]() {
+         bench_sink = sink_value(A.transpose());
+      });
+
+      run_bench("make_triangular", type, n, [&]() {
+         bench_sink = sink_value(A.make_triangular());
+      });
+
+      run_bench("determinant", type, n, [&]() {
+         bench_sink = sink_value(A.determinant());
+      });
+
+      run_bench("compute_inverse", type, n, [&]() {
+         bench_sink = sink_value(A.compute_inverse());
+      });
+
+      run_bench("row_reduce", type, n, [&]() {
+         bench_sink = sink_value(W.row_reduce());
+      });
+
+      // (n/2 x n): the null space has n/2 dimensions.
+      run_bench("null_space", type, n, [&]() {
+         bench_sink = sink_value(W.null_space());
+      });
+   }
+}
+
+// One run is n additions, multiplications or divisions.
+template <class T>
+void bench_scalar_arithmetic(const string& type, int n)
+{
+   const vector<T> a = seeded_numbers<T>(n, 4000);
+   const vector<T> b = seeded_numbers<T>(n, 5000);
+   vector<T> c(n);
+
+   run_bench("scalar_add", type, n, [&]() {
+      for (int i = 0; i < n; i++)
+         c[i] = a[i] + b[i];
+      bench_sink = sink_value(c[n / 2]);
+   });
+
+   run_bench("scalar_mul", type, n, [&]() {
+      for (int i = 0; i < n; i++)
+         c[i] = a[i] * b[i];
+      bench_sink = sink_value(c[n / 2]);
+   });
+
+   run_bench("scalar_div", type, n, [&]() {
+      for (int i = 0; i < n; i++)
+         c[i] = a[i] / b[i];
+      bench_sink = sink_value(c[n / 2]);
+   });
+}
+
+string json_escape(const string& s)
+{
+   string res;
+
+   for (char c : s) {
+
+      if (c == '"' || c == '\\')
+         res += '\\';
+
+      res += c;
+   }
+
+   return res;
+}
+
+void write_json(ostream& out)
+{
+   out << "{\n";
+   out << "  \"threads\": " << get_num_threads() << ",\n";
+   out << "  \"quick\": " << (options.quick ? "true" : "false") << ",\n";
+   out << "  \"results\": [\n";
+
+   for (size_t i = 0; i < results.size(); i++) {
+
+      const bench_result& r = results[i];
+      char buf[128];
+
+      snprintf(buf, sizeof(buf), "\"median_ms\": %.6f, \"p99_ms\": %.6f, \"min_ms\": %.6f",
+               r.median * 1e3, r.p99 * 1e3, r.min * 1e3);
+
+      out << "    { \"name\": \"" << json_escape(r.name) << "\", "
+          << "\"type\": \"" << json_escape(r.type) << "\", "
+          << "\"size\": " << r.size << ", "
+          << "\"runs\": " << r.runs << ", "
+          << buf << " }"
+          << (i + 1 < results.size() ? ",\n" : "\n");
+   }
+
+   out << "  ]\n";
+   out << "}\n";
+}
+
+bool parse_args(int argc, char **argv)
+{
+   for (int i = 1; i < argc; i++) {
+
+      if (!strcmp(argv[i], "--quick")) {
+         options.quick = true;
+      } else if (!strcmp(argv[i], "--filter") && i + 1 < argc) {
+         options.filter = argv[++i];
+      } else if (!strcmp(argv[i], "--json") && i + 1 < argc) {
+         options.jsonFile = argv[++i];
+         options.table = options.jsonFile == "-" ? stderr : stdout;
+      } else {
+         cerr << "Usage: " << argv[0] << " [--quick] [--filter <text>] [--json <file>]\n";
+         return false;
+      }
+   }
+
+   return true;
+}
+
+int main(int argc, char **argv) {
+
+   if (!parse_args(argc, argv))
+      return 1;
+
+   const bool quick = options.quick;
+
+   fprintf(options.table, "%-18s %-22s %5s %6s %12s %12s\n",
+           "benchmark", "type", "size", "runs", "median (ms)", "p99 (ms)");
+
+   bench_matrix_algorithms<double>("fast_vmatrix",
+      quick ? vector<int>{ 64, 128 } : vector<int>{ 64, 128, 256, 512 });
+
+   bench_matrix_algorithms<vmatrix::number_type>("vmatrix",
+      quick ? vector<int>{ 16 } : vector<int>{ 16, 32, 64 });
+
+   bench_matrix_algorithms<small_frac>("frac<int32_t,double>",
+      quick ? vector<int>{ 16 } : vector<int>{ 16, 32, 64 });
+
+   const int scalars = quick ? 1 << 12 : 1 << 16;
+
+   bench_scalar_arithmetic<small_frac>("frac<int32_t,double>", scalars);
+   bench_scalar_arithmetic<frac<long long, long double>>("frac<int64_t,ldouble>", scalars);
+   bench_scalar_arithmetic<vmatrix::number_type>("complex_frac", scalars);
+
+   if (!options.jsonFile.empty()) {
+
+      if (options.jsonFile == "-") {
+         write_json(cout);
+      } else {
+
+         ofstream out(options.jsonFile);
+
+         if (!out) {
+            cerr << "Can't write " << options.jsonFile << "\n";
+            return 1;
+         }
+
+         write_json(out);
+      }
+   }
+
+   return 0;
+}
@@ -0,0 +1,275 @@
+
+#pragma once
+
+#include <string>
+#include <cmath>
+#include <stdexcept>
+
+#include "util.h"
+#include "bigint.h"
+
+namespace vmatrixlib {
+
+/*
+ * An exact fraction num/den of two bigints.
+ *
+ * Unlike frac, bigfrac never falls back to floating point: when the
+ * numbers grow, the bigints just use more limbs. As long as they fit in
+ * 64 bits, bigint keeps them inline and the arithmetic costs about as much
+ * as frac<long long, long double>'s.
+ *
+ * Invariant: the fraction is always in lowest terms and den > 0.
+ */
+class bigfrac {
+
+public:
+
+   typedef bigint integer_type;
+   typedef long double float_type;
+
+protected:
+
+   bigint num;
+   bigint den;
+
+   // Builds a fraction already in lowest terms with den > 0.
+   static bigfrac make_reduced(bigint n, bigint d) {
+      bigfrac res;
+      res.num = std::move(n);
+      res.den = std::move(d);
+      return res;
+   }
+
+public:
+
+   bigfrac() : num(0), den(1) { }
+   bigfrac(int n) : num(n), den(1) { }
+   bigfrac(long n) : num(n), den(1) { }
+   bigfrac(long long n) : num(n), den(1) { }
+   bigfrac(const bigint& n) : num(n), den(1) { }
+
+   bigfrac(const bigint& n, const bigint& d) : num(n), den(d)
+   {
+      if (d.is_zero()) {
+         throw std::domain_error("Division by zero!");
+      }
+
+      semplify();
+   }
+
+   /*
+    * Like frac, keeps 'precision' decimal digits, so that 0.1 becomes 1/10
+    * and not its binary approximation. Numbers too big for float_to_frac()
+    * keep just their integer part, converted exactly.
+    */
+   bigfrac(long double number, int precision = 6) : bigfrac()
+   {
+      long long n, d;
+
+      if (float_to_frac(number, n, d, precision)) {
+         num = n;
+         den = d;
+         semplify();
+      } else {
+         num = bigint::from_float(number);
+      }
+   }
+
+   bigfrac(double number, int precision = 6)
+      : bigfrac(static_cast<long double>(number), precision) { }
+
+   bigfrac operator+(const bigfrac& f2) const;
+   bigfrac operator-(const bigfrac& f2) const { return operator+(-f2); }
+   bigfrac operator*(const bigfrac& f2) const;
+   bigfrac operator/(const bigfrac& f2) const;
+
+   bigfrac operator-() const { return make_reduced(-num, den); }
+
+   // Both fractions are in lowest terms: equal only if identical.
+   bool operator==(const bigfrac& f2) const {
+      return num == f2.num && den == f2.den;
+   }
+
+   bool operator!=(const bigfrac& f2) const { return !operator==(f2); }
+
+   bool operator<(const bigfrac& f2) const {
+      return den == f2.den ? num < f2.num : num * f2.den < f2.num * den;
+   }
+
+   bool operator>(const bigfrac& f2) const { return f2 < *this; }
+   bool operator<=(const bigfrac& f2) const { return !(f2 < *this); }
+   bool operator>=(const bigfrac& f2) const { return !(*this < f2); }
+
+   bigfrac& operator+=(const bigfrac& f2) { return *this = operator+(f2); }
+   bigfrac& operator-=(const bigfrac& f2) { return *this = operator-(f2); }
+   bigfrac& operator*=(const bigfrac& f2) { return *this = operator*(f2); }
+   bigfrac& operator/=(const bigfrac& f2) { return *this = operator/(f2); }
+
+   bool is_zero() const { return num.is_zero(); }
+   bool is_integer() const { return den.is_one(); }
+
+   const bigint& int_numerator() const { return num; }
+   const bigint& int_denominator() const { return den; }
+
+   float_type numerator() const { return num.to_float(); }
+   float_type denominator() const { return den.to_float(); }
+
+   float_type fpval() const;
+
+   explicit operator float_type() const { return fpval(); }
+
+   void semplify();
+};
+
+
+inline void bigfrac::semplify()
+{
+   if (den.sign() < 0) {
+      num = -num;
+      den = -den;
+   }
+
+   if (den.is_one())
+      return;
+
+   const bigint d = gcd(num, den);
+
+   if (!d.is_one()) {
+      num /= d;
+      den /= d;
+   }
+}
+
+/*
+ * Numerator and denominator can be way out of the long double range even
+ * when their ratio isn't: scale them separately.
+ */
+inline bigfrac::float_type bigfrac::fpval() const
+{
+   if (den.is_one())
+      return num.to_float();
+
+   int en, ed;
+   const float_type mn = num.to_float(&en);
+   const float_type md = den.to_float(&ed);
+
+   return ldexpl(mn / md, en - ed);
+}
+
+/*
+ * Same algorithm as frac::operator+ (Knuth, TAOCP vol. 2, 4.5.1), without
+ * the overflow checks.
+ */
+inline bigfrac bigfrac::operator+(const bigfrac& f2) const
+{
+   if (den == f2.den) {
+
+      bigint n = num + f2.num;
+
+      if (den.is_one())
+         return make_reduced(std::move(n), den);
+
+      if (n.is_zero())
+         return bigfrac();
+
+      const bigint g = gcd(n, den);
+      return make_reduced(n / g, den / g);
+   }
+
+   const bigint g = gcd(den, f2.den);
+
+   if (g.is_one())
+      return make_reduced(num * f2.den + f2.num * den, den * f2.den);
+
+   const bigint bg = den / g;
+   bigint t = num * (f2.den / g) + f2.num * bg;
+
+   if (t.is_zero())
+      return bigfrac();
+
+   const bigint g2 = gcd(t, g);
+   return make_reduced(t / g2, bg * (f2.den / g2));
+}
+
+inline bigfrac bigfrac::operator*(const bigfrac& f2) const
+{
+   if (num.is_zero() || f2.num.is_zero())
+      return bigfrac();
+
+   if (den.is_one() && f2.den.is_one())
+      return make_reduced(num * f2.num, den);
+
+   const bigint g1 = gcd(num, f2.den);
+   const bigint g2 = gcd(f2.num, den);
+
+   return make_reduced((num / g1) * (f2.num / g2),
+                       (den / g2) * (f2.den / g1));
+}
+
+inline bigfrac bigfrac::operator/(const bigfrac& f2) const
+{
+   if (f2.num.is_zero())
+      throw std::domain_error("Division by zero!");
+
+   const bigfrac inv = f2.num.sign() > 0 ? make_reduced(f2.den, f2.num)
+                                         : make_reduced(-f2.den, -f2.num);
+   return operator*(inv);
+}
+
+
+// On integers, the exact division needs no gcd().
+inline bigfrac fraction_free_step(const bigfrac& a, const bigfrac& b,
+                                  const bigfrac& p, const bigfrac& f,
+                                  const bigfrac& d)
+{
+   if (a.is_integer() && b.is_integer() && p.is_integer() &&
+       f.is_integer() && d.is_integer())
+   {
+      bigint q, r;
+
+      bigint::divmod(a.int_numerator() * p.int_numerator() -
+                     b.int_numerator() * f.int_numerator(),
+                     d.int_numerator(), &q, &r);
+
+      if (r.is_zero())
+         return bigfrac(q);
+   }
+
+   return (a * p - b * f) / d;
+}
+
+
+inline bigfrac denominators_lcm(const bigfrac& l, const bigfrac& x)
+{
+   if (x.is_integer())
+      return l;
+
+   const bigint& a = l.int_numerator();
+   const bigint& b = x.int_denominator();
+
+   return bigfrac(a / gcd(a, b) * b);
+}
+
+template <>
+struct fp_type_of<bigfrac> {
+   typedef bigfrac::float_type type;
+};
+
+inline bigfrac::float_type numerator(const bigfrac& val) {
+   return val.numerator();
+}
+
+inline bigfrac::float_type denominator(const bigfrac& val) {
+   return val.denominator();
+}
+
+inline std::string to_string(const bigfrac& f, int /* precision */ = 6)
+{
+   if (f.int_denominator().is_one())
+      return f.int_numerator().to_string();
+
+   return f.int_numerator().to_string() + "/" +
+          f.int_denominator().to_string();
+}
+
+} // namespace vmatrixlib
@@ -0,0 +1,636 @@
+
+#pragma once
+
+#include <cmath>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <stdexcept>
+#include <algorithm>
+
+#include "util.h"
+
+namespace vmatrixlib {
+
+/*
+ * Arbitrary-precision signed integer.
+ *
+ * Values which fit in an int64_t (by far the most common case in matrix
+ * elimination) are stored inline, in _small, and every operation between
+ * two of them is a couple of overflow-checked machine instructions. Only
+ * when a result doesn't fit, its magnitude is stored in _mag as base 2^32
+ * limbs (least significant first), with the sign in _neg. Results are
+ * always brought back to the inline form when they fit again.
+ */
+
+class bigint {
+
+public:
+
+   typedef std::vector<uint32_t> mag_type;
+
+   bigint() : _small(0), _neg(false) { }
+   bigint(int v) : _small(v), _neg(false) { }
+   bigint(long v) : _small(v), _neg(false) { }
+   bigint(long long v) : _small(v), _neg(false) { }
+
+   bool is_small() const { return _mag.empty(); }
+   int64_t small_value() const { return _small; }
+
+   bool is_zero() const { return is_small() && _small == 0; }
+   bool is_one() const { return is_small() && _small == 1; }
+
+   int sign() const {
+
+      if (is_small())
+         return _small > 0 ? 1 : (_small < 0 ? -1 : 0);
+
+      return _neg ? -1 : 1;
+   }
+
+   // Number of significant bits of the magnitude.
+   int bit_length() const;
+
+   bigint operator-() const;
+   bigint abs() const { return sign() < 0 ? -*this : *this; }
+
+   bigint operator+(const bigint& b) const;
+   bigint operator-(const bigint& b) const;
+   bigint operator*(const bigint& b) const;
+   bigint operator/(const bigint& b) const;
+   bigint operator%(const bigint& b) const;
+
+   bigint& operator+=(const bigint& b) { return *this = *this + b; }
+   bigint& operator-=(const bigint& b) { return *this = *this - b; }
+   bigint& operator*=(const bigint& b) { return *this = *this * b; }
+   bigint& operator/=(const bigint& b) { return *this = *this / b; }
+   bigint& operator%=(const bigint& b) { return *this = *this % b; }
+
+   bool operator==(const bigint& b) const;
+   bool operator!=(const bigint& b) const { return !operator==(b); }
+   bool operator<(const bigint& b) const { return compare(b) < 0; }
+   bool operator<=(const bigint& b) const { return compare(b) <= 0; }
+   bool operator>(const bigint& b) const { return compare(b) > 0; }
+   bool operator>=(const bigint& b) const { return compare(b) >= 0; }
+
+   int compare(const bigint& b) const;
+
+   // Truncated division: q = a / b, r = a % b (sign of a), like for ints.
+   static void divmod(const bigint& a, const bigint& b, bigint *q, bigint *r);
+
+   /*
+    * Returns m, setting *exp, such that the value is about m * 2^(*exp).
+    * Unlike a plain conversion, it never overflows a long double.
+    */
+   long double to_float(int *exp) const;
+   long double to_float() const;
+
+   std::string to_string() const;
+
+   // Exact conversion of the integer part of a finite floating point value.
+   static bigint from_float(long double v);
+
+private:
+
+   int64_t _small;
+   mag_type _mag;
+   bool _neg;
+
+   static bigint from_mag(mag_type m, bool neg);
+   mag_type magnitude() const;
+
+   static int mag_cmp(const mag_type& a, const mag_type& b);
+   static mag_type mag_add(const mag_type& a, const mag_type& b);
+   static mag_type mag_sub(const mag_type& a, const mag_type& b);
+   static mag_type mag_mul(const mag_type& a, const mag_type& b);
+   static uint32_t mag_divmod_small(mag_type& a, uint32_t d);
+   static void mag_divmod(const mag_type& u, const mag_type& v,
+                          mag_type *q, mag_type *r);
+   static void mag_trim(mag_type& m);
+
+   static int clz32(uint32_t x) {
+
+      int n = 0;
+
+      while (!(x & 0x80000000u)) {
+         x <<= 1;
+         n++;
+      }
+
+      return n;
+   }
+};
+
+
+inline void bigint::mag_trim(mag_type& m)
+{
+   while (!m.empty() && m.back() == 0)
+      m.pop_back();
+}
+
+/*
+ * Builds a bigint from a magnitude, bringing it back to the inline form
+ * when it fits in an int64_t (INT64_MIN included).
+ */
+inline bigint bigint::from_mag(mag_type m, bool neg)
+{
+   mag_trim(m);
+
+   bigint res;
+
+   if (m.size() <= 2) {
+
+      const uint64_t v = m.empty() ? 0 :
+         (m.size() == 1 ? m[0] : (static_cast<uint64_t>(m[1]) << 32) | m[0]);
+
+      if (v <= static_cast<uint64_t>(INT64_MAX)) {
+         res._small = neg ? -static_cast<int64_t>(v) : static_cast<int64_t>(v);
+         return res;
+      }
+
+      // -2^63 fits too: equal values must have the same form for ==.
+      if (neg && v == static_cast<uint64_t>(INT64_MAX) + 1) {
+         res._small = INT64_MIN;
+         return res;
+      }
+   }
+
+   res._mag = std::move(m);
+   res._neg = neg;
+   return res;
+}
+
+inline bigint::mag_type bigint::magnitude() const
+{
+   if (!is_small())
+      return _mag;
+
+   // INT64_MIN is handled going through the unsigned type.
+   const uint64_t v = _small < 0 ? 0 - static_cast<uint64_t>(_small)
+                                 : static_cast<uint64_t>(_small);
+   mag_type m;
+
+   if (v) {
+      m.push_back(static_cast<uint32_t>(v));
+
+      if (v >> 32)
+         m.push_back(static_cast<uint32_t>(v >> 32));
+   }
+
+   return m;
+}
+
+inline int bigint::bit_length() const
+{
+   const mag_type m = magnitude();
+
+   if (m.empty())
+      return 0;
+
+   return static_cast<int>(m.size()) * 32 - clz32(m.back());
+}
+
+inline int bigint::mag_cmp(const mag_type& a, const mag_type& b)
+{
+   if (a.size() != b.size())
+      return a.size() < b.size() ? -1 : 1;
+
+   for (size_t i = a.size(); i-- > 0; ) {
+      if (a[i] != b[i])
+         return a[i] < b[i] ? -1 : 1;
+   }
+
+   return 0;
+}
+
+inline bigint::mag_type bigint::mag_add(const mag_type& a, const mag_type& b)
+{
+   const mag_type& l = a.size() >= b.size() ? a : b;
+   const mag_type& s = a.size() >= b.size() ? b : a;
+
+   mag_type res(l.size() + 1);
+   uint64_t carry = 0;
+
+   for (size_t i = 0; i < l.size(); i++) {
+      const uint64_t t = carry + l[i] + (i < s.size() ? s[i] : 0);
+      res[i] = static_cast<uint32_t>(t);
+      carry = t >> 32;
+   }
+
+   res[l.size()] = static_cast<uint32_t>(carry);
+   mag_trim(res);
+   return res;
+}
+
+// Requires a >= b.
+inline bigint::mag_type bigint::mag_sub(const mag_type& a, const mag_type& b)
+{
+   mag_type res(a.size());
+   int64_t borrow = 0;
+
+   for (size_t i = 0; i < a.size(); i++) {
+
+      int64_t t = static_cast<int64_t>(a[i]) - borrow - (i < b.size() ? b[i] : 0);
+      borrow = 0;
+
+      if (t < 0) {
+         t += static_cast<int64_t>(1) << 32;
+         borrow = 1;
+      }
+
+      res[i] = static_cast<uint32_t>(t);
+   }
+
+   mag_trim(res);
+   return res;
+}
+
+inline bigint::mag_type bigint::mag_mul(const mag_type& a, const mag_type& b)
+{
+   if (a.empty() || b.empty())
+      return mag_type();
+
+   mag_type res(a.size() + b.size());
+
+   for (size_t i = 0; i < a.size(); i++) {
+
+      uint64_t carry = 0;
+
+      for (size_t j = 0; j < b.size(); j++) {
+         const uint64_t t =
+            static_cast<uint64_t>(a[i]) * b[j] + res[i + j] + carry;
+         res[i + j] = static_cast<uint32_t>(t);
+         carry = t >> 32;
+      }
+
+      res[i + b.size()] = static_cast<uint32_t>(carry);
+   }
+
+   mag_trim(res);
+   return res;
+}
+
+// a /= d, returns the remainder.
+inline uint32_t bigint::mag_divmod_small(mag_type& a, uint32_t d)
+{
+   uint64_t rem = 0;
+
+   for (size_t i = a.size(); i-- > 0; ) {
+      const uint64_t cur = (rem << 32) | a[i];
+      a[i] = static_cast<uint32_t>(cur / d);
+      rem = cur % d;
+   }
+
+   mag_trim(a);
+   return static_cast<uint32_t>(rem);
+}
+
+/*
+ * Long division of magnitudes, Knuth's algorithm D (TAOCP vol. 2, 4.3.1),
+ * as presented in Hacker's Delight (divmnu).
+ */
+inline void bigint::mag_divmod(const mag_type& u, const mag_type& v,
+                               mag_type *q, mag_type *r)
+{
+   if (v.empty())
+      throw std::domain_error("Division by zero!");
+
+   if (mag_cmp(u, v) < 0) {
+      *q = mag_type();
+      *r = u;
+      return;
+   }
+
+   if (v.size() == 1) {
+      *q = u;
+      const uint32_t rem = mag_divmod_small(*q, v[0]);
+      *r = rem ? mag_type(1, rem) : mag_type();
+      return;
+   }
+
+   const int m = static_cast<int>(u.size());
+   const int n = static_cast<int>(v.size());
+   const int s = clz32(v[n - 1]);
+
+   // Normalize: shift so that the top limb of the divisor has its MSB set.
+   mag_type vn(n), un(m + 1);
+
+   for (int i = n - 1; i > 0; i--)
+      vn[i] = (v[i] << s) | (s ? v[i - 1] >> (32 - s) : 0);
+
+   vn[0] = v[0] << s;
+
+   un[m] = s ? u[m - 1] >> (32 - s) : 0;
+
+   for (int i = m - 1; i > 0; i--)
+      un[i] = (u[i] << s) | (s ? u[i - 1] >> (32 - s) : 0);
+
+   un[0] = u[0] << s;
+
+   q->assign(m - n + 1, 0);
+
+   const uint64_t base = static_cast<uint64_t>(1) << 32;
+
+   for (int j = m - n; j >= 0; j--) {
+
+      const uint64_t num = (static_cast<uint64_t>(un[j + n]) << 32) | un[j + n - 1];
+      uint64_t qhat = num / vn[n - 1];
+      uint64_t rhat = num % vn[n - 1];
+
+      while (qhat >= base ||
+             qhat * vn[n - 2] > ((rhat << 32) | un[j + n - 2]))
+      {
+         qhat--;
+         rhat += vn[n - 1];
+
+         if (rhat >= base)
+            break;
+      }
+
+      // Multiply and subtract.
+      int64_t k = 0, t;
+
+      for (int i = 0; i < n; i++) {
+         const uint64_t p = qhat * vn[i];
+         t = static_cast<int64_t>(un[i + j]) - k -
+             static_cast<int64_t>(p & 0xFFFFFFFFu);
+         un[i + j] = static_cast<uint32_t>(t);
+         k = static_cast<int64_t>(p >> 32) - (t >> 32);
+      }
+
+      t = static_cast<int64_t>(un[j + n]) - k;
+      un[j + n] = static_cast<uint32_t>(t);
+      (*q)[j] = static_cast<uint32_t>(qhat);
+
+      if (t < 0) {
+
+         // qhat was one too big: add the divisor back.
+         (*q)[j]--;
+         uint64_t c = 0;
+
+         for (int i = 0; i < n; i++) {
+            const uint64_t tt = static_cast<uint64_t>(un[i + j]) + vn[i] + c;
+            un[i + j] = static_cast<uint32_t>(tt);
+            c = tt >> 32;
+         }
+
+         un[j + n] = static_cast<uint32_t>(un[j + n] + c);
+      }
+   }
+
+   // Unnormalize the remainder.
+   r->assign(n, 0);
+
+   for (int i = 0; i < n - 1; i++)
+      (*r)[i] = (un[i] >> s) | (s ? un[i + 1] << (32 - s) : 0);
+
+   (*r)[n - 1] = un[n - 1] >> s;
+
+   mag_trim(*q);
+   mag_trim(*r);
+}
+
+inline bigint bigint::operator-() const
+{
+   if (is_small() && _small != INT64_MIN) {
+      bigint res;
+      res._small = -_small;
+      return res;
+   }
+
+   return from_mag(magnitude(), sign() > 0);
+}
+
+inline bigint bigint::operator+(const bigint& b) const
+{
+   if (is_small() && b.is_small()) {
+
+      bigint res;
+
+      if (!add_overflow(_small, b._small, &res._small))
+         return res;
+   }
+
+   const mag_type ma = magnitude(), mb = b.magnitude();
+   const bool na = sign() < 0, nb = b.sign() < 0;
+
+   if (na == nb)
+      return from_mag(mag_add(ma, mb), na);
+
+   // Different signs: subtract the smaller magnitude from the bigger one.
+   if (mag_cmp(ma, mb) >= 0)
+      return from_mag(mag_sub(ma, mb), na);
+
+   return from_mag(mag_sub(mb, ma), nb);
+}
+
+inline bigint bigint::operator-(const bigint& b) const
+{
+   if (is_small() && b.is_small()) {
+
+      bigint res;
+
+      if (!sub_overflow(_small, b._small, &res._small))
+         return res;
+   }
+
+   return *this + (-b);
+}
+
+inline bigint bigint::operator*(const bigint& b) const
+{
+   if (is_small() && b.is_small()) {
+
+      bigint res;
+
+      if (!mul_overflow(_small, b._small, &res._small))
+         return res;
+   }
+
+   return from_mag(mag_mul(magnitude(), b.magnitude()),
+                   (sign() < 0) != (b.sign() < 0));
+}
+
+inline void bigint::divmod(const bigint& a, const bigint& b,
+                           bigint *q, bigint *r)
+{
+   if (b.is_zero())
+      throw std::domain_error("Division by zero!");
+
+   if (a.is_small() && b.is_small() &&
+       !(a._small == INT64_MIN && b._small == -1))
+   {
+      if (q) *q = bigint(static_cast<long long>(a._small / b._small));
+      if (r) *r = bigint(static_cast<long long>(a._small % b._small));
+      return;
+   }
+
+   mag_type mq, mr;
+   mag_divmod(a.magnitude(), b.magnitude(), &mq, &mr);
+
+   if (q) *q = from_mag(std::move(mq), (a.sign() < 0) != (b.sign() < 0));
+   if (r) *r = from_mag(std::move(mr), a.sign() < 0);
+}
+
+inline bigint bigint::operator/(const bigint& b) const
+{
+   bigint q;
+   divmod(*this, b, &q, nullptr);
+   return q;
+}
+
+inline bigint bigint::operator%(const bigint& b) const
+{
+   bigint r;
+   divmod(*this, b, nullptr, &r);
+   return r;
+}
+
+inline bool bigint::operator==(const bigint& b) const
+{
+   if (is_small() != b.is_small())
+      return false;
+
+   if (is_small())
+      return _small == b._small;
+
+   return _neg == b._neg && _mag == b._mag;
+}
+
+inline int bigint::compare(const bigint& b) const
+{
+   if (is_small() && b.is_small())
+      return _small < b._small ? -1 : (_small > b._small ? 1 : 0);
+
+   const int sa = sign(), sb = b.sign();
+
+   if (sa != sb)
+      return sa < sb ? -1 : 1;
+
+   const int c = mag_cmp(magnitude(), b.magnitude());
+   return sa >= 0 ? c : -c;
+}
+
+inline long double bigint::to_float(int *exp) const
+{
+   if (is_small()) {
+      *exp = 0;
+      return static_cast<long double>(_small);
+   }
+
+   // The top three limbs are more than enough for a long double mantissa.
+   const size_t n = _mag.size();
+   long double m = 0;
+
+   for (size_t i = 0; i < 3 && i < n; i++)
+      m = m * 4294967296.0L + _mag[n - 1 - i];
+
+   *exp = 32 * static_cast<int>(n - std::min<size_t>(n, 3));
+   return _neg ? -m : m;
+}
+
+inline long double bigint::to_float() const
+{
+   int exp;
+   const long double m = to_float(&exp);
+   return ldexpl(m, exp);
+}
+
+inline std::string bigint::to_string() const
+{
+   if (is_small())
+      return std::to_string(static_cast<long long>(_small));
+
+   mag_type m = _mag;
+   std::string res;
+
+   // Peel off 9 decimal digits at a time.
+   while (!m.empty()) {
+
+      uint32_t chunk = mag_divmod_small(m, 1000000000u);
+
+      for (int i = 0; i < 9; i++) {
+
+         res.push_back(static_cast<char>('0' + chunk % 10));
+         chunk /= 10;
+
+         if (m.empty() && chunk == 0)
+            break;
+      }
+   }
+
+   if (_neg)
+      res.push_back('-');
+
+   std::reverse(res.begin(), res.end());
+   return res;
+}
+
+inline bigint bigint::from_float(long double v)
+{
+   v = truncl(v);
+
+   if (fabsl(v) < 9.2e18L)
+      return bigint(static_cast<long long>(v));
+
+   int exp;
+   const long double frac = frexpl(fabsl(v), &exp);
+
+   // frac * 2^64 is integer as long as long double has <= 64 mantissa bits.
+   const uint64_t mant = static_cast<uint64_t>(ldexpl(frac, 64));
+   mag_type m(2);
+   m[0] = static_cast<uint32_t>(mant);
+   m[1] = static_cast<uint32_t>(mant >> 32);
+
+   bigint res = from_mag(m, v < 0);
+   exp -= 64;
+
+   // Multiply (or divide) by 2^exp, 16 bits at a time.
+   for (; exp >= 16; exp -= 16)
+      res = res * bigint(65536);
+
+   if (exp > 0)
+      res = res * bigint(1LL << exp);
+
+   for (; exp <= -16; exp += 16)
+      res = res / bigint(65536);
+
+   if (exp < 0)
+      res = res / bigint(1LL << -exp);
+
+   return res;
+}
+
+/*
+ * Euclid's algorithm on bigints, falling back to the binary gcd on machine
+ * integers as soon as both values fit in an int64_t.
+ */
+inline bigint gcd(bigint a, bigint b)
+{
+   a = a.abs();
+   b = b.abs();
+
+   while (!b.is_zero()) {
+
+      if (a.is_small() && b.is_small() &&
+          a.small_value() != INT64_MIN && b.small_value() != INT64_MIN)
+      {
+         return bigint(static_cast<long long>(
+            gcd<int64_t>(a.small_value(), b.small_value())
+         ));
+      }
+
+      bigint r = a % b;
+      a = std::move(b);
+      b = std::move(r);
+   }
+
+   return a;
+}
+
+inline std::string to_string(const bigint& n)
+{
+   return n.to_string();
+}
+
+} // namespace vmatrixlib
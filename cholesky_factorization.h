@@ -0,0 +1,477 @@
+
+#pragma once
+
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include <type_traits>
+
+#include "matrix.h"
+
+namespace vmatrixlib {
+
+/*
+ * Factorizations of symmetric matrices, which read only the lower triangle
+ * of A and store their factor there:
+ *
+ *    - cholesky_factorization: A = L*L^T, for positive definite matrices of
+ *      a floating point type. Blocked.
+ *    - ldlt_factorization: A = L*D*L^T with a unit lower triangular L, for
+ *      any number type, exact ones included since no square root is needed.
+ *      It requires non-zero leading principal minors (no pivoting), which
+ *      is always the case for positive definite matrices.
+ *
+ * Both cost about half of an LU factorization: n^3/3 operations instead
+ * of 2n^3/3, and only half of the matrix is ever touched.
+ */
+
+// Columns of a block in the blocked Cholesky.
+constexpr const int cholesky_block = 64;
+
+template <class T>
+class cholesky_factorization {
+
+public:
+
+   explicit cholesky_factorization(const matrix<T>& a);
+   explicit cholesky_factorization(matrix<T>&& a);
+
+   int size() const { return _l.rows(); }
+   bool is_positive_definite() const { return _positiveDefinite; }
+
+   // L, with zeros above the diagonal.
+   const matrix<T>& lower() const { return _l; }
+
+   T determinant() const;
+
+   matrix<T> solve(const matrix<T>& b) const;
+   matrix<T> solve_many(const matrix<T>& b) const;
+   matrix<T> inverse() const;
+
+protected:
+
+   matrix<T> _l;
+   bool _positiveDefinite;
+
+   void factorize();
+   bool factorize_block(int k, int nb);
+};
+
+template <class T>
+class ldlt_factorization {
+
+public:
+
+   explicit ldlt_factorization(const matrix<T>& a);
+   explicit ldlt_factorization(matrix<T>&& a);
+
+   int size() const { return _ld.rows(); }
+
+   // A zero leading principal minor stops the factorization.
+   bool has_zero_pivot() const { return _zeroPivot; }
+
+   // L (unit diagonal) below the diagonal and D on it.
+   const matrix<T>& packed() const { return _ld; }
+
+   matrix<T> lower() const;
+   matrix<T> diagonal() const;
+
+   T determinant() const;
+
+   matrix<T> solve(const matrix<T>& b) const;
+   matrix<T> solve_many(const matrix<T>& b) const;
+   matrix<T> inverse() const;
+
+protected:
+
+   matrix<T> _ld;
+   bool _zeroPivot;
+
+   void factorize();
+};
+
+
+/*
+ * Forward and back substitution with L and L^T, for all the columns of X
+ * at once, whole rows at a time. With a unit diagonal, L's diagonal is not
+ * read.
+ */
+template <class T>
+void lower_triangular_solve(const matrix<T>& l, matrix<T>& x, bool unitDiag)
+{
+   const int n = l.rows();
+   const int k = x.cols();
+
+   for (int i=0; i < n; i++) {
+
+      T *xi = &x(i,0);
+      const T *li = &l(i,0);
+
+      for (int j=0; j < i; j++) {
+
+         if (li[j] == 0)
+            continue;
+
+         const T *xj = &x(j,0);
+
+         for (int c=0; c < k; c++)
+            xi[c] -= li[j] * xj[c];
+      }
+
+      if (!unitDiag)
+         x.in_place_div_row(i, li[i]);
+   }
+}
+
+template <class T>
+void lower_transposed_solve(const matrix<T>& l, matrix<T>& x, bool unitDiag)
+{
+   const int n = l.rows();
+   const int k = x.cols();
+
+   // L^T is upper triangular: row i of X is final once divided, then it
+   // is subtracted from the rows above.
+   for (int i=n-1; i >= 0; i--) {
+
+      if (!unitDiag)
+         x.in_place_div_row(i, l(i,i));
+
+      const T *xi = &x(i,0);
+      const T *li = &l(i,0);
+
+      for (int j=0; j < i; j++) {
+
+         if (li[j] == 0)
+            continue;
+
+         T *xj = &x(j,0);
+
+         for (int c=0; c < k; c++)
+            xj[c] -= li[j] * xi[c];
+      }
+   }
+}
+
+
+template <class T>
+cholesky_factorization<T>::cholesky_factorization(const matrix<T>& a)
+   : _l(a), _positiveDefinite(true)
+{
+   factorize();
+}
+
+template <class T>
+cholesky_factorization<T>::cholesky_factorization(matrix<T>&& a)
+   : _l(std::move(a)), _positiveDefinite(true)
+{
+   factorize();
+}
+
+/*
+ * Right-looking blocked algorithm: for each block column, factor the
+ * diagonal block, solve for the block below it, then subtract its outer
+ * product from the lower triangle of the trailing matrix (a matrix
+ * product, with gemm_add, by blocks of rows in parallel).
+ */
+template <class T>
+void cholesky_factorization<T>::factorize()
+{
+   static_assert(std::is_floating_point<T>::value,
+                 "Cholesky factorization requires a floating point type, use ldlt_factorization");
+
+   if (!_l.is_square())
+      throw std::domain_error("Cholesky factorization can be computed only for square matrices");
+
+   const int n = size();
+   const int nb = cholesky_block;
+   std::vector<T> w;
+
+   for (int k=0; k < n && _positiveDefinite; k += nb) {
+
+      const int b = std::min(nb, n - k);
+      const int rest = n - k - b;
+
+      if (!factorize_block(k, b)) {
+         _positiveDefinite = false;
+         break;
+      }
+
+      if (rest == 0)
+         break;
+
+      // A21 := A21 * L11^-T, row by row.
+      const int grain = std::max(1, parallel_grain<T>::value / (b * b));
+
+      parallel_for(k + b, n, grain, [this, k, b](int rb, int re) {
+
+         for (int i=rb; i < re; i++) {
+
+            T *row = &_l(i,k);
+
+            for (int j=0; j < b; j++) {
+
+               const T *lj = &_l(k + j, k);
+               T s = row[j];
+
+               for (int p=0; p < j; p++)
+                  s -= row[p] * lj[p];
+
+               row[j] = s / lj[j];
+            }
+         }
+      });
+
+      // A22 -= A21 * A21^T, lower triangle only.
+      w.resize(static_cast<size_t>(rest) * b);
+
+      for (int i=0; i < rest; i++)
+         for (int j=0; j < b; j++)
+            w[i * b + j] = -_l(k + b + i, k + j);
+
+      const int blocks = (rest + nb - 1) / nb;
+
+      parallel_for(0, blocks, 1, [this, &w, k, b, n, nb, rest](int bb, int be) {
+
+         for (int blk=bb; blk < be; blk++) {
+
+            const int r0 = blk * nb;
+            const int rows = std::min(nb, rest - r0);
+
+            gemm_add(rows, r0 + rows, b,
+                     &w[r0 * b], b, 1,
+                     &_l(k + b, k), 1, n,
+                     &_l(k + b + r0, k + b), n);
+         }
+      });
+   }
+
+   // Clear what's left of A above the diagonal.
+   for (int i=0; i < n; i++)
+      for (int j=i+1; j < n; j++)
+         _l(i,j) = T(0);
+}
+
+// Unblocked, row by row, on the diagonal block starting at (k, k).
+template <class T>
+bool cholesky_factorization<T>::factorize_block(int k, int nb)
+{
+   for (int i=0; i < nb; i++) {
+
+      T *li = &_l(k + i, k);
+
+      for (int j=0; j < i; j++) {
+
+         const T *lj = &_l(k + j, k);
+         T s = li[j];
+
+         for (int p=0; p < j; p++)
+            s -= li[p] * lj[p];
+
+         li[j] = s / lj[j];
+      }
+
+      T d = li[i];
+
+      for (int p=0; p < i; p++)
+         d -= li[p] * li[p];
+
+      if (!(d > 0))
+         return false;
+
+      li[i] = std::sqrt(d);
+   }
+
+   return true;
+}
+
+template <class T>
+T cholesky_factorization<T>::determinant() const
+{
+   if (!_positiveDefinite)
+      throw std::runtime_error("The matrix is not positive definite");
+
+   const T d = _l.diagonal_product();
+   return d * d;
+}
+
+template <class T>
+matrix<T> cholesky_factorization<T>::solve(const matrix<T>& b) const
+{
+   if (b.cols() != 1)
+      throw std::domain_error("The right-hand side must be a column vector");
+
+   return solve_many(b);
+}
+
+template <class T>
+matrix<T> cholesky_factorization<T>::solve_many(const matrix<T>& b) const
+{
+   if (b.rows() != size())
+      throw std::domain_error("The right-hand side must have as many rows as the system matrix");
+
+   if (!_positiveDefinite)
+      throw std::runtime_error("The matrix is not positive definite");
+
+   matrix<T> x = b;
+
+   lower_triangular_solve(_l, x, false);
+   lower_transposed_solve(_l, x, false);
+
+   return x;
+}
+
+template <class T>
+matrix<T> cholesky_factorization<T>::inverse() const
+{
+   matrix<T> id(size(), size());
+   id.make_identity();
+
+   return solve_many(id);
+}
+
+
+template <class T>
+ldlt_factorization<T>::ldlt_factorization(const matrix<T>& a)
+   : _ld(a), _zeroPivot(false)
+{
+   factorize();
+}
+
+template <class T>
+ldlt_factorization<T>::ldlt_factorization(matrix<T>&& a)
+   : _ld(std::move(a)), _zeroPivot(false)
+{
+   factorize();
+}
+
+/*
+ * Row by row: with w(p) = L(i,p) * D(p),
+ *
+ *    L(i,j) = (A(i,j) - sum_{p<j} w(p) * L(j,p)) / D(j)
+ *    D(i)   =  A(i,i) - sum_{p<i} w(p) * L(i,p)
+ *
+ * Both rows i and j are walked along their elements.
+ */
+template <class T>
+void ldlt_factorization<T>::factorize()
+{
+   if (!_ld.is_square())
+      throw std::domain_error("LDL^T factorization can be computed only for square matrices");
+
+   const int n = size();
+   std::vector<T> w(n);
+
+   for (int i=0; i < n; i++) {
+
+      T *li = &_ld(i,0);
+
+      for (int j=0; j < i; j++) {
+
+         const T *lj = &_ld(j,0);
+         T s = li[j];
+
+         for (int p=0; p < j; p++)
+            if (w[p] != 0 && lj[p] != 0)
+               s -= w[p] * lj[p];
+
+         w[j] = s;
+         li[j] = s == 0 ? T(0) : s / lj[j];
+      }
+
+      T d = li[i];
+
+      for (int p=0; p < i; p++)
+         if (w[p] != 0 && li[p] != 0)
+            d -= w[p] * li[p];
+
+      li[i] = d;
+
+      if (d == 0) {
+         _zeroPivot = true;
+         return;
+      }
+
+      for (int j=i+1; j < n; j++)
+         li[j] = T(0);
+   }
+}
+
+template <class T>
+matrix<T> ldlt_factorization<T>::lower() const
+{
+   const int n = size();
+   matrix<T> res(n, n);
+
+   for (int i=0; i < n; i++) {
+
+      for (int j=0; j < i; j++)
+         res(i,j) = _ld(i,j);
+
+      res(i,i) = 1;
+   }
+
+   return res;
+}
+
+template <class T>
+matrix<T> ldlt_factorization<T>::diagonal() const
+{
+   const int n = size();
+   matrix<T> res(n, n);
+
+   for (int i=0; i < n; i++)
+      res(i,i) = _ld(i,i);
+
+   return res;
+}
+
+template <class T>
+T ldlt_factorization<T>::determinant() const
+{
+   if (_zeroPivot)
+      throw std::runtime_error("Zero pivot in LDL^T factorization: use LU");
+
+   return _ld.diagonal_product();
+}
+
+template <class T>
+matrix<T> ldlt_factorization<T>::solve(const matrix<T>& b) const
+{
+   if (b.cols() != 1)
+      throw std::domain_error("The right-hand side must be a column vector");
+
+   return solve_many(b);
+}
+
+template <class T>
+matrix<T> ldlt_factorization<T>::solve_many(const matrix<T>& b) const
+{
+   if (b.rows() != size())
+      throw std::domain_error("The right-hand side must have as many rows as the system matrix");
+
+   if (_zeroPivot)
+      throw std::runtime_error("Zero pivot in LDL^T factorization: use LU");
+
+   matrix<T> x = b;
+
+   lower_triangular_solve(_ld, x, true);
+
+   for (int i=0; i < size(); i++)
+      x.in_place_div_row(i, _ld(i,i));
+
+   lower_transposed_solve(_ld, x, true);
+
+   return x;
+}
+
+template <class T>
+matrix<T> ldlt_factorization<T>::inverse() const
+{
+   matrix<T> id(size(), size());
+   id.make_identity();
+
+   return solve_many(id);
+}
+
+} // namespace vmatrixlib
@@ -0,0 +1,624 @@
+
+#pragma once
+
+#include <mutex>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <stdexcept>
+
+#include "matrix.h"
+
+namespace vmatrixlib {
+
+/*
+ * Structure-of-arrays storage for matrices of complex_frac<frac<I, F>>.
+ *
+ * matrix<T> stores each element as a whole T: for vmatrix, two frac objects
+ * of num, den and a long double fn each, that is 64 bytes per element,
+ * mostly unused. Here, instead, every field lives in its own contiguous
+ * array:
+ *
+ *    - the numerators and denominators of the real parts
+ *    - the numerators and denominators of the imaginary parts, allocated
+ *      only when some element has a non-zero imaginary part
+ *    - one byte of fp-fallback flags per element, allocated only when some
+ *      element uses floating point. For such a part, the numerator is the
+ *      index of its value in a separate pool, whose freed slots are reused.
+ *
+ * A real, exact matrix takes 16 bytes per element (with I = long long).
+ *
+ * Since no element exists as a T object, get() and operator() return by
+ * value and elements are written with set(). The product, the elimination
+ * (make_triangular), determinant() and rank() run directly on the arrays,
+ * with the frac arithmetic alone while the matrices are real; they give
+ * the results of the matrix<T> ones. For everything else, convert to a
+ * matrix: compact matrices are matrix expressions, so vmatrix m = c; just
+ * works, and so does c = m;
+ */
+
+template <class integerT, class floatT>
+class compact_complex_matrix
+   : public matrix_expr<compact_complex_matrix<integerT, floatT>>
+{
+
+public:
+
+   typedef integerT integer_type;
+   typedef floatT float_type;
+   typedef frac<integer_type, float_type> frac_type;
+   typedef complex_frac<frac_type> number_type;
+
+   compact_complex_matrix() : _rows(0), _cols(0) { }
+   compact_complex_matrix(int rows, int cols);
+
+   template <class E>
+   compact_complex_matrix(const matrix_expr<E>& e);
+
+   template <class E>
+   compact_complex_matrix& operator=(const matrix_expr<E>& e);
+
+   int rows() const { return _rows; }
+   int cols() const { return _cols; }
+   int size() const { return _rows * _cols; }
+
+   number_type get(int r, int c) const;
+   void set(int r, int c, const number_type& val);
+
+   number_type operator()(int r, int c) const { return get(r, c); }
+
+   // As a matrix_expr: its own storage never overlaps a matrix's.
+   bool aliases(const void *, const void *) const { return false; }
+
+   compact_complex_matrix operator*(const compact_complex_matrix& m) const;
+
+   void swap_rows(int i, int j);
+   void in_place_make_triangular() { int swaps; eliminate(swaps); }
+   compact_complex_matrix make_triangular() const;
+
+   number_type determinant() const;
+   int rank() const;
+
+   bool is_real() const { return _imNum.empty(); }
+   bool is_using_fp() const { return !_fpFlags.empty(); }
+
+   // Releases the arrays which are no longer needed.
+   void shrink();
+
+   size_t memory_bytes() const;
+
+protected:
+
+   enum : uint8_t {
+      re_fp = 1 << 0,
+      im_fp = 1 << 1
+   };
+
+   int _rows;
+   int _cols;
+
+   std::vector<integer_type> _reNum;
+   std::vector<integer_type> _reDen;
+   std::vector<integer_type> _imNum;
+   std::vector<integer_type> _imDen;
+   std::vector<uint8_t> _fpFlags;
+   std::vector<float_type> _fpValues;
+   std::vector<integer_type> _fpFree;     // unused slots of _fpValues
+
+   size_t index(int r, int c) const {
+      assert(r >= 0 && r < _rows && c >= 0 && c < _cols);
+      return static_cast<size_t>(r) * _cols + c;
+   }
+
+   bool is_fp(size_t i, uint8_t flag) const {
+      return !_fpFlags.empty() && (_fpFlags[i] & flag);
+   }
+
+   // A part using fp is never zero: frac stores an fp zero as 0/1.
+   bool is_exact_zero_at(size_t i) const {
+      return !is_fp(i, re_fp) && _reNum[i] == 0 &&
+             (_imNum.empty() || (!is_fp(i, im_fp) && _imNum[i] == 0));
+   }
+
+   // As x == 0 for the pivots of matrix<T>: fp parts compare with an epsilon.
+   bool is_zero_at(size_t i) const {
+
+      if (!_fpFlags.empty() && _fpFlags[i])
+         return get_at(i) == number_type();
+
+      return is_exact_zero_at(i);
+   }
+
+   frac_type load_re(size_t i) const {
+      return load(_reNum, _reDen, i, re_fp);
+   }
+
+   number_type get_at(size_t i) const;
+   void set_at(size_t i, const number_type& val);
+
+   // As matrix<T>::in_place_make_triangular(): returns the rank.
+   int eliminate(int& swaps);
+
+   // As matrix<T>::fraction_free_elimination(false, &scale): returns the rank.
+   int fraction_free_eliminate(number_type& scale, int& swaps);
+
+   frac_type load(const std::vector<integer_type>& num,
+                  const std::vector<integer_type>& den,
+                  size_t i, uint8_t flag) const;
+
+   void store(std::vector<integer_type>& num,
+              std::vector<integer_type>& den,
+              size_t i, uint8_t flag, const frac_type& f);
+};
+
+// Compact version of vmatrix.
+typedef compact_complex_matrix<long long, long double> compact_vmatrix;
+
+// Expression nodes must refer to compact matrices, not copy them.
+template <class I, class F>
+struct matrix_expr_operand<compact_complex_matrix<I, F>> {
+   typedef const compact_complex_matrix<I, F>& type;
+};
+
+
+template <class I, class F>
+compact_complex_matrix<I, F>::compact_complex_matrix(int rows, int cols)
+   : _rows(rows), _cols(cols),
+     _reNum(static_cast<size_t>(rows) * cols, 0),
+     _reDen(static_cast<size_t>(rows) * cols, 1)
+{
+   if (rows < 0 || cols < 0)
+      throw std::domain_error("Invalid matrix size");
+}
+
+template <class I, class F>
+template <class E>
+compact_complex_matrix<I, F>::compact_complex_matrix(const matrix_expr<E>& expr)
+   : compact_complex_matrix(expr.rows(), expr.cols())
+{
+   const E& e = expr.derived();
+
+   for (int r=0; r < _rows; r++)
+      for (int c=0; c < _cols; c++)
+         set(r, c, e(r, c));
+}
+
+// The expression may refer to *this: it's evaluated in a new matrix.
+template <class I, class F>
+template <class E>
+compact_complex_matrix<I, F>&
+compact_complex_matrix<I, F>::operator=(const matrix_expr<E>& expr)
+{
+   return *this = compact_complex_matrix(expr);
+}
+
+template <class I, class F>
+typename compact_complex_matrix<I, F>::frac_type
+compact_complex_matrix<I, F>::load(const std::vector<I>& num,
+                                   const std::vector<I>& den,
+                                   size_t i, uint8_t flag) const
+{
+   if (is_fp(i, flag))
+      return frac_type::make_dec_frac(_fpValues[num[i]]);
+
+   return frac_type::make_reduced(num[i], den[i]);
+}
+
+template <class I, class F>
+void compact_complex_matrix<I, F>::store(std::vector<I>& num,
+                                         std::vector<I>& den,
+                                         size_t i, uint8_t flag,
+                                         const frac_type& f)
+{
+   if (f.is_using_fp()) {
+
+      if (_fpFlags.empty())
+         _fpFlags.assign(num.size(), 0);
+
+      // numerator() is the fp value, for a frac using fp.
+      if (_fpFlags[i] & flag) {
+         _fpValues[num[i]] = f.numerator();
+         return;
+      }
+
+      _fpFlags[i] |= flag;
+      den[i] = 1;
+
+      if (!_fpFree.empty()) {
+         num[i] = _fpFree.back();
+         _fpFree.pop_back();
+         _fpValues[num[i]] = f.numerator();
+         return;
+      }
+
+      num[i] = static_cast<I>(_fpValues.size());
+      _fpValues.push_back(f.numerator());
+      return;
+   }
+
+   if (is_fp(i, flag)) {
+      _fpFree.push_back(num[i]);
+      _fpFlags[i] &= ~flag;
+   }
+
+   num[i] = f.int_numerator();
+   den[i] = f.int_denominator();
+}
+
+template <class I, class F>
+typename compact_complex_matrix<I, F>::number_type
+compact_complex_matrix<I, F>::get(int r, int c) const
+{
+   return get_at(index(r, c));
+}
+
+template <class I, class F>
+typename compact_complex_matrix<I, F>::number_type
+compact_complex_matrix<I, F>::get_at(size_t i) const
+{
+   const frac_type re = load_re(i);
+
+   if (_imNum.empty())
+      return number_type(re);
+
+   return number_type(re, load(_imNum, _imDen, i, im_fp));
+}
+
+template <class I, class F>
+void compact_complex_matrix<I, F>::set(int r, int c, const number_type& val)
+{
+   set_at(index(r, c), val);
+}
+
+template <class I, class F>
+void compact_complex_matrix<I, F>::set_at(size_t i, const number_type& val)
+{
+   const frac_type im = val.imag_part();
+
+   store(_reNum, _reDen, i, re_fp, val.real_part());
+
+   if (_imNum.empty()) {
+
+      if (im.is_zero())
+         return;
+
+      _imNum.assign(_reNum.size(), 0);
+      _imDen.assign(_reNum.size(), 1);
+   }
+
+   store(_imNum, _imDen, i, im_fp, im);
+}
+
+/*
+ * Drops the imaginary arrays if all the imaginary parts became zero, and
+ * the fp flags and pool if no element uses fp anymore (or just compacts
+ * the pool, whose free slots are otherwise only reused).
+ */
+template <class I, class F>
+void compact_complex_matrix<I, F>::shrink()
+{
+   if (!_fpFlags.empty()) {
+
+      std::vector<F> pool;
+
+      for (size_t i=0; i < _fpFlags.size(); i++) {
+
+         if (_fpFlags[i] & re_fp) {
+            pool.push_back(_fpValues[_reNum[i]]);
+            _reNum[i] = static_cast<I>(pool.size() - 1);
+         }
+
+         if (_fpFlags[i] & im_fp) {
+            pool.push_back(_fpValues[_imNum[i]]);
+            _imNum[i] = static_cast<I>(pool.size() - 1);
+         }
+      }
+
+      _fpValues.swap(pool);
+      _fpValues.shrink_to_fit();
+      std::vector<I>().swap(_fpFree);
+   }
+
+   if (!_imNum.empty()) {
+
+      bool real = true;
+
+      for (size_t i=0; i < _imNum.size() && real; i++) {
+
+         const bool fp = !_fpFlags.empty() && (_fpFlags[i] & im_fp);
+         real = !fp && _imNum[i] == 0;
+      }
+
+      if (real) {
+         std::vector<I>().swap(_imNum);
+         std::vector<I>().swap(_imDen);
+      }
+   }
+
+   if (_fpValues.empty())
+      std::vector<uint8_t>().swap(_fpFlags);
+}
+
+template <class I, class F>
+size_t compact_complex_matrix<I, F>::memory_bytes() const
+{
+   return sizeof(*this) +
+          (_reNum.capacity() + _reDen.capacity() +
+           _imNum.capacity() + _imDen.capacity() + _fpFree.capacity()) * sizeof(I) +
+          _fpFlags.capacity() * sizeof(uint8_t) +
+          _fpValues.capacity() * sizeof(F);
+}
+
+/*
+ * Rows of the result in parallel, each one accumulated in a row of fracs
+ * (or of complex numbers) reading the rows of m in order, then stored.
+ * Storing may use the fp pool, which is shared: it's serialized.
+ */
+template <class I, class F>
+compact_complex_matrix<I, F>
+compact_complex_matrix<I, F>::operator*(const compact_complex_matrix& m) const
+{
+   if (m._rows != _cols)
+      throw std::domain_error("Right matrix must have rows count equals to first matrix's columns count");
+
+   const int n = m._cols;
+   const bool real = is_real() && m.is_real();
+   const int grain = std::max(1, parallel_grain<number_type>::value /
+                                 std::max(1, _cols * n));
+
+   compact_complex_matrix res(_rows, n);
+   std::mutex storeLock;
+
+   parallel_for(0, _rows, grain, [&](int rb, int re) {
+
+      std::vector<frac_type> rowRe(real ? n : 0);
+      std::vector<number_type> row(real ? 0 : n);
+
+      for (int i=rb; i < re; i++) {
+
+         std::fill(rowRe.begin(), rowRe.end(), frac_type());
+         std::fill(row.begin(), row.end(), number_type());
+
+         for (int k=0; k < _cols; k++) {
+
+            const size_t ik = index(i, k);
+            const size_t kb = static_cast<size_t>(k) * n;
+
+            if (is_exact_zero_at(ik))
+               continue;
+
+            if (real) {
+
+               const frac_type a = load_re(ik);
+
+               for (int j=0; j < n; j++)
+                  rowRe[j] += a * m.load_re(kb + j);
+
+            } else {
+
+               const number_type a = get_at(ik);
+
+               for (int j=0; j < n; j++)
+                  row[j] += a * m.get_at(kb + j);
+            }
+         }
+
+         std::lock_guard<std::mutex> guard(storeLock);
+
+         for (int j=0; j < n; j++)
+            res.set_at(res.index(i, j), real ? number_type(rowRe[j]) : row[j]);
+      }
+   });
+
+   return res;
+}
+
+template <class I, class F>
+void compact_complex_matrix<I, F>::swap_rows(int i, int j)
+{
+   const size_t a = index(i, 0), b = index(j, 0);
+
+   auto swap_in = [this, a, b](auto& v) {
+      if (!v.empty())
+         std::swap_ranges(v.begin() + a, v.begin() + a + _cols, v.begin() + b);
+   };
+
+   swap_in(_reNum);
+   swap_in(_reDen);
+   swap_in(_imNum);
+   swap_in(_imDen);
+   swap_in(_fpFlags);
+}
+
+template <class I, class F>
+int compact_complex_matrix<I, F>::eliminate(int& swaps)
+{
+   int i = 0;
+   swaps = 0;
+
+   for (int j=0; i < _rows && j < _cols; j++) {
+
+      int k = i;
+
+      while (k < _rows && is_zero_at(index(k, j)))
+         k++;
+
+      if (k == _rows)
+         continue;
+
+      if (k != i) {
+         swap_rows(k, i);
+         swaps++;
+      }
+
+      for (int u=i+1; u < _rows; u++) {
+
+         const size_t uj = index(u, j);
+
+         if (is_zero_at(uj))
+            continue;
+
+         // Row u += row i * (-A(u,j) / A(i,j)), with frac operations alone
+         // while the matrix is real (a real pivot keeps it real).
+         if (is_real()) {
+
+            const frac_type f = -load_re(uj) / load_re(index(i, j));
+
+            for (int c=j+1; c < _cols; c++) {
+               const size_t uc = index(u, c);
+               store(_reNum, _reDen, uc, re_fp, load_re(uc) + load_re(index(i, c)) * f);
+            }
+
+         } else {
+
+            number_type a = get_at(uj);
+            const number_type f = -a / get_at(index(i, j));
+
+            for (int c=j+1; c < _cols; c++) {
+               const size_t uc = index(u, c);
+               set_at(uc, get_at(uc) + get_at(index(i, c)) * f);
+            }
+         }
+
+         set_at(uj, number_type());
+      }
+
+      i++;
+   }
+
+   return i;
+}
+
+/*
+ * Fraction-free (Bareiss) elimination, the one determinant() and rank() of
+ * matrix<T> use for exact types: see matrix.h. Unlike there, the rows are
+ * updated serially, since reading the fp pool while it grows isn't safe.
+ */
+template <class I, class F>
+int compact_complex_matrix<I, F>::fraction_free_eliminate(number_type& scale, int& swaps)
+{
+   const bool real = is_real();
+   scale = number_type::one();
+   swaps = 0;
+
+   // Rows scaled to integers, when their denominators' lcm fits.
+   for (int i=0; i < _rows; i++) {
+
+      number_type k = number_type::one();
+
+      for (int j=0; j < _cols; j++)
+         k = denominators_lcm(k, get_at(index(i, j)));
+
+      if (k == number_type::one())
+         continue;
+
+      for (int j=0; j < _cols; j++)
+         set_at(index(i, j), get_at(index(i, j)) * k);
+
+      scale *= k;
+   }
+
+   number_type prev = number_type::one();
+   frac_type prevRe = frac_type::make_reduced(1, 1);
+   int r = 0;
+
+   for (int c=0; c < _cols && r < _rows; c++) {
+
+      int p = r;
+
+      while (p < _rows && is_zero_at(index(p, c)))
+         p++;
+
+      if (p == _rows)
+         continue;
+
+      if (p != r) {
+         swap_rows(p, r);
+         swaps++;
+      }
+
+      if (real) {
+
+         const frac_type pivot = load_re(index(r, c));
+
+         for (int i=r+1; i < _rows; i++) {
+
+            const frac_type f = load_re(index(i, c));
+
+            for (int j=c+1; j < _cols; j++) {
+               const size_t ij = index(i, j);
+               store(_reNum, _reDen, ij, re_fp,
+                     fraction_free_step(load_re(ij), load_re(index(r, j)), pivot, f, prevRe));
+            }
+
+            set_at(index(i, c), number_type());
+         }
+
+         prevRe = pivot;
+
+      } else {
+
+         const number_type pivot = get_at(index(r, c));
+
+         for (int i=r+1; i < _rows; i++) {
+
+            const number_type f = get_at(index(i, c));
+
+            for (int j=c+1; j < _cols; j++) {
+               const size_t ij = index(i, j);
+               set_at(ij, fraction_free_step(get_at(ij), get_at(index(r, j)), pivot, f, prev));
+            }
+
+            set_at(index(i, c), number_type());
+         }
+
+         prev = pivot;
+      }
+
+      r++;
+   }
+
+   return r;
+}
+
+template <class I, class F>
+compact_complex_matrix<I, F> compact_complex_matrix<I, F>::make_triangular() const
+{
+   compact_complex_matrix res = *this;
+   res.in_place_make_triangular();
+   return res;
+}
+
+// The last pivot of the fraction-free elimination, as matrix<T>::determinant().
+template <class I, class F>
+typename compact_complex_matrix<I, F>::number_type
+compact_complex_matrix<I, F>::determinant() const
+{
+   if (_rows != _cols)
+      throw std::domain_error("Determinant can be computed only for square matrices");
+
+   if (_rows == 0)
+      return number_type::one();
+
+   compact_complex_matrix m = *this;
+   number_type scale;
+   int swaps;
+
+   if (m.fraction_free_eliminate(scale, swaps) != _rows)
+      return number_type();
+
+   number_type det = m.get(_rows-1, _cols-1) / scale;
+   return swaps % 2 ? -det : det;
+}
+
+template <class I, class F>
+int compact_complex_matrix<I, F>::rank() const
+{
+   compact_complex_matrix m = *this;
+   number_type scale;
+   int swaps;
+
+   return m.fraction_free_eliminate(scale, swaps);
+}
+
+} // namespace vmatrixlib
@@ -28,19 +28,31 @@ protected:
 
 public:
 
-   complex_frac() : re(0), im(0) { }
+   // frac_type() is zero, without any conversion from int or float.
+   complex_frac() : re(), im() { }
 
-   complex_frac(const frac_type& r) : re(r), im(0.0) { }
+   complex_frac(const frac_type& r) : re(r), im() { }
    complex_frac(const frac_type& r, const frac_type& i) : re(r), im(i) { }
 
    complex_frac neg() { return complex_frac(-re, -im); }
    complex_frac conj() { return complex_frac(re, -im); }
 
+   // Exactly: a tiny fp imaginary part isn't zero.
+   bool is_real() const { return im.is_zero(); }
+
    complex_frac operator+(const complex_frac& c2) const {
+
+      if (is_real() && c2.is_real())
+         return complex_frac(re + c2.re);
+
       return complex_frac(re + c2.re, im + c2.im);
    }
 
    complex_frac operator-(const complex_frac& c2) const {
+
+      if (is_real() && c2.is_real())
+         return complex_frac(re - c2.re);
+
       return complex_frac(re - c2.re, im - c2.im);
    }
 
@@ -57,11 +69,11 @@ public:
    }
 
    bool operator==(const frac_type& c2) const {
-      return operator==(complex_frac(c2));
+      return re == c2 && is_real();
    }
 
    bool operator!=(const frac_type& c2) const {
-      return operator!=(complex_frac(c2));
+      return !operator==(c2);
    }
 
    complex_frac& operator=(const frac_type& n) {
@@ -73,7 +85,7 @@ public:
    }
 
    complex_frac& operator-=(const complex_frac& c2) {
-      return *this = operator+(c2);
+      return *this = operator-(c2);
    }
 
    complex_frac& operator*=(const complex_frac& c2) {
@@ -105,6 +117,21 @@ public:
 };
 
 
+template <class T>
+struct real_type_of<complex_frac<T>> {
+   typedef T type;
+};
+
+template <class T>
+inline T real_part(const complex_frac<T>& c) {
+   return c.real_part();
+}
+
+template <class T>
+inline bool is_real(const complex_frac<T>& c) {
+   return c.is_real();
+}
+
 template <class T>
 inline complex_frac<T> to_frac_in_decimal_form(const complex_frac<T>& c) {
    return complex_frac<T>(to_frac_in_decimal_form(c.real_part()),
@@ -124,14 +151,14 @@ complex_frac<frac_type>::operator*(const complex_frac& c2) const {
 
    frac_type _re, _im;
 
-   if (im == frac_type(0) && c2.im == frac_type(0)) {
-      return complex_frac(re*c2.re, 0);
+   if (is_real() && c2.is_real()) {
+      return complex_frac(re*c2.re);
    }
 
    _re = re*c2.re - im*c2.im;
    _im = im*c2.re + re*c2.im;
 
-   return complex_frac(frac_semplify(_re), frac_semplify(_im));
+   return complex_frac(_re, _im);
 }
 
 template <class frac_type>
@@ -140,8 +167,8 @@ complex_frac<frac_type>::operator/(const complex_frac& c2) const {
 
    frac_type _re, _im, div;
 
-   if (im == frac_type(0) && c2.im == frac_type(0)) {
-      return complex_frac(re / c2.re, 0);
+   if (is_real() && c2.is_real()) {
+      return complex_frac(re / c2.re);
    }
 
    div = (c2.re) * (c2.re) + (c2.im) * (c2.im);
@@ -149,7 +176,38 @@ complex_frac<frac_type>::operator/(const complex_frac& c2) const {
    _re = (re*c2.re + im*c2.im) / div;
    _im = (im*c2.re - re*c2.im) / div;
 
-   return complex_frac(frac_semplify(_re), frac_semplify(_im));
+   return complex_frac(_re, _im);
+}
+
+// Real values use the fraction-free step of frac_type.
+template <class frac_type>
+complex_frac<frac_type>
+fraction_free_step(const complex_frac<frac_type>& a,
+                   const complex_frac<frac_type>& b,
+                   const complex_frac<frac_type>& p,
+                   const complex_frac<frac_type>& f,
+                   const complex_frac<frac_type>& d)
+{
+   if (a.is_real() && b.is_real() && p.is_real() &&
+       f.is_real() && d.is_real())
+   {
+      return fraction_free_step(a.real_part(), b.real_part(),
+                                p.real_part(), f.real_part(),
+                                d.real_part());
+   }
+
+   return (a * p - b * f) / d;
+}
+
+template <class frac_type>
+complex_frac<frac_type>
+denominators_lcm(const complex_frac<frac_type>& l,
+                 const complex_frac<frac_type>& x)
+{
+   return complex_frac<frac_type>(
+      denominators_lcm(denominators_lcm(l.real_part(), x.real_part()),
+                       x.imag_part())
+   );
 }
 
 /*
@@ -12,6 +12,15 @@
 
 namespace vmatrixlib {
 
+/*
+ * A fraction num/den of two integer_type numbers which, when its numerator
+ * or denominator would overflow, falls back to a floating point value (fn).
+ *
+ * Invariant: when not using fp, the fraction is always in lowest terms and
+ * den > 0. The constructors establish it and the operators preserve it
+ * without a final gcd(), by reducing the operands crosswise (Knuth, TAOCP
+ * vol. 2, 4.5.1).
+ */
 template <class integerT, class floatT>
 class frac {
 
@@ -30,12 +39,17 @@ protected:
 
    // static functions
 
+   // The numbers which can't be negated are treated as overflows.
+   static bool out_of_range(integer_type n) {
+      return n == std::numeric_limits<integer_type>::min();
+   }
+
 protected: // methods
 
    frac neg() const {
 
       if (!is_using_fp()) {
-         return frac(-num, den);
+         return make_reduced(-num, den);
       }
 
       frac res;
@@ -57,6 +71,8 @@ public:
       if (d == 0) {
          throw std::domain_error("Division by zero!");
       }
+
+      semplify();
    }
 
    frac(float_type number, int precision = 6) : frac()
@@ -74,6 +90,14 @@ public:
       return res;
    }
 
+   // Builds a fraction already in lowest terms with den > 0.
+   static frac make_reduced(integer_type n, integer_type d) {
+      frac res;
+      res.num = n;
+      res.den = d;
+      return res;
+   }
+
    frac& operator=(const frac& rhs) = default;
 
    frac to_frac_in_decimal_form() const {
@@ -93,9 +117,20 @@ public:
 
    frac operator/(const frac& f2) const {
 
-      frac f22 = !f2.is_using_fp()
-                    ? frac(f2.den, f2.num)
-                    : make_dec_frac(1.0 / f2.fn);
+      frac f22;
+
+      if (f2.is_using_fp()) {
+
+         f22 = make_dec_frac(1.0 / f2.fn);
+
+      } else {
+
+         if (f2.num == 0)
+            throw std::domain_error("Division by zero!");
+
+         f22 = f2.num > 0 ? make_reduced(f2.den, f2.num)
+                          : make_reduced(-f2.den, -f2.num);
+      }
 
       return operator*(f22);
    }
@@ -103,12 +138,30 @@ public:
    frac operator-() const { return neg(); }
 
    bool operator==(const frac& f2) const {
+
+      // Two exact fractions in lowest terms are equal only if identical.
+      if (!is_using_fp() && !f2.is_using_fp())
+         return num == f2.num && den == f2.den;
+
       float_type eps = 10 * std::numeric_limits<float_type>::epsilon();
       return std::abs(fpval() - f2.fpval()) <= eps;
    }
 
+   bool is_zero() const {
+      return !is_using_fp() && num == 0;
+   }
+
+   bool is_integer() const {
+      return !is_using_fp() && den == 1;
+   }
+
    bool operator!=(const frac& f2) const { return !operator==(f2); }
 
+   // Exact matches for comparisons with int literals, which would be
+   // ambiguous with the conversion operators.
+   bool operator==(int n) const { return operator==(make_reduced(n, 1)); }
+   bool operator!=(int n) const { return !operator==(n); }
+
    frac& operator+=(const frac& f2) { return *this = operator+(f2); }
    frac& operator-=(const frac& f2) { return *this = operator-(f2); }
    frac& operator*=(const frac& f2) { return *this = operator*(f2); }
@@ -146,11 +199,22 @@ void frac<integer_type, float_type>::semplify()
       return;
    }
 
+   // Whatever the sign of den: num must stay negatable for neg().
+   if (out_of_range(num) || out_of_range(den)) {
+      fn = static_cast<float_type>(num) / static_cast<float_type>(den);
+      num = 0;
+      den = 1;
+      return;
+   }
+
    if (den < 0) {
       num = -num;
       den = -den;
    }
 
+   if (den == 1)
+      return;
+
    integer_type d = gcd(num, den);
    num /= d;
    den /= d;
@@ -215,61 +279,156 @@ frac_semplify(const frac<integer_type, float_type>& f)
    return f2;
 }
 
+/*
+ * a/b + c/d, with both operands in lowest terms: with g = gcd(b, d),
+ * t = a*(d/g) + c*(b/g) and g2 = gcd(t, g), the sum in lowest terms is
+ * (t/g2) / ((b/g)*(d/g2)). All the integer operations are overflow-checked
+ * and the floating point fallback is computed only on overflow.
+ */
 template <class integer_type, class float_type>
 frac<integer_type, float_type>
 frac<integer_type, float_type>::operator+(const frac& f2) const
 {
-   frac res;
-   frac f11, f22;
-   float_type sum;
+   if (is_using_fp() || f2.is_using_fp())
+      return frac::make_dec_frac(fpval() + f2.fpval());
+
+   const integer_type a = num, b = den;
+   const integer_type c = f2.num, d = f2.den;
+   integer_type n, dd, t1, t2;
+
+   if (b == d) {
 
-   f11 = frac_semplify(*this);
-   f22 = frac_semplify(f2);
+      // Same denominator (integers, most of the times): just reduce by
+      // the gcd of the new numerator and the denominator.
+      if (!add_overflow(a, c, &n) && !out_of_range(n)) {
 
-   sum = to_float(f11) + to_float(f22);
+         if (b == 1)
+            return make_reduced(n, 1);
 
-   if (f11.is_using_fp() || f22.is_using_fp() ||
-       num_out_of_range<integer_type>(sum) ||
-       num_out_of_range<integer_type>(f11.numerator() * f22.denominator()) ||
-       num_out_of_range<integer_type>(f11.numerator() * f22.denominator() +
-       f22.numerator() * f11.denominator())) {
-      return frac::make_dec_frac(sum);
+         const integer_type g = gcd(n, b);
+         return n != 0 ? make_reduced(n / g, b / g) : frac();
+      }
+
+      return frac::make_dec_frac(fpval() + f2.fpval());
    }
 
-   const integer_type num =
-      f11.int_numerator() * f22.int_denominator() +
-      f22.int_numerator() * f11.int_denominator();
+   const integer_type g = gcd(b, d);
 
-   const integer_type den = f11.int_denominator() * f22.int_denominator();
+   if (g == 1) {
 
-   return frac_semplify(frac(num, den));
+      if (!mul_overflow(a, d, &t1) &&
+          !mul_overflow(c, b, &t2) &&
+          !add_overflow(t1, t2, &n) &&
+          !mul_overflow(b, d, &dd) && !out_of_range(n))
+      {
+         return make_reduced(n, dd);
+      }
 
+      return frac::make_dec_frac(fpval() + f2.fpval());
+   }
+
+   const integer_type bg = b / g;
+
+   if (!mul_overflow(a, d / g, &t1) &&
+       !mul_overflow(c, bg, &t2) &&
+       !add_overflow(t1, t2, &n) && !out_of_range(n))
+   {
+      if (n == 0)
+         return frac();
+
+      const integer_type g2 = gcd(n, g);
+
+      if (!mul_overflow(bg, d / g2, &dd))
+         return make_reduced(n / g2, dd);
+   }
+
+   return frac::make_dec_frac(fpval() + f2.fpval());
 }
 
+/*
+ * (a/b) * (c/d), with both operands in lowest terms: reducing a with d and
+ * c with b before multiplying gives the product directly in lowest terms.
+ */
 template <class integer_type, class float_type>
 frac<integer_type, float_type>
 frac<integer_type, float_type>::operator*(const frac& f2) const
 {
-   frac res;
-   frac f11, f22;
-   float_type prod;
+   if (is_using_fp() || f2.is_using_fp())
+      return frac::make_dec_frac(fpval() * f2.fpval());
+
+   if (num == 0 || f2.num == 0)
+      return frac();
 
-   f11 = frac_semplify(*this);
-   f22 = frac_semplify(f2);
+   integer_type n, d;
 
-   prod = to_float(f11) * to_float(f22);
+   if (den == 1 && f2.den == 1) {
 
-   if (f11.is_using_fp() || f22.is_using_fp() ||
-       num_out_of_range<integer_type>(prod) ||
-       num_out_of_range<integer_type>(f11.numerator() * f22.numerator()) ||
-       num_out_of_range<integer_type>(f11.denominator() * f22.denominator())) {
-      return frac::make_dec_frac(prod);
+      if (!mul_overflow(num, f2.num, &n) && !out_of_range(n))
+         return make_reduced(n, 1);
+
+      return frac::make_dec_frac(fpval() * f2.fpval());
+   }
+
+   const integer_type g1 = gcd(num, f2.den);
+   const integer_type g2 = gcd(f2.num, den);
+
+   if (!mul_overflow(num / g1, f2.num / g2, &n) &&
+       !mul_overflow(den / g2, f2.den / g1, &d) && !out_of_range(n))
+   {
+      return make_reduced(n, d);
    }
 
-   const integer_type num = f11.int_numerator() * f22.int_numerator();
-   const integer_type den = f11.int_denominator() * f22.int_denominator();
+   return frac::make_dec_frac(fpval() * f2.fpval());
+}
+
+
+/*
+ * On integers, the fraction-free step is just a few overflow-checked
+ * integer operations, with no gcd() at all. Otherwise, or on overflow, the
+ * operands are divided by d before multiplying, which keeps the
+ * intermediate results about as small as the final one.
+ */
+template <class integer_type, class float_type>
+frac<integer_type, float_type>
+fraction_free_step(const frac<integer_type, float_type>& a,
+                   const frac<integer_type, float_type>& b,
+                   const frac<integer_type, float_type>& p,
+                   const frac<integer_type, float_type>& f,
+                   const frac<integer_type, float_type>& d)
+{
+   typedef frac<integer_type, float_type> frac_type;
+
+   integer_type n;
+
+   if (a.is_integer() && b.is_integer() && p.is_integer() &&
+       f.is_integer() && d.is_integer() &&
+       fraction_free_int_step(a.int_numerator(), b.int_numerator(),
+                              p.int_numerator(), f.int_numerator(),
+                              d.int_numerator(), &n))
+   {
+      return frac_type(n, integer_type(1));
+   }
+
+   return a * (p / d) - b * (f / d);
+}
+
+template <class integer_type, class float_type>
+frac<integer_type, float_type>
+denominators_lcm(const frac<integer_type, float_type>& l,
+                 const frac<integer_type, float_type>& x)
+{
+   if (!l.is_integer() || x.is_using_fp() || x.int_denominator() == 1)
+      return l;
+
+   const integer_type a = l.int_numerator();
+   const integer_type b = x.int_denominator();
+   integer_type res;
+
+   // On overflow, the matrix just won't be made of integers.
+   if (mul_overflow(a / gcd(a, b), b, &res))
+      return l;
 
-   return frac_semplify(frac(num, den));
+   return frac<integer_type, float_type>(res, integer_type(1));
 }
 
 
@@ -0,0 +1,276 @@
+
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <type_traits>
+
+#if defined(__AVX2__) && defined(__FMA__)
+#include <immintrin.h>
+#define VMATRIXLIB_GEMM_AVX2 1
+#endif
+
+namespace vmatrixlib {
+
+/*
+ * Cache-blocked matrix product for arithmetic types.
+ *
+ * gemm_add() computes C += A * B where A is (m x k), B is (k x n) and C is
+ * (m x n). A and B are described by a row and a column stride, so they can
+ * be blocks or transposed views of larger matrices; C is row-major with
+ * leading dimension ldc.
+ *
+ * The loops are organized as in GotoBLAS/BLIS: B is packed panel by panel
+ * (gemm_kc x gemm_nc) in gemm_nr-wide slivers, A is packed block by block
+ * (gemm_mc x gemm_kc) in gemm_mr-tall slivers, and a micro-kernel computes
+ * a gemm_mr x gemm_nr tile of C keeping it in registers for the whole kc
+ * loop. The packed slivers are read contiguously, so the inner loop never
+ * walks down a column of a row-major buffer, whatever the input strides.
+ */
+
+constexpr const int gemm_mr = 4;
+constexpr const int gemm_nr = 8;
+constexpr const int gemm_mc = 96;
+constexpr const int gemm_kc = 256;
+constexpr const int gemm_nc = 4096;
+
+// Below this number of multiply-adds, packing costs more than it saves.
+constexpr const long gemm_small_threshold = 32 * 32 * 32;
+
+
+template <class T>
+void gemm_pack_a(int mc, int kc, const T *a, int rsa, int csa, T *dest)
+{
+   for (int i = 0; i < mc; i += gemm_mr) {
+
+      const int mr = std::min(gemm_mr, mc - i);
+
+      for (int p = 0; p < kc; p++) {
+
+         for (int r = 0; r < mr; r++)
+            *dest++ = a[(i + r) * rsa + p * csa];
+
+         for (int r = mr; r < gemm_mr; r++)
+            *dest++ = T(0);
+      }
+   }
+}
+
+template <class T>
+void gemm_pack_b(int kc, int nc, const T *b, int rsb, int csb, T *dest)
+{
+   for (int j = 0; j < nc; j += gemm_nr) {
+
+      const int nr = std::min(gemm_nr, nc - j);
+
+      for (int p = 0; p < kc; p++) {
+
+         const T *row = b + p * rsb + j * csb;
+
+         if (csb == 1) {
+
+            for (int c = 0; c < nr; c++)
+               *dest++ = row[c];
+
+         } else {
+
+            for (int c = 0; c < nr; c++)
+               *dest++ = row[c * csb];
+         }
+
+         for (int c = nr; c < gemm_nr; c++)
+            *dest++ = T(0);
+      }
+   }
+}
+
+/*
+ * Portable micro-kernel: C[0:mr, 0:nr] += Apack * Bpack.
+ * The fixed-size accumulator lets the compiler keep it in registers and
+ * auto-vectorize the inner loop.
+ */
+template <class T>
+void gemm_micro_kernel(int kc, const T *a, const T *b,
+                       T *c, int ldc, int mr, int nr)
+{
+   T acc[gemm_mr][gemm_nr] = { };
+
+   for (int p = 0; p < kc; p++) {
+
+      for (int r = 0; r < gemm_mr; r++) {
+
+         const T av = a[r];
+
+         for (int q = 0; q < gemm_nr; q++)
+            acc[r][q] += av * b[q];
+      }
+
+      a += gemm_mr;
+      b += gemm_nr;
+   }
+
+   for (int r = 0; r < mr; r++)
+      for (int q = 0; q < nr; q++)
+         c[r * ldc + q] += acc[r][q];
+}
+
+#ifdef VMATRIXLIB_GEMM_AVX2
+
+/*
+ * AVX2/FMA micro-kernel for doubles: the 4x8 tile of C lives in eight
+ * ymm registers, each step broadcasts one element of A and issues two FMAs.
+ */
+inline void gemm_micro_kernel(int kc, const double *a, const double *b,
+                              double *c, int ldc, int mr, int nr)
+{
+   __m256d c00 = _mm256_setzero_pd(), c01 = _mm256_setzero_pd();
+   __m256d c10 = _mm256_setzero_pd(), c11 = _mm256_setzero_pd();
+   __m256d c20 = _mm256_setzero_pd(), c21 = _mm256_setzero_pd();
+   __m256d c30 = _mm256_setzero_pd(), c31 = _mm256_setzero_pd();
+
+   for (int p = 0; p < kc; p++) {
+
+      const __m256d b0 = _mm256_loadu_pd(b);
+      const __m256d b1 = _mm256_loadu_pd(b + 4);
+      __m256d av;
+
+      av = _mm256_broadcast_sd(a + 0);
+      c00 = _mm256_fmadd_pd(av, b0, c00);
+      c01 = _mm256_fmadd_pd(av, b1, c01);
+
+      av = _mm256_broadcast_sd(a + 1);
+      c10 = _mm256_fmadd_pd(av, b0, c10);
+      c11 = _mm256_fmadd_pd(av, b1, c11);
+
+      av = _mm256_broadcast_sd(a + 2);
+      c20 = _mm256_fmadd_pd(av, b0, c20);
+      c21 = _mm256_fmadd_pd(av, b1, c21);
+
+      av = _mm256_broadcast_sd(a + 3);
+      c30 = _mm256_fmadd_pd(av, b0, c30);
+      c31 = _mm256_fmadd_pd(av, b1, c31);
+
+      a += gemm_mr;
+      b += gemm_nr;
+   }
+
+   if (mr == gemm_mr && nr == gemm_nr) {
+
+      double *c0 = c, *c1 = c + ldc, *c2 = c + 2 * ldc, *c3 = c + 3 * ldc;
+
+      _mm256_storeu_pd(c0,     _mm256_add_pd(_mm256_loadu_pd(c0),     c00));
+      _mm256_storeu_pd(c0 + 4, _mm256_add_pd(_mm256_loadu_pd(c0 + 4), c01));
+      _mm256_storeu_pd(c1,     _mm256_add_pd(_mm256_loadu_pd(c1),     c10));
+      _mm256_storeu_pd(c1 + 4, _mm256_add_pd(_mm256_loadu_pd(c1 + 4), c11));
+      _mm256_storeu_pd(c2,     _mm256_add_pd(_mm256_loadu_pd(c2),     c20));
+      _mm256_storeu_pd(c2 + 4, _mm256_add_pd(_mm256_loadu_pd(c2 + 4), c21));
+      _mm256_storeu_pd(c3,     _mm256_add_pd(_mm256_loadu_pd(c3),     c30));
+      _mm256_storeu_pd(c3 + 4, _mm256_add_pd(_mm256_loadu_pd(c3 + 4), c31));
+      return;
+   }
+
+   // Edge tile: spill the accumulators and add only the valid part.
+   double tmp[gemm_mr][gemm_nr];
+
+   _mm256_storeu_pd(&tmp[0][0], c00); _mm256_storeu_pd(&tmp[0][4], c01);
+   _mm256_storeu_pd(&tmp[1][0], c10); _mm256_storeu_pd(&tmp[1][4], c11);
+   _mm256_storeu_pd(&tmp[2][0], c20); _mm256_storeu_pd(&tmp[2][4], c21);
+   _mm256_storeu_pd(&tmp[3][0], c30); _mm256_storeu_pd(&tmp[3][4], c31);
+
+   for (int r = 0; r < mr; r++)
+      for (int q = 0; q < nr; q++)
+         c[r * ldc + q] += tmp[r][q];
+}
+
+#endif // VMATRIXLIB_GEMM_AVX2
+
+
+/*
+ * Straightforward i-k-j product, used for small sizes. Walking B and C
+ * along rows keeps the accesses unit-stride.
+ */
+template <class T>
+void gemm_add_simple(int m, int n, int k,
+                     const T *a, int rsa, int csa,
+                     const T *b, int rsb, int csb,
+                     T *c, int ldc)
+{
+   for (int i = 0; i < m; i++) {
+
+      T *crow = c + i * ldc;
+
+      for (int p = 0; p < k; p++) {
+
+         const T av = a[i * rsa + p * csa];
+         const T *brow = b + p * rsb;
+
+         if (csb == 1) {
+
+            for (int j = 0; j < n; j++)
+               crow[j] += av * brow[j];
+
+         } else {
+
+            for (int j = 0; j < n; j++)
+               crow[j] += av * brow[j * csb];
+         }
+      }
+   }
+}
+
+template <class T>
+void gemm_add(int m, int n, int k,
+              const T *a, int rsa, int csa,
+              const T *b, int rsb, int csb,
+              T *c, int ldc)
+{
+   static_assert(std::is_arithmetic<T>::value,
+                 "gemm_add() requires an arithmetic type");
+
+   if (static_cast<long>(m) * n * k <= gemm_small_threshold) {
+      gemm_add_simple(m, n, k, a, rsa, csa, b, rsb, csb, c, ldc);
+      return;
+   }
+
+   const int nc_max = std::min(gemm_nc, (n + gemm_nr - 1) / gemm_nr * gemm_nr);
+   const int mc_max = std::min(gemm_mc, (m + gemm_mr - 1) / gemm_mr * gemm_mr);
+
+   std::vector<T> bpack(static_cast<size_t>(gemm_kc) * nc_max);
+   std::vector<T> apack(static_cast<size_t>(mc_max) * gemm_kc);
+
+   for (int jc = 0; jc < n; jc += gemm_nc) {
+
+      const int nc = std::min(gemm_nc, n - jc);
+
+      for (int pc = 0; pc < k; pc += gemm_kc) {
+
+         const int kc = std::min(gemm_kc, k - pc);
+
+         gemm_pack_b(kc, nc, b + pc * rsb + jc * csb, rsb, csb, &bpack[0]);
+
+         for (int ic = 0; ic < m; ic += gemm_mc) {
+
+            const int mc = std::min(gemm_mc, m - ic);
+
+            gemm_pack_a(mc, kc, a + ic * rsa + pc * csa, rsa, csa, &apack[0]);
+
+            for (int jr = 0; jr < nc; jr += gemm_nr) {
+
+               const int nr = std::min(gemm_nr, nc - jr);
+               const T *bp = &bpack[0] + jr * kc;
+
+               for (int ir = 0; ir < mc; ir += gemm_mr) {
+
+                  const int mr = std::min(gemm_mr, mc - ir);
+
+                  gemm_micro_kernel(kc, &apack[0] + ir * kc, bp,
+                                    c + (ic + ir) * ldc + jc + jr, ldc,
+                                    mr, nr);
+               }
+            }
+         }
+      }
+   }
+}
+
+} // namespace vmatrixlib
@@ -0,0 +1,329 @@
+
+#pragma once
+
+#include <cmath>
+#include <vector>
+#include <limits>
+#include <algorithm>
+#include <type_traits>
+
+#include "gemm.h"
+
+namespace vmatrixlib {
+
+/*
+ * Householder QR kernels for floating point types.
+ *
+ * As in LAPACK, the matrices are row-major buffers with leading dimension
+ * lda, and a reflector H = I - tau * v * v^T is stored as the part of v
+ * below its first element, which is an implicit 1. After a QR, the
+ * reflectors fill the matrix below the diagonal and R is on and above it.
+ */
+
+// Columns of a panel in the blocked QR.
+constexpr const int householder_block = 32;
+
+
+/*
+ * Computes the reflector which maps x (n elements, stride incx) to
+ * (beta, 0, ..., 0): x(1:) is overwritten with v(1:), and beta returned.
+ * tau = 0 means H = I, when x(1:) is already zero.
+ */
+template <class T>
+T householder_vector(int n, T *x, int incx, T *tau)
+{
+   T xnorm = T(0);
+
+   for (int i=1; i < n; i++)
+      xnorm += x[i * incx] * x[i * incx];
+
+   xnorm = std::sqrt(xnorm);
+
+   const T alpha = x[0];
+
+   if (xnorm == 0) {
+      *tau = T(0);
+      return alpha;
+   }
+
+   const T beta = alpha >= 0 ? -std::hypot(alpha, xnorm)
+                             : std::hypot(alpha, xnorm);
+   const T scale = T(1) / (alpha - beta);
+
+   for (int i=1; i < n; i++)
+      x[i * incx] *= scale;
+
+   *tau = (beta - alpha) / beta;
+   return beta;
+}
+
+/*
+ * A := H * A, with A (m x n) and v (m elements, stride incv). v(0) is
+ * never read: it's the implicit 1. work must have room for n elements.
+ */
+template <class T>
+void householder_apply_left(int m, int n, const T *v, int incv, T tau,
+                            T *a, int lda, T *work)
+{
+   if (tau == 0)
+      return;
+
+   // work = v^T * A, walking A along its rows.
+   std::copy(a, a + n, work);
+
+   for (int i=1; i < m; i++) {
+
+      const T vi = v[i * incv];
+      const T *row = a + i * lda;
+
+      if (vi != 0)
+         for (int j=0; j < n; j++)
+            work[j] += vi * row[j];
+   }
+
+   for (int j=0; j < n; j++)
+      a[j] -= tau * work[j];
+
+   for (int i=1; i < m; i++) {
+
+      const T f = tau * v[i * incv];
+      T *row = a + i * lda;
+
+      if (f != 0)
+         for (int j=0; j < n; j++)
+            row[j] -= f * work[j];
+   }
+}
+
+/*
+ * Unblocked QR of the (m x n) matrix a: one reflector per column, applied
+ * to the columns on its right.
+ */
+template <class T>
+void householder_qr_unblocked(int m, int n, T *a, int lda, T *tau)
+{
+   static_assert(std::is_floating_point<T>::value,
+                 "Householder QR requires a floating point type");
+
+   std::vector<T> work(n);
+   const int k = std::min(m, n);
+
+   for (int j=0; j < k; j++) {
+
+      T *col = a + j * lda + j;
+
+      *col = householder_vector(m - j, col, lda, &tau[j]);
+      householder_apply_left(m - j, n - j - 1, col, lda, tau[j],
+                             col + 1, lda, &work[0]);
+   }
+}
+
+/*
+ * Builds the (k x k) upper triangular T of the compact WY representation
+ * H(0) * H(1) * ... * H(k-1) = I - V * T * V^T, where V (m x k) is the
+ * explicit reflectors matrix (row-major, unit diagonal, zeros above).
+ */
+template <class T>
+void householder_wy_factor(int m, int k, const T *v, const T *tau, T *t)
+{
+   std::fill(t, t + k * k, T(0));
+
+   for (int i=0; i < k; i++) {
+
+      // t(0:i, i) = -tau(i) * T(0:i, 0:i) * V(:, 0:i)^T * v(:, i)
+      std::vector<T> w(i, T(0));
+
+      for (int r=i; r < m; r++) {
+
+         const T vri = v[r * k + i];
+
+         if (vri != 0)
+            for (int c=0; c < i; c++)
+               w[c] += v[r * k + c] * vri;
+      }
+
+      for (int r=0; r < i; r++) {
+
+         T sum = T(0);
+
+         for (int c=r; c < i; c++)
+            sum += t[r * k + c] * w[c];
+
+         t[r * k + i] = -tau[i] * sum;
+      }
+
+      t[i * k + i] = tau[i];
+   }
+}
+
+/*
+ * Blocked QR. Each panel of householder_block columns is factored with
+ * the unblocked algorithm, then its reflectors are applied to the trailing
+ * columns all at once: C := (I - V * T^T * V^T) * C, with two matrix
+ * products (gemm_add) instead of one rank-1 update per reflector.
+ */
+template <class T>
+void householder_qr(int m, int n, T *a, int lda, T *tau)
+{
+   const int k = std::min(m, n);
+   const int nb = householder_block;
+
+   if (k <= nb) {
+      householder_qr_unblocked(m, n, a, lda, tau);
+      return;
+   }
+
+   std::vector<T> v, t, w;
+
+   for (int j=0; j < k; j += nb) {
+
+      const int b = std::min(nb, k - j);
+      const int mp = m - j;
+      const int nt = n - j - b;
+      T *panel = a + j * lda + j;
+
+      householder_qr_unblocked(mp, b, panel, lda, &tau[j]);
+
+      if (nt == 0)
+         continue;
+
+      v.assign(static_cast<size_t>(mp) * b, T(0));
+
+      for (int r=0; r < mp; r++)
+         for (int c=0; c < b && c <= r; c++)
+            v[r * b + c] = r == c ? T(1) : panel[r * lda + c];
+
+      t.resize(b * b);
+      householder_wy_factor(mp, b, &v[0], &tau[j], &t[0]);
+
+      T *c = panel + b;
+
+      // w = V^T * C
+      w.assign(static_cast<size_t>(b) * nt, T(0));
+      gemm_add(b, nt, mp, &v[0], 1, b, c, lda, 1, &w[0], nt);
+
+      // w = -T^T * w, row by row from the bottom (T^T is lower triangular).
+      for (int r=b-1; r >= 0; r--) {
+
+         T *wr = &w[r * nt];
+
+         for (int col=0; col < nt; col++)
+            wr[col] *= -t[r * b + r];
+
+         for (int p=0; p < r; p++) {
+
+            const T f = -t[p * b + r];
+            const T *wp = &w[p * nt];
+
+            for (int col=0; col < nt; col++)
+               wr[col] += f * wp[col];
+         }
+      }
+
+      // C += V * w
+      gemm_add(mp, nt, b, &v[0], b, 1, &w[0], nt, 1, c, lda);
+   }
+}
+
+/*
+ * QR with column pivoting (Businger-Golub): at each step, the remaining
+ * column with the largest norm is moved in front. Then |R(0,0)| >= |R(1,1)|
+ * >= ... and the rank shows up as the point where the diagonal falls
+ * below the tolerance. perm[j] is the column of A which ended up in
+ * column j.
+ *
+ * The column norms are downdated after each step rather than recomputed,
+ * except when cancellation made the downdated value unreliable (LAPACK's
+ * xLAQP2 criterion).
+ */
+template <class T>
+void householder_qr_pivoted(int m, int n, T *a, int lda, T *tau, int *perm)
+{
+   static_assert(std::is_floating_point<T>::value,
+                 "Householder QR requires a floating point type");
+
+   const T tol = std::sqrt(std::numeric_limits<T>::epsilon());
+   const int k = std::min(m, n);
+   std::vector<T> norms(n, T(0)), work(n);
+
+   for (int j=0; j < n; j++)
+      perm[j] = j;
+
+   for (int i=0; i < m; i++)
+      for (int j=0; j < n; j++)
+         norms[j] += a[i * lda + j] * a[i * lda + j];
+
+   for (int j=0; j < n; j++)
+      norms[j] = std::sqrt(norms[j]);
+
+   std::vector<T> norms0 = norms;
+
+   for (int j=0; j < k; j++) {
+
+      const int p = static_cast<int>(
+         std::max_element(norms.begin() + j, norms.end()) - norms.begin());
+
+      if (p != j) {
+
+         for (int i=0; i < m; i++)
+            std::swap(a[i * lda + j], a[i * lda + p]);
+
+         std::swap(perm[j], perm[p]);
+         std::swap(norms[j], norms[p]);
+         std::swap(norms0[j], norms0[p]);
+      }
+
+      T *col = a + j * lda + j;
+
+      *col = householder_vector(m - j, col, lda, &tau[j]);
+      householder_apply_left(m - j, n - j - 1, col, lda, tau[j],
+                             col + 1, lda, &work[0]);
+
+      for (int c=j+1; c < n; c++) {
+
+         if (norms[c] == 0)
+            continue;
+
+         const T ratio = std::abs(a[j * lda + c]) / norms[c];
+         const T f = std::max(T(0), (T(1) - ratio) * (T(1) + ratio));
+         const T q = norms[c] / norms0[c];
+
+         if (f * q * q > tol) {
+            norms[c] *= std::sqrt(f);
+            continue;
+         }
+
+         T s = T(0);
+
+         for (int i=j+1; i < m; i++)
+            s += a[i * lda + c] * a[i * lda + c];
+
+         norms[c] = norms0[c] = std::sqrt(s);
+      }
+   }
+}
+
+/*
+ * Numerical rank from the diagonal of R: the number of elements above
+ * max(m, n) * eps * max|R(i,i)|. Reliable only after a column-pivoted QR.
+ */
+template <class T>
+int householder_rank(int m, int n, const T *a, int lda)
+{
+   const int k = std::min(m, n);
+   T maxDiag = T(0);
+
+   for (int i=0; i < k; i++)
+      maxDiag = std::max(maxDiag, std::abs(a[i * lda + i]));
+
+   const T tol = std::max(m, n) * std::numeric_limits<T>::epsilon() * maxDiag;
+   int r = 0;
+
+   for (int i=0; i < k; i++)
+      if (std::abs(a[i * lda + i]) > tol)
+         r++;
+
+   return r;
+}
+
+} // namespace vmatrixlib
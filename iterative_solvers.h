@@ -0,0 +1,589 @@
+
+#pragma once
+
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include <type_traits>
+
+#include "matrix.h"
+#include "sparse_matrix.h"
+
+namespace vmatrixlib {
+
+/*
+ * Krylov solvers for A*x = b, with A a dense matrix<T> or a sparse_matrix<T>
+ * of a floating point type:
+ *
+ *    - conjugate_gradient(): A must be symmetric positive definite
+ *    - gmres(): restarted GMRES(m), for any non-singular A
+ *    - bicgstab(): for any non-singular A, with memory independent of the
+ *      iterations count
+ *
+ * A is only ever multiplied by vectors, so besides A itself the memory is
+ * O(n) (O(m * n) for GMRES(m)). b and x are column vectors: x is the
+ * initial guess and, on return, the solution.
+ *
+ * The preconditioner M (an approximation of A) is applied as z = M^-1 * r.
+ * GMRES and BiCGSTAB are right-preconditioned, so the residual they check
+ * is always the one of the original system.
+ */
+
+struct iterative_options {
+   double tolerance = 1e-10;     // on ||b - A*x|| / ||b||
+   int max_iterations = 1000;
+   int restart = 30;             // GMRES only
+};
+
+struct iterative_result {
+   bool converged;
+   int iterations;
+   double residual;              // ||b - A*x|| / ||b||
+};
+
+
+template <class T>
+class identity_preconditioner {
+
+public:
+
+   void apply(const T *r, T *z, int n) const {
+      std::copy(r, r + n, z);
+   }
+};
+
+/*
+ * M = diag(A). Cheap, and effective enough for diagonally dominant
+ * matrices.
+ */
+template <class T>
+class jacobi_preconditioner {
+
+public:
+
+   explicit jacobi_preconditioner(const matrix<T>& a);
+   explicit jacobi_preconditioner(const sparse_matrix<T>& a);
+
+   void apply(const T *r, T *z, int n) const {
+      for (int i=0; i < n; i++)
+         z[i] = r[i] * _invDiag[i];
+   }
+
+protected:
+
+   std::vector<T> _invDiag;
+
+   void set_diagonal(int i, const T& d);
+};
+
+/*
+ * Incomplete LU with no fill-in: L*U restricted to the non-zero pattern of
+ * A, which is also where the factors are stored. Every diagonal element of
+ * A must be non-zero.
+ */
+template <class T>
+class ilu0_preconditioner {
+
+public:
+
+   explicit ilu0_preconditioner(const sparse_matrix<T>& a);
+
+   void apply(const T *r, T *z, int n) const;
+
+protected:
+
+   // L (unit diagonal, implicit) and U together, in the CSR pattern of A.
+   std::vector<int> _starts;
+   std::vector<int> _indices;
+   std::vector<T> _values;
+   std::vector<int> _diag;
+};
+
+
+template <class T>
+jacobi_preconditioner<T>::jacobi_preconditioner(const matrix<T>& a)
+   : _invDiag(a.rows())
+{
+   if (a.rows() != a.cols())
+      throw std::domain_error("The preconditioner requires a square matrix");
+
+   for (int i=0; i < a.rows(); i++)
+      set_diagonal(i, a(i,i));
+}
+
+template <class T>
+jacobi_preconditioner<T>::jacobi_preconditioner(const sparse_matrix<T>& a)
+   : _invDiag(a.rows())
+{
+   if (a.rows() != a.cols())
+      throw std::domain_error("The preconditioner requires a square matrix");
+
+   for (int i=0; i < a.rows(); i++)
+      set_diagonal(i, a.get(i, i));
+}
+
+template <class T>
+void jacobi_preconditioner<T>::set_diagonal(int i, const T& d)
+{
+   if (d == 0)
+      throw std::domain_error("Jacobi preconditioner: zero on the diagonal");
+
+   _invDiag[i] = T(1) / d;
+}
+
+template <class T>
+ilu0_preconditioner<T>::ilu0_preconditioner(const sparse_matrix<T>& a)
+   : _diag(a.rows(), -1)
+{
+   if (a.rows() != a.cols())
+      throw std::domain_error("The preconditioner requires a square matrix");
+
+   const sparse_matrix<T> csr = a.to_csr();
+   const int n = a.rows();
+
+   _starts = csr.starts();
+   _indices = csr.indices();
+   _values = csr.values();
+
+   const std::vector<int>& starts = _starts;
+   const std::vector<int>& indices = _indices;
+   std::vector<T>& values = _values;
+
+   // Position of each column in the current row, -1 if not there.
+   std::vector<int> pos(n, -1);
+
+   for (int i=0; i < n; i++) {
+
+      for (int p=starts[i]; p < starts[i+1]; p++) {
+
+         pos[indices[p]] = p;
+
+         if (indices[p] == i)
+            _diag[i] = p;
+      }
+
+      if (_diag[i] == -1)
+         throw std::domain_error("ILU(0): zero on the diagonal");
+
+      // The columns are sorted: the L part of the row comes first.
+      for (int p=starts[i]; p < starts[i+1] && indices[p] < i; p++) {
+
+         const int k = indices[p];
+         const T f = values[p] / values[_diag[k]];
+         values[p] = f;
+
+         for (int q=_diag[k]+1; q < starts[k+1]; q++)
+            if (pos[indices[q]] != -1)
+               values[pos[indices[q]]] -= f * values[q];
+      }
+
+      if (values[_diag[i]] == 0)
+         throw std::runtime_error("ILU(0): zero pivot");
+
+      for (int p=starts[i]; p < starts[i+1]; p++)
+         pos[indices[p]] = -1;
+   }
+}
+
+template <class T>
+void ilu0_preconditioner<T>::apply(const T *r, T *z, int n) const
+{
+   const std::vector<int>& starts = _starts;
+   const std::vector<int>& indices = _indices;
+   const std::vector<T>& values = _values;
+
+   for (int i=0; i < n; i++) {
+
+      T sum = r[i];
+
+      for (int p=starts[i]; p < _diag[i]; p++)
+         sum -= values[p] * z[indices[p]];
+
+      z[i] = sum;
+   }
+
+   for (int i=n-1; i >= 0; i--) {
+
+      T sum = z[i];
+
+      for (int p=_diag[i]+1; p < starts[i+1]; p++)
+         sum -= values[p] * z[indices[p]];
+
+      z[i] = sum / values[_diag[i]];
+   }
+}
+
+
+/*
+ * y = A * x, for the two kinds of matrices the solvers accept.
+ */
+template <class T>
+void apply_operator(const sparse_matrix<T>& a, const T *x, T *y)
+{
+   a.spmv(x, y);
+}
+
+template <class T>
+void apply_operator(const matrix<T>& a, const T *x, T *y)
+{
+   const int n = a.cols();
+   const int grain = std::max(1, parallel_grain<T>::value / std::max(1, n));
+
+   parallel_for(0, a.rows(), grain, [&a, x, y, n](int b, int e) {
+
+      for (int i=b; i < e; i++) {
+
+         const T *row = &a(i,0);
+         T sum = T(0);
+
+         for (int j=0; j < n; j++)
+            sum += row[j] * x[j];
+
+         y[i] = sum;
+      }
+   });
+}
+
+namespace iterative_detail {
+
+template <class T>
+T dot(const std::vector<T>& a, const std::vector<T>& b)
+{
+   T sum = T(0);
+
+   for (size_t i=0; i < a.size(); i++)
+      sum += a[i] * b[i];
+
+   return sum;
+}
+
+template <class T>
+T norm(const std::vector<T>& a) {
+   return std::sqrt(dot(a, a));
+}
+
+// Checks the sizes and returns ||b||, or 1 when b = 0 (absolute residuals).
+template <class M, class T>
+T check_system(const M& a, const matrix<T>& b, matrix<T>& x)
+{
+   static_assert(std::is_floating_point<T>::value,
+                 "Iterative solvers require a floating point type");
+
+   if (a.rows() != a.cols())
+      throw std::domain_error("The system matrix must be square");
+
+   if (b.rows() != a.rows() || b.cols() != 1)
+      throw std::domain_error("The right-hand side must be a column vector with as many rows as the system matrix");
+
+   if (x.rows() != a.rows() || x.cols() != 1)
+      x = matrix<T>(a.rows(), 1);
+
+   T bnorm = T(0);
+
+   for (int i=0; i < b.rows(); i++)
+      bnorm += b(i,0) * b(i,0);
+
+   return bnorm > 0 ? std::sqrt(bnorm) : T(1);
+}
+
+// r = b - A*x
+template <class M, class T>
+void residual(const M& a, const matrix<T>& b, const matrix<T>& x,
+              std::vector<T>& r)
+{
+   apply_operator(a, &x(0,0), r.data());
+
+   for (size_t i=0; i < r.size(); i++)
+      r[i] = b(static_cast<int>(i), 0) - r[i];
+}
+
+} // namespace iterative_detail
+
+
+template <class M, class T, class P>
+iterative_result conjugate_gradient(const M& a, const matrix<T>& b,
+                                    matrix<T>& x, const P& precond,
+                                    const iterative_options& opts = iterative_options())
+{
+   using namespace iterative_detail;
+
+   const T bnorm = check_system(a, b, x);
+   const int n = a.rows();
+   std::vector<T> r(n), z(n), p(n), ap(n);
+   T *xp = &x(0,0);
+
+   residual(a, b, x, r);
+
+   iterative_result res = { false, 0, static_cast<double>(norm(r) / bnorm) };
+
+   if (res.residual <= opts.tolerance) {
+      res.converged = true;
+      return res;
+   }
+
+   precond.apply(r.data(), z.data(), n);
+   p = z;
+   T rz = dot(r, z);
+
+   while (res.iterations < opts.max_iterations) {
+
+      apply_operator(a, p.data(), ap.data());
+
+      const T pap = dot(p, ap);
+
+      if (pap <= 0)
+         throw std::domain_error("Conjugate gradient requires a positive definite matrix");
+
+      const T alpha = rz / pap;
+
+      for (int i=0; i < n; i++) {
+         xp[i] += alpha * p[i];
+         r[i] -= alpha * ap[i];
+      }
+
+      res.iterations++;
+      res.residual = static_cast<double>(norm(r) / bnorm);
+
+      if (res.residual <= opts.tolerance) {
+         res.converged = true;
+         break;
+      }
+
+      precond.apply(r.data(), z.data(), n);
+
+      const T rzNew = dot(r, z);
+      const T beta = rzNew / rz;
+      rz = rzNew;
+
+      for (int i=0; i < n; i++)
+         p[i] = z[i] + beta * p[i];
+   }
+
+   return res;
+}
+
+/*
+ * GMRES(m): at most m steps of Arnoldi (modified Gram-Schmidt) build an
+ * orthonormal basis V of the Krylov space, then x is updated with the
+ * combination of V minimizing the residual and the process restarts. The
+ * small least squares problem with the Hessenberg matrix H is solved
+ * progressively with Givens rotations, which also give the residual norm
+ * at each step for free.
+ */
+template <class M, class T, class P>
+iterative_result gmres(const M& a, const matrix<T>& b, matrix<T>& x,
+                       const P& precond,
+                       const iterative_options& opts = iterative_options())
+{
+   using namespace iterative_detail;
+
+   const T bnorm = check_system(a, b, x);
+   const int n = a.rows();
+   const int m = std::max(1, std::min(opts.restart, n));
+
+   std::vector<std::vector<T>> v(m + 1, std::vector<T>(n));
+   std::vector<T> h((m + 1) * m), cs(m), sn(m), g(m + 1), y(m);
+   std::vector<T> w(n), z(n);
+   T *xp = &x(0,0);
+
+   residual(a, b, x, v[0]);
+
+   T beta = norm(v[0]);
+   iterative_result res = { false, 0, static_cast<double>(beta / bnorm) };
+
+   while (res.residual > opts.tolerance && res.iterations < opts.max_iterations) {
+
+      for (int i=0; i < n; i++)
+         v[0][i] /= beta;
+
+      std::fill(g.begin(), g.end(), T(0));
+      g[0] = beta;
+
+      int k = 0;
+
+      while (k < m && res.iterations < opts.max_iterations) {
+
+         precond.apply(v[k].data(), z.data(), n);
+         apply_operator(a, z.data(), w.data());
+
+         T *hk = &h[k * (m + 1)];   // column k of H
+
+         for (int i=0; i <= k; i++) {
+
+            hk[i] = dot(w, v[i]);
+
+            for (int j=0; j < n; j++)
+               w[j] -= hk[i] * v[i][j];
+         }
+
+         hk[k+1] = norm(w);
+
+         if (hk[k+1] != 0)
+            for (int j=0; j < n; j++)
+               v[k+1][j] = w[j] / hk[k+1];
+
+         for (int i=0; i < k; i++) {
+            const T t = cs[i] * hk[i] + sn[i] * hk[i+1];
+            hk[i+1] = -sn[i] * hk[i] + cs[i] * hk[i+1];
+            hk[i] = t;
+         }
+
+         const T d = std::sqrt(hk[k] * hk[k] + hk[k+1] * hk[k+1]);
+
+         if (d == 0)
+            throw std::runtime_error("GMRES breakdown: singular matrix");
+
+         cs[k] = hk[k] / d;
+         sn[k] = hk[k+1] / d;
+         hk[k] = d;
+         hk[k+1] = 0;
+
+         g[k+1] = -sn[k] * g[k];
+         g[k] *= cs[k];
+
+         k++;
+         res.iterations++;
+         res.residual = static_cast<double>(std::abs(g[k]) / bnorm);
+
+         if (res.residual <= opts.tolerance)
+            break;
+      }
+
+      // H(0:k, 0:k) * y = g(0:k), then x += M^-1 * V * y.
+      for (int i=k-1; i >= 0; i--) {
+
+         T sum = g[i];
+
+         for (int j=i+1; j < k; j++)
+            sum -= h[j * (m + 1) + i] * y[j];
+
+         y[i] = sum / h[i * (m + 1) + i];
+      }
+
+      std::fill(w.begin(), w.end(), T(0));
+
+      for (int i=0; i < k; i++)
+         for (int j=0; j < n; j++)
+            w[j] += y[i] * v[i][j];
+
+      precond.apply(w.data(), z.data(), n);
+
+      for (int j=0; j < n; j++)
+         xp[j] += z[j];
+
+      // The true residual, against the drift of the recurrence.
+      residual(a, b, x, v[0]);
+      beta = norm(v[0]);
+      res.residual = static_cast<double>(beta / bnorm);
+   }
+
+   res.converged = res.residual <= opts.tolerance;
+   return res;
+}
+
+template <class M, class T, class P>
+iterative_result bicgstab(const M& a, const matrix<T>& b, matrix<T>& x,
+                          const P& precond,
+                          const iterative_options& opts = iterative_options())
+{
+   using namespace iterative_detail;
+
+   const T bnorm = check_system(a, b, x);
+   const int n = a.rows();
+   std::vector<T> r(n), rhat(n), p(n, T(0)), v(n, T(0));
+   std::vector<T> phat(n), s(n), shat(n), t(n);
+   T *xp = &x(0,0);
+
+   residual(a, b, x, r);
+   rhat = r;
+
+   T rho = 1, alpha = 1, omega = 1;
+   iterative_result res = { false, 0, static_cast<double>(norm(r) / bnorm) };
+
+   while (res.residual > opts.tolerance && res.iterations < opts.max_iterations) {
+
+      const T rhoNew = dot(rhat, r);
+
+      if (rhoNew == 0 || omega == 0)
+         break;
+
+      const T beta = (rhoNew / rho) * (alpha / omega);
+      rho = rhoNew;
+
+      for (int i=0; i < n; i++)
+         p[i] = r[i] + beta * (p[i] - omega * v[i]);
+
+      precond.apply(p.data(), phat.data(), n);
+      apply_operator(a, phat.data(), v.data());
+
+      // Breakdown (e.g. rhat orthogonal to A p): x is left as it was.
+      const T rhatv = dot(rhat, v);
+
+      if (rhatv == 0)
+         break;
+
+      alpha = rho / rhatv;
+
+      for (int i=0; i < n; i++)
+         s[i] = r[i] - alpha * v[i];
+
+      res.iterations++;
+
+      if (norm(s) / bnorm <= opts.tolerance) {
+
+         for (int i=0; i < n; i++)
+            xp[i] += alpha * phat[i];
+
+         res.residual = static_cast<double>(norm(s) / bnorm);
+         break;
+      }
+
+      precond.apply(s.data(), shat.data(), n);
+      apply_operator(a, shat.data(), t.data());
+
+      const T tt = dot(t, t);
+
+      if (tt == 0)
+         break;
+
+      omega = dot(t, s) / tt;
+
+      for (int i=0; i < n; i++) {
+         xp[i] += alpha * phat[i] + omega * shat[i];
+         r[i] = s[i] - omega * t[i];
+      }
+
+      res.residual = static_cast<double>(norm(r) / bnorm);
+   }
+
+   res.converged = res.residual <= opts.tolerance;
+   return res;
+}
+
+
+/*
+ * Unpreconditioned versions.
+ */
+template <class M, class T>
+iterative_result conjugate_gradient(const M& a, const matrix<T>& b, matrix<T>& x,
+                                    const iterative_options& opts = iterative_options())
+{
+   return conjugate_gradient(a, b, x, identity_preconditioner<T>(), opts);
+}
+
+template <class M, class T>
+iterative_result gmres(const M& a, const matrix<T>& b, matrix<T>& x,
+                       const iterative_options& opts = iterative_options())
+{
+   return gmres(a, b, x, identity_preconditioner<T>(), opts);
+}
+
+template <class M, class T>
+iterative_result bicgstab(const M& a, const matrix<T>& b, matrix<T>& x,
+                          const iterative_options& opts = iterative_options())
+{
+   return bicgstab(a, b, x, identity_preconditioner<T>(), opts);
+}
+
+} // namespace vmatrixlib
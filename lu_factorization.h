@@ -0,0 +1,251 @@
+
+#pragma once
+
+#include "matrix.h"
+
+namespace vmatrixlib {
+
+/*
+ * LU factorization with partial pivoting: P*A = L*U.
+ *
+ * The factorization is computed once and stored compactly in a single
+ * matrix: U on and above the diagonal, the multipliers of the unit lower
+ * triangular L below it. The row permutation P is kept as a vector where
+ * perm[i] is the row of A that ended up in row i.
+ *
+ * After that, every solve() costs just O(n^2) per right-hand side, and
+ * determinant() is O(n).
+ */
+
+template <class T>
+class lu_factorization {
+
+public:
+
+   explicit lu_factorization(const matrix<T>& a);
+   explicit lu_factorization(matrix<T>&& a);
+
+   int size() const { return _lu.rows(); }
+   bool is_singular() const { return _singular; }
+
+   const std::vector<int>& permutation() const { return _perm; }
+   const matrix<T>& packed() const { return _lu; }
+
+   matrix<T> lower() const;
+   matrix<T> upper() const;
+
+   T determinant() const;
+
+   matrix<T> solve(const matrix<T>& b) const;
+   matrix<T> solve_many(const matrix<T>& b) const;
+   matrix<T> inverse() const;
+
+protected:
+
+   matrix<T> _lu;
+   std::vector<int> _perm;
+   int _rowSwapsCount;
+   bool _singular;
+
+   void factorize();
+};
+
+
+template <class T>
+lu_factorization<T>::lu_factorization(const matrix<T>& a)
+   : _lu(a), _rowSwapsCount(0), _singular(false)
+{
+   factorize();
+}
+
+template <class T>
+lu_factorization<T>::lu_factorization(matrix<T>&& a)
+   : _lu(std::move(a)), _rowSwapsCount(0), _singular(false)
+{
+   factorize();
+}
+
+template <class T>
+void lu_factorization<T>::factorize() {
+
+   if (!_lu.is_square())
+      throw std::domain_error("LU factorization can be computed only for square matrices");
+
+   const int n = _lu.rows();
+
+   _perm.resize(n);
+
+   for (int i=0; i < n; i++)
+      _perm[i] = i;
+
+   for (int k=0; k < n; k++) {
+
+      const int p = _lu.find_pivot_in_col(k, k);
+
+      if (p == -1) {
+         // The whole column is zero below the diagonal: nothing to eliminate.
+         _singular = true;
+         continue;
+      }
+
+      if (p != k) {
+         _lu.swap_rows(p, k);
+         std::swap(_perm[p], _perm[k]);
+         _rowSwapsCount++;
+      }
+
+      const T pivot = _lu(k,k);
+      const T *pivotRow = &_lu(k,0);
+      const int grain =
+         std::max(1, parallel_grain<T>::value / std::max(1, n - k));
+
+      parallel_for(k+1, n, grain, [this, k, n, &pivot, pivotRow](int b, int e) {
+
+         for (int i=b; i < e; i++) {
+
+            T *row = &_lu(i,0);
+
+            if (row[k] == 0)
+               continue;
+
+            const T l = row[k] / pivot;
+            row[k] = l;
+
+            for (int j=k+1; j < n; j++)
+               row[j] -= l * pivotRow[j];
+         }
+      });
+   }
+}
+
+template <class T>
+matrix<T> lu_factorization<T>::lower() const {
+
+   const int n = size();
+   matrix<T> res(n, n);
+
+   for (int i=0; i < n; i++) {
+
+      for (int j=0; j < i; j++)
+         res(i,j) = _lu(i,j);
+
+      res(i,i) = 1;
+   }
+
+   return res;
+}
+
+template <class T>
+matrix<T> lu_factorization<T>::upper() const {
+
+   const int n = size();
+   matrix<T> res(n, n);
+
+   for (int i=0; i < n; i++)
+      for (int j=i; j < n; j++)
+         res(i,j) = _lu(i,j);
+
+   return res;
+}
+
+template <class T>
+T lu_factorization<T>::determinant() const {
+
+   if (_singular)
+      return T(0);
+
+   T det = _lu.diagonal_product();
+
+   if ((_rowSwapsCount % 2) == 0)
+      return det;
+
+   return -det;
+}
+
+template <class T>
+matrix<T> lu_factorization<T>::solve(const matrix<T>& b) const {
+
+   if (b.cols() != 1)
+      throw std::domain_error("The right-hand side must be a column vector");
+
+   return solve_many(b);
+}
+
+/*
+ * Solves A*X = B for all the columns of B at once. The substitutions are
+ * done with whole-row operations on X, which walks both X and the packed
+ * factors along their rows.
+ */
+template <class T>
+matrix<T> lu_factorization<T>::solve_many(const matrix<T>& b) const {
+
+   const int n = size();
+   const int k = b.cols();
+
+   if (b.rows() != n)
+      throw std::domain_error("The right-hand side must have as many rows as the system matrix");
+
+   if (_singular)
+      throw std::runtime_error("Can't solve a singular system");
+
+   matrix<T> x(n, k);
+
+   for (int i=0; i < n; i++)
+      x.attach_row(b, _perm[i], i);
+
+   // Forward substitution: L*Y = P*B, L has a unit diagonal.
+   for (int i=1; i < n; i++) {
+
+      T *xi = &x(i,0);
+
+      for (int j=0; j < i; j++) {
+
+         const T& l = _lu(i,j);
+
+         if (l == 0)
+            continue;
+
+         const T *xj = &x(j,0);
+
+         for (int c=0; c < k; c++)
+            xi[c] -= l * xj[c];
+      }
+   }
+
+   // Back substitution: U*X = Y.
+   for (int i=n-1; i >= 0; i--) {
+
+      T *xi = &x(i,0);
+
+      for (int j=i+1; j < n; j++) {
+
+         const T& u = _lu(i,j);
+
+         if (u == 0)
+            continue;
+
+         const T *xj = &x(j,0);
+
+         for (int c=0; c < k; c++)
+            xi[c] -= u * xj[c];
+      }
+
+      x.in_place_div_row(i, _lu(i,i));
+   }
+
+   return x;
+}
+
+template <class T>
+matrix<T> lu_factorization<T>::inverse() const {
+
+   if (_singular)
+      throw std::runtime_error("Can't invert a singular matrix");
+
+   matrix<T> id(size(), size());
+   id.make_identity();
+
+   return solve_many(id);
+}
+
+} // namespace vmatrixlib
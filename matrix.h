@@ -4,32 +4,121 @@
 #include <cassert>
 #include <vector>
 #include <random>
+#include <type_traits>
 #include "complex_frac.h"
+#include "bigfrac.h"
+#include "gemm.h"
+#include "householder.h"
+#include "transpose.h"
+#include "philox.h"
+#include "thread_pool.h"
+#include "matrix_expr.h"
+#include "matrix_view.h"
+#include "matrix_writer.h"
 
 namespace vmatrixlib {
 
+/*
+ * Minimum number of elements handed to each thread by the parallel
+ * algorithms: element operations on exact types (frac, complex_frac) are
+ * far more expensive than on arithmetic types, so they split earlier.
+ */
 template <class T>
-class matrix {
+struct parallel_grain {
+   static constexpr int value = std::is_arithmetic<T>::value ? 1 << 15 : 1 << 9;
+};
+
+// Products below this number of multiply-adds always run on the caller.
+constexpr const long parallel_gemm_threshold = 64L * 64 * 64;
+
+/*
+ * Exact number types: determinant(), rank() and row_reduce() eliminate
+ * them with fraction-free steps (see fraction_free_elimination()) instead
+ * of dividing by the pivots.
+ */
+template <class T>
+struct is_exact_number : std::is_integral<T> { };
+
+template <class I, class F>
+struct is_exact_number<frac<I, F>> : std::true_type { };
+
+template <>
+struct is_exact_number<bigfrac> : std::true_type { };
+
+template <class F>
+struct is_exact_number<complex_frac<F>> : is_exact_number<F> { };
+
+template <class T>
+class matrix : public matrix_expr<matrix<T>> {
 
 public:
    typedef T number_type;
 
 protected:
 
+   template <class U>
+   friend class matrix;
+
    int _rows;
    int _cols;
    int _rowSwapsCount;
    std::vector<T> _data;
 
+   int find_pivot_in_col(int col, int fromRow, std::true_type) const;
+   int find_pivot_in_col(int col, int fromRow, std::false_type) const;
+
+   bool determinant_without_elimination(T& det) const;
+   T determinant_by_elimination(std::true_type);
+   T determinant_by_elimination(std::false_type);
+   int rank_by_elimination(std::true_type);
+   int rank_by_elimination(std::false_type);
+   int rank_in_place(std::true_type);
+   int rank_in_place(std::false_type);
+   void in_place_row_reduce(std::true_type);
+   void in_place_row_reduce(std::false_type);
+   int echelon_form_rank() const;
+   int fraction_free_elimination(bool reduce, T *scale = nullptr);
+
 public:
 
+   /*
+    * Elements in [min, max] with the given decimals, zero with probability
+    * zero_prob. With a seed, the rows are filled in parallel by a Philox
+    * generator (see philox.h) and the result is the same on every run and
+    * platform. With an engine, they are drawn from it, serially.
+    */
    static matrix random(int rows, int cols, int min,
                         int max, int decimals, double zero_prob);
 
+   static matrix random(int rows, int cols, int min, int max,
+                        int decimals, double zero_prob, uint64_t seed);
+
+   template <class Engine, class = typename std::enable_if<
+                              !std::is_integral<Engine>::value>::type>
+   static matrix random(int rows, int cols, int min, int max,
+                        int decimals, double zero_prob, Engine& e);
+
    matrix();
    matrix(int rows, int cols);
    matrix(int rows, int cols, T *arr);
 
+   matrix(const matrix&) = default;
+   matrix(matrix&& m) noexcept;
+   matrix& operator=(const matrix&) = default;
+   matrix& operator=(matrix&& m) noexcept;
+
+   template <class E>
+   matrix(const matrix_expr<E>& e);
+
+   template <class E>
+   matrix& operator=(const matrix_expr<E>& e);
+
+   template <class E>
+   matrix& operator+=(const matrix_expr<E>& e);
+
+   template <class E>
+   matrix& operator-=(const matrix_expr<E>& e);
+
    void load_data(T *arr);
 
    int rows() const { return _rows; }
@@ -37,6 +126,29 @@ public:
    int size() const { return _rows*_cols; }
    bool is_square() const { return _rows == _cols; }
 
+   bool is_real() const;
+   matrix<typename real_type_of<T>::type> real_parts() const;
+
+   template <class U>
+   static matrix from_real_parts(const matrix<U>& re);
+
+   const_matrix_view<T> view() const {
+      return const_matrix_view<T>(_data.data(), _rows, _cols, _cols);
+   }
+
+   matrix_view<T> view() {
+      return matrix_view<T>(_data.data(), _rows, _cols, _cols);
+   }
+
+   const_matrix_view<T> block(int r, int c, int nr, int nc) const {
+      return view().block(r, c, nr, nc);
+   }
+
+   matrix_view<T> block(int r, int c, int nr, int nc) {
+      return view().block(r, c, nr, nc);
+   }
+
+   operator const_matrix_view<T>() const { return view(); }
 
    void clear();
    void make_identity();
@@ -53,17 +165,17 @@ public:
 
    void in_place_mul_by_constant(const T& n);
    void in_place_div_by_constant(const T& n);
-   void in_place_mul(const matrix &m);
+   void in_place_mul(const matrix &m);   // A := A * m, with m square
 
    void in_place_transpose();
+   void in_place_make_triangular();
+   void in_place_row_reduce();
    void in_place_sum(const matrix &m);
    void in_place_mul_row(int row, const T& k);
    void in_place_div_row(int row, const T& k);
 
-   matrix transpose() const;
-   matrix operator+(const matrix& m) const;
-   matrix operator-(const matrix& m) const;
-   matrix operator*(const T& n) const;
+   matrix transpose() const &;
+   matrix transpose() &&;
    matrix operator*(const matrix& m) const;
    bool operator==(const matrix& m) const;
    bool operator!=(const matrix& m) const {
@@ -98,24 +210,29 @@ public:
    void add_row_mult_by_const_to_row(int srcRow, int destRow, T k);
 
    bool has_row_echelon_form() const;
-   matrix make_triangular() const;
+   matrix make_triangular() const &;
+   matrix make_triangular() &&;
    T diagonal_product() const;
 
-   int rank() const;
-   T determinant() const;
+   int rank() const &;
+   int rank() &&;
+   T determinant() const &;
+   T determinant() &&;
    matrix compute_inverse() const;
+   matrix compute_inverse_by_cofactors() const;
 
    matrix sub_matrix_erasing_row_col(int r, int c) const;
-   matrix row_reduce() const;
+   matrix row_reduce() const &;
+   matrix row_reduce() &&;
    matrix null_space() const;
    matrix col_space(matrix *cols = nullptr) const;
 
-   matrix add_row(const matrix& row);
-   matrix add_col(const matrix& col);
+   matrix add_row(const const_matrix_view<T>& row);
+   matrix add_col(const const_matrix_view<T>& col);
 
-   void attach_sub_matrix(const matrix& m, int row, int col);
-   void attach_col(const matrix& srcMatrix, int srcCol, int destCol);
-   void attach_row(const matrix& srcMatrix, int srcRow, int destRow);
+   void attach_sub_matrix(const const_matrix_view<T>& m, int row, int col);
+   void attach_col(const const_matrix_view<T>& srcMatrix, int srcCol, int destCol);
+   void attach_row(const const_matrix_view<T>& srcMatrix, int srcRow, int destRow);
 
    matrix approx_matrix() const;
 
@@ -126,6 +243,10 @@ public:
    int find_elem_in_row(int row, const T& elem) const;
    int find_elem(const T& elem) const;
 
+   int find_pivot_in_col(int col, int fromRow) const {
+      return find_pivot_in_col(col, fromRow, std::is_floating_point<T>());
+   }
+
    void pretty_print(int precision = 6) const;
    void print_mathematica_style() const;
    void print_matlab_style() const;
@@ -137,6 +258,73 @@ typedef matrix<double> fast_vmatrix;
 // Slower, but more precise matrix instantiation.
 typedef matrix<complex_frac<frac<long long, long double>>> vmatrix;
 
+// Exact matrix instantiation: never falls back to floating point.
+typedef matrix<complex_frac<bigfrac>> exact_vmatrix;
+
+
+/*
+ * Real-only kernels for complex matrices.
+ *
+ * Nearly all the complex matrices are actually real. When all the
+ * imaginary parts are zero, the algorithms which copy the matrix anyway
+ * (the const & overloads and the product) copy just the real parts and
+ * run on a matrix of the real type: half of the memory, and no work at
+ * all on the imaginary parts. The rvalue overloads keep working in place.
+ *
+ * with_real_parts(m, fn) calls fn() on the real parts of m and returns
+ * true when m is a complex matrix with no imaginary parts. Otherwise, it
+ * just returns false.
+ */
+template <class T, class Fn>
+inline bool with_real_parts(const matrix<T>&, Fn&&) {
+   return false;
+}
+
+template <class F, class Fn>
+inline bool with_real_parts(const matrix<complex_frac<F>>& m, Fn&& fn) {
+
+   if (!m.is_real())
+      return false;
+
+   fn(m.real_parts());
+   return true;
+}
+
+template <class T>
+bool matrix<T>::is_real() const {
+
+   for (const T& x : _data)
+      if (!vmatrixlib::is_real(x))
+         return false;
+
+   return true;
+}
+
+template <class T>
+matrix<typename real_type_of<T>::type> matrix<T>::real_parts() const {
+
+   matrix<typename real_type_of<T>::type> res(_rows, _cols);
+
+   for (int i=0; i < size(); i++)
+      res._data[i] = real_part(_data[i]);
+
+   res._rowSwapsCount = _rowSwapsCount;
+   return res;
+}
+
+template <class T>
+template <class U>
+matrix<T> matrix<T>::from_real_parts(const matrix<U>& re) {
+
+   matrix res(re._rows, re._cols);
+
+   for (int i=0; i < res.size(); i++)
+      res._data[i] = T(re._data[i]);
+
+   res._rowSwapsCount = re._rowSwapsCount;
+   return res;
+}
+
 
 template <class T>
 inline T& matrix<T>::get(int r, int c) {
@@ -194,8 +382,51 @@ inline const T& matrix<T>::operator()(int index) const {
    return _data[index];
 }
 
+/*
+ * Products are never lazy: an expression on the left is evaluated first.
+ */
+template <class E, class T>
+inline matrix<T> operator*(const matrix_expr<E>& e, const matrix<T>& m) {
+   return matrix<T>(e) * m;
+}
+
 template <class T>
-inline matrix<T> operator*(T n, matrix<T> m) { return m*n; }
+void mul_add_to(const const_matrix_view<T>& a,
+                const const_matrix_view<T>& b,
+                const matrix_view<T>& res, std::true_type);
+
+template <class T>
+void mul_add_to(const const_matrix_view<T>& a,
+                const const_matrix_view<T>& b,
+                const matrix_view<T>& res, std::false_type);
+
+/*
+ * res += a * b. The views can be blocks or transposed views: nothing is
+ * copied, except by the packing done by the blocked product kernel.
+ */
+template <class T>
+inline void mul_add_to(const const_matrix_view<T>& a,
+                       const const_matrix_view<T>& b,
+                       const matrix_view<T>& res)
+{
+   if (a.cols() != b.rows())
+      throw std::domain_error("Right matrix must have rows count equals to first matrix's columns count");
+
+   if (res.rows() != a.rows() || res.cols() != b.cols())
+      throw std::domain_error("The result matrix has the wrong size");
+
+   if (res.size() && a.cols())
+      mul_add_to(a, b, res, std::is_arithmetic<T>());
+}
+
+template <class T>
+inline matrix<T> operator*(const const_matrix_view<T>& a,
+                           const const_matrix_view<T>& b)
+{
+   matrix<T> res(a.rows(), b.cols());
+   mul_add_to(a, b, res.view());
+   return res;
+}
 
 template <class T>
 matrix<T>::matrix() : _rows(0), _cols(0), _rowSwapsCount(0) { }
@@ -209,11 +440,120 @@ matrix<T>::matrix(int r, int c)
 
 template <class T>
 matrix<T>::matrix(int r, int c, T *arr)
-   : _rows(r), _cols(c), _rowSwapsCount(0), _data(_rows, _cols)
+   : _rows(r), _cols(c), _rowSwapsCount(0), _data(_rows * _cols)
 {
    load_data(arr);
 }
 
+/*
+ * Moved-from matrices are left empty (0 x 0), never with dimensions that
+ * don't match their (stolen) buffer.
+ */
+template <class T>
+matrix<T>::matrix(matrix&& m) noexcept
+   : _rows(m._rows), _cols(m._cols),
+     _rowSwapsCount(m._rowSwapsCount), _data(std::move(m._data))
+{
+   m._rows = m._cols = m._rowSwapsCount = 0;
+}
+
+template <class T>
+matrix<T>& matrix<T>::operator=(matrix&& m) noexcept {
+
+   if (this != &m) {
+      _rows = m._rows;
+      _cols = m._cols;
+      _rowSwapsCount = m._rowSwapsCount;
+      _data = std::move(m._data);
+      m._rows = m._cols = m._rowSwapsCount = 0;
+      m._data.clear();
+   }
+
+   return *this;
+}
+
+template <class T>
+template <class E>
+matrix<T>::matrix(const matrix_expr<E>& e)
+   : _rows(e.rows()), _cols(e.cols()), _rowSwapsCount(0), _data(_rows * _cols)
+{
+   *this = e;
+}
+
+/*
+ * Evaluates the expression directly into this matrix, reusing its buffer
+ * when the size matches. 'e' may use *this as a matrix operand (read only
+ * at the position being written); if it has views over the buffer (e.g.
+ * A = A.view().transposed() or a block), it's evaluated into a temporary.
+ */
+template <class T>
+template <class E>
+matrix<T>& matrix<T>::operator=(const matrix_expr<E>& expr) {
+
+   const E& e = expr.derived();
+
+   if (matrix_expr_aliases(e, _data.data(), _data.data() + _data.size()))
+      return *this = matrix(e);
+
+   if (_rows != e.rows() || _cols != e.cols()) {
+      _rows = e.rows();
+      _cols = e.cols();
+      _data.resize(_rows * _cols);
+   }
+
+   _rowSwapsCount = 0;
+
+   const int grain = std::max(1, parallel_grain<T>::value / std::max(1, _cols));
+
+   parallel_for(0, _rows, grain, [this, &e](int rb, int re) {
+      for (int i=rb; i < re; i++)
+         for (int j=0; j < _cols; j++)
+            get(i,j) = e(i,j);
+   });
+
+   return *this;
+}
+
+template <class T>
+template <class E>
+matrix<T>& matrix<T>::operator+=(const matrix_expr<E>& expr) {
+
+   const E& e = expr.derived();
+
+   if (_rows != e.rows() || _cols != e.cols())
+      throw std::domain_error("Argument matrix and object matrix MUST have the same size");
+
+   const int grain = std::max(1, parallel_grain<T>::value / std::max(1, _cols));
+
+   parallel_for(0, _rows, grain, [this, &e](int rb, int re) {
+      for (int i=rb; i < re; i++)
+         for (int j=0; j < _cols; j++)
+            get(i,j) += e(i,j);
+   });
+
+   return *this;
+}
+
+template <class T>
+template <class E>
+matrix<T>& matrix<T>::operator-=(const matrix_expr<E>& expr) {
+
+   const E& e = expr.derived();
+
+   if (_rows != e.rows() || _cols != e.cols())
+      throw std::domain_error("Argument matrix and object matrix MUST have the same size");
+
+   const int grain = std::max(1, parallel_grain<T>::value / std::max(1, _cols));
+
+   parallel_for(0, _rows, grain, [this, &e](int rb, int re) {
+      for (int i=rb; i < re; i++)
+         for (int j=0; j < _cols; j++)
+            get(i,j) -= e(i,j);
+   });
+
+   return *this;
+}
+
 template <class T>
 void matrix<T>::clear() {
 
@@ -238,8 +578,10 @@ void matrix<T>::make_identity() {
 template <class T>
 void matrix<T>::in_place_mul_by_constant(const T& n) {
 
-   for (int i=0; i < _rows*_cols; i++)
-      _data[i] *= n;
+   parallel_for(0, size(), parallel_grain<T>::value, [this, &n](int b, int e) {
+      for (int i=b; i < e; i++)
+         _data[i] *= n;
+   });
 }
 
 template <class T>
@@ -250,29 +592,48 @@ void matrix<T>::in_place_div_by_constant(const T& n) {
 }
 
 
+/*
+ * A := A * B, with B square. Row i of the product only depends on row i of
+ * A, so A is done by stripes of gemm_mc rows: a stripe is copied to a
+ * scratch buffer, cleared and accumulated with the product kernel. Only
+ * the stripe is copied, instead of the whole matrix.
+ */
 template <class T>
 void matrix<T>::in_place_mul(const matrix &m) {
 
-   if (_rows != m._rows || _cols != m._cols)
-      throw std::domain_error("Argument matrix MUST have the same size as object matrix");
+   if (m._rows != _cols || m._cols != _cols)
+      throw std::domain_error("Argument matrix MUST be square, with as many rows as the object matrix's columns");
 
-   for (int i=0; i < _rows; i++)
-      for (int j=0; j < _cols; j++)
-         for (int k=0; k < _cols; k++)
-            get(i,j)+=get(i,k)*m.get(k,j);
+   if (&m == this) {
+      // A * A needs all of A until the end.
+      *this = *this * m;
+      return;
+   }
+
+   if (size() == 0)
+      return;
+
+   const int stripe = std::min(_rows, gemm_mc);
+   matrix scratch(stripe, _cols);
+
+   for (int r=0; r < _rows; r += stripe) {
+
+      const int h = std::min(stripe, _rows - r);
+      T *rows = &_data[r * _cols];
 
+      std::copy(rows, rows + h * _cols, scratch._data.begin());
+      std::fill(rows, rows + h * _cols, T(0));
+
+      mul_add_to(scratch.block(0, 0, h, _cols), m.view(), block(r, 0, h, _cols));
+   }
 }
 
+// Works for any shape: a rows x cols matrix becomes cols x rows.
 template <class T>
 void matrix<T>::in_place_transpose() {
 
-   if (!is_square())
-      throw std::domain_error("in_place_transpose() can be used ONLY for square matrices");
-
-   for (int i=0; i < _rows; i++)
-      for (int j=0; j < _cols; j++)
-         if (j < i)
-            swap(i,j,j,i);
+   transpose_in_place(_rows, _cols, _data.data());
+   std::swap(_rows, _cols);
 }
 
 template <class T>
@@ -281,56 +642,109 @@ void matrix<T>::in_place_sum(const matrix &m) {
    if (_rows != m._rows || _cols != m._cols)
       throw std::domain_error("Argument matrix and object matrix MUST have the same size");
 
-   for (int i=0; i < _rows; i++)
-      for (int j=0; j < _cols; j++)
-         get(i,j)+=m(i,j);
+   parallel_for(0, size(), parallel_grain<T>::value, [this, &m](int b, int e) {
+      for (int i=b; i < e; i++)
+         _data[i] += m._data[i];
+   });
 }
 
 template <class T>
-matrix<T> matrix<T>::operator+(const matrix<T>& m) const {
+matrix<T> matrix<T>::operator*(const matrix<T>& m) const {
 
-   matrix res(*this);
-   res.in_place_sum(m);
+   if (m._rows != _cols)
+      throw std::domain_error("Right matrix must have rows count equals to first matrix's columns count");
 
-   return res;
-}
+   int resR = _rows;
+   int resC = m._cols;
 
-template <class T>
-matrix<T> matrix<T>::operator-(const matrix<T>& m) const {
+   matrix res;
 
-   matrix res = *this;
-   matrix t = m * T(-1);
-   res.in_place_sum(t);
+   if (m.is_real() && with_real_parts(*this, [&res, &m](auto&& a) {
+          res = from_real_parts(a * m.real_parts());
+       }))
+   {
+      return res;
+   }
+
+   res = matrix(resR,resC);
+   mul_add_to(view(), m.view(), res.view());
 
    return res;
 }
 
 template <class T>
-matrix<T> matrix<T>::operator*(const T& n) const {
+void mul_add_to(const const_matrix_view<T>& av,
+                const const_matrix_view<T>& bv,
+                const matrix_view<T>& res, std::true_type)
+{
+   const int m = av.rows();
+   const int n = bv.cols();
+   const int k = av.cols();
+   const T *a = av.data();
+   const T *b = bv.data();
+   const int rsa = av.row_stride(), csa = av.col_stride();
+   const int rsb = bv.row_stride(), csb = bv.col_stride();
+
+   if (res.col_stride() != 1) {
+      // The kernel writes rows of C: go through a temporary.
+      matrix<T> tmp(m, n);
+      mul_add_to(av, bv, tmp.view(), std::true_type());
+
+      matrix_view<T> dest = res;
+      dest += tmp;
+      return;
+   }
 
-   matrix res = *this;
-   res.in_place_mul_by_constant(n);
+   T *c = res.data();
+   const int ldc = res.row_stride();
 
-   return res;
+   if (static_cast<long>(m) * n * k < parallel_gemm_threshold ||
+       get_num_threads() == 1)
+   {
+      gemm_add(m, n, k, a, rsa, csa, b, rsb, csb, c, ldc);
+      return;
+   }
+
+   // Split C in blocks of rows or, for short and wide products, of columns.
+   if (m >= n) {
+
+      parallel_for(0, m, 8 * gemm_mr, [=](int rb, int re) {
+         gemm_add(re - rb, n, k, a + rb * rsa, rsa, csa,
+                  b, rsb, csb, c + rb * ldc, ldc);
+      });
+
+   } else {
+
+      parallel_for(0, n, 4 * gemm_nr, [=](int cb, int ce) {
+         gemm_add(m, ce - cb, k, a, rsa, csa,
+                  b + cb * csb, rsb, csb, c + cb, ldc);
+      });
+   }
 }
 
 template <class T>
-matrix<T> matrix<T>::operator*(const matrix<T>& m) const {
+void mul_add_to(const const_matrix_view<T>& a,
+                const const_matrix_view<T>& b,
+                const matrix_view<T>& res, std::false_type)
+{
+   const int grain =
+      std::max(1, parallel_grain<T>::value / std::max(1, b.cols() * a.cols()));
 
-   if (m._rows != _cols)
-      throw std::domain_error("Right matrix must have rows count equals to first matrix's columns count");
+   // i-k-j order: b and res are walked along their rows.
+   parallel_for(0, a.rows(), grain, [&a, &b, &res](int rb, int re) {
 
-   int resR = _rows;
-   int resC = m._cols;
+      for (int i=rb; i < re; i++)
+         for (int k=0; k < a.cols(); k++) {
 
-   matrix res(resR,resC);
+            const T& aik = a(i,k);
 
-   for (int i=0; i < resR; i++)
-      for (int j=0; j < resC; j++)
-         for (int k=0; k < _cols; k++)
-            res(i,j) += get(i,k)*m(k,j);
+            if (aik == 0)
+               continue;
 
-   return res;
+            for (int j=0; j < b.cols(); j++)
+               res(i,j) += aik*b(k,j);
+         }
+   });
 }
 
 template <class T>
@@ -346,14 +760,41 @@ bool matrix<T>::operator==(const matrix& m) const {
    return true;
 }
 
+/*
+ * The rvalue overloads of transpose(), make_triangular(), row_reduce(),
+ * determinant() and rank() work directly on the buffer of the matrix they
+ * are called on, so that std::move(A).make_triangular() or chains like
+ * A.transpose().make_triangular() don't allocate. The exception is the
+ * transpose of non-square matrices: following the permutation cycles is
+ * serial and slower than the blocked parallel copy, so it allocates
+ * (in_place_transpose() still works in place, when memory matters more).
+ */
+template <class T>
+matrix<T> matrix<T>::transpose() && {
+
+   if (!is_square())
+      return static_cast<const matrix&>(*this).transpose();
+
+   in_place_transpose();
+   return std::move(*this);
+}
+
+// Stripes of rows, each transposed with the cache-oblivious kernel.
 template <class T>
-matrix<T> matrix<T>::transpose() const {
+matrix<T> matrix<T>::transpose() const & {
 
    matrix res(_cols,_rows);
 
-   for (int i=0; i < _rows; i++)
-      for (int j=0; j < _cols; j++)
-         res(j,i)=get(i,j);
+   if (size() == 0)
+      return res;
+
+   const int grain = std::max(transpose_tile,
+                              parallel_grain<T>::value / std::max(1, _cols));
+
+   parallel_for(0, _rows, grain, [this, &res](int rb, int re) {
+      transpose_copy(re - rb, _cols, &_data[rb * _cols], _cols,
+                     &res._data[rb], _rows);
+   });
 
    return res;
 }
@@ -407,12 +848,39 @@ void matrix<T>::add_row_mult_by_const_to_row(int srcRow, int destRow, T k) {
 }
 
 template <class T>
-matrix<T> matrix<T>::make_triangular() const {
+matrix<T> matrix<T>::make_triangular() const & {
 
    if (rows() == 1 || cols() == 1 || has_row_echelon_form())
       return *this;
 
-   matrix res = *this;
+   matrix res;
+
+   if (with_real_parts(*this, [&res](auto&& re) {
+          res = from_real_parts(std::move(re).make_triangular());
+       }))
+   {
+      return res;
+   }
+
+   res = *this;
+   res.in_place_make_triangular();
+   return res;
+}
+
+template <class T>
+matrix<T> matrix<T>::make_triangular() && {
+
+   in_place_make_triangular();
+   return std::move(*this);
+}
+
+template <class T>
+void matrix<T>::in_place_make_triangular() {
+
+   if (rows() == 1 || cols() == 1 || has_row_echelon_form())
+      return;
+
+   matrix& res = *this;
 
    int i,j,k,u;
 
@@ -460,9 +928,6 @@ matrix<T> matrix<T>::make_triangular() const {
       res.pretty_print();
       throw std::runtime_error("Calc error in make_triangular()");
    }
-
-   return res;
-
 }
 
 template <class T>
@@ -519,45 +984,163 @@ T matrix<T>::diagonal_product() const {
    return res;
 }
 
+/*
+ * Handles the cases not requiring any elimination: returns false when
+ * the determinant has to be computed by determinant_by_elimination().
+ */
 template <class T>
-T matrix<T>::determinant() const {
+bool matrix<T>::determinant_without_elimination(T& det) const {
 
    if (!is_square())
       throw std::domain_error("Determinant can be computed only for square matrices");
 
-   if (_rows == 1)
-      return get(0,0);
+   if (_rows == 1) {
+      det = get(0,0);
+      return true;
+   }
 
-   if (_rows == 2)
-      return get(0,0)*get(1,1) - get(0,1)*get(1,0);
+   if (_rows == 2) {
+      det = get(0,0)*get(1,1) - get(0,1)*get(1,0);
+      return true;
+   }
 
    if (is_triangular()) {
 
-      T det = diagonal_product();
+      det = diagonal_product();
 
-      if (_rowSwapsCount == 0 || (_rowSwapsCount%2) == 0)
-         return det;
+      if ((_rowSwapsCount%2) != 0)
+         det = -det;
 
-      return -det;
+      return true;
    }
 
-   matrix m = make_triangular();
+   return false;
+}
+
+// NOTE: destroys the content of the matrix.
+template <class T>
+T matrix<T>::determinant_by_elimination(std::true_type) {
+
+   T scale;
 
-   T det = m.diagonal_product();
+   if (fraction_free_elimination(false, &scale) != _rows)
+      return T(0);
 
-   int rSwaps = m._rowSwapsCount;
+   // The last pivot is the determinant of the whole (permuted) matrix.
+   T det = get(_rows-1, _cols-1) / scale;
 
-   if (rSwaps == 0 || (rSwaps%2) == 0)
+   if ((_rowSwapsCount%2) == 0)
       return det;
 
    return -det;
+}
+
+// NOTE: destroys the content of the matrix.
+template <class T>
+T matrix<T>::determinant_by_elimination(std::false_type) {
+
+   in_place_make_triangular();
+
+   T det = diagonal_product();
+
+   if (_rowSwapsCount == 0 || (_rowSwapsCount%2) == 0)
+      return det;
+
+   return -det;
+}
+
+template <class T>
+T matrix<T>::determinant() const & {
+
+   T det;
 
+   if (determinant_without_elimination(det))
+      return det;
+
+   if (with_real_parts(*this, [&det](auto&& re) {
+          det = T(std::move(re).determinant());
+       }))
+   {
+      return det;
+   }
+
+   matrix m = *this;
+   return m.determinant_by_elimination(is_exact_number<T>());
+}
+
+template <class T>
+T matrix<T>::determinant() && {
+
+   T det;
+
+   if (determinant_without_elimination(det))
+      return det;
+
+   return determinant_by_elimination(is_exact_number<T>());
+}
+
+template <class T>
+int matrix<T>::rank() const & {
+
+   int r;
+
+   if (with_real_parts(*this, [&r](auto&& re) { r = std::move(re).rank(); }))
+      return r;
+
+   matrix m = *this;
+   return m.rank_in_place(std::is_floating_point<T>());
+}
+
+template <class T>
+int matrix<T>::rank() && {
+   return rank_in_place(std::is_floating_point<T>());
+}
+
+/*
+ * Floating point: Gaussian elimination decides that an element is zero by
+ * comparing it with a fixed epsilon, which makes the rank depend on the
+ * scale of the matrix. The diagonal of a column-pivoted QR, instead, is
+ * compared with the largest one.
+ *
+ * NOTE: destroys the content of the matrix.
+ */
+template <class T>
+int matrix<T>::rank_in_place(std::true_type) {
+
+   if (_rows == 0 || _cols == 0)
+      return 0;
+
+   std::vector<T> tau(std::min(_rows, _cols));
+   std::vector<int> perm(_cols);
+
+   householder_qr_pivoted(_rows, _cols, _data.data(), _cols, tau.data(), perm.data());
+   return householder_rank(_rows, _cols, _data.data(), _cols);
 }
 
+// NOTE: destroys the content of the matrix.
 template <class T>
-int matrix<T>::rank() const {
+int matrix<T>::rank_in_place(std::false_type) {
+   return rank_by_elimination(is_exact_number<T>());
+}
+
+// NOTE: destroys the content of the matrix.
+template <class T>
+int matrix<T>::rank_by_elimination(std::true_type) {
+   return fraction_free_elimination(false);
+}
+
+// NOTE: destroys the content of the matrix.
+template <class T>
+int matrix<T>::rank_by_elimination(std::false_type) {
+
+   in_place_make_triangular();
+   return echelon_form_rank();
+}
+
+template <class T>
+int matrix<T>::echelon_form_rank() const {
 
-   matrix m = make_triangular();
+   const matrix& m = *this;
 
    int i=0,j=0;
    int steps=0;
@@ -589,9 +1172,195 @@ int matrix<T>::rank() const {
    return steps;
 }
 
+/*
+ * Fraction-free (Bareiss) elimination, for exact number types.
+ *
+ * Instead of dividing the rows by the pivot, each step cross-multiplies:
+ * with p the current pivot, in row r and column c, and d the previous one,
+ *
+ *    a(i,j) = (p * a(i,j) - a(i,c) * a(r,j)) / d
+ *
+ * where the division is always exact, since every entry is a minor of the
+ * original matrix (Sylvester's identity). Thus the numbers never grow
+ * beyond the size of those minors and integer matrices stay integer, with
+ * no gcd() at all. For that, the rows of rational matrices are first
+ * scaled to integers: the product of the factors is stored in *scale.
+ *
+ * With reduce == false, it stops at a (non-normalized) row echelon form,
+ * whose last pivot is the determinant, up to the sign of the row swaps.
+ * With reduce == true, it eliminates above the pivots too (fraction-free
+ * Gauss-Jordan) and then divides each row by its pivot, which gives the
+ * reduced row echelon form.
+ *
+ * Returns the rank. NOTE: destroys the content of the matrix.
+ */
+template <class T>
+int matrix<T>::fraction_free_elimination(bool reduce, T *scale) {
+
+   T prev = T(1);
+   int r = 0;
+
+   if (scale)
+      *scale = T(1);
+
+   for (int i=0; i < _rows; i++) {
+
+      T k = T(1);
+
+      for (int j=0; j < _cols; j++)
+         k = denominators_lcm(k, get(i,j));
+
+      if (k == 1)
+         continue;
+
+      in_place_mul_row(i, k);
+
+      if (scale)
+         *scale *= k;
+   }
+
+   for (int c=0; c < _cols && r < _rows; c++) {
+
+      const int p = find_pivot_in_col(c, r);
+
+      if (p == -1)
+         continue;
+
+      if (p != r)
+         swap_rows(p, r);
+
+      const T pivot = get(r,c);
+      const T *pivotRow = &get(r,0);
+      const int grain = std::max(1, parallel_grain<T>::value / _cols);
+
+      parallel_for(reduce ? 0 : r+1, _rows, grain,
+                   [this, r, c, &pivot, &prev, pivotRow](int b, int e) {
+
+         for (int i=b; i < e; i++) {
+
+            if (i == r)
+               continue;
+
+            T *row = &get(i,0);
+            const T f = row[c];
+
+            // Below the pivot row, the columns before c are already zero.
+            for (int j = i < r ? 0 : c+1; j < _cols; j++)
+               row[j] = fraction_free_step(row[j], pivotRow[j], pivot, f, prev);
+
+            row[c] = 0;
+         }
+      });
+
+      prev = pivot;
+      r++;
+   }
+
+   if (reduce) {
+
+      for (int i=0; i < r; i++) {
+
+         int j=i;
+
+         while (get(i,j) == 0)
+            j++;
+
+         const T pivot = get(i,j);
+         in_place_div_row(i, pivot);
+         get(i,j) = 1;
+      }
+   }
+
+   return r;
+}
+
+/*
+ * In-place Gauss-Jordan inversion, O(n^3).
+ *
+ * Works on a single n x n buffer: at step k, column k of the identity that
+ * would be built on the right side is stored in place of the just
+ * eliminated column k. The row swaps done for pivoting become column swaps
+ * of the inverse, undone in reverse order at the end.
+ */
 template <class T>
 matrix<T> matrix<T>::compute_inverse() const {
 
+   if (!is_square())
+      throw std::domain_error("Only square matrices can be inverted");
+
+   matrix res;
+
+   if (with_real_parts(*this, [&res](auto&& re) {
+          res = from_real_parts(re.compute_inverse());
+       }))
+   {
+      return res;
+   }
+
+   const int n = _rows;
+   res = *this;
+   std::vector<int> pivotRows(n);
+
+   for (int k=0; k < n; k++) {
+
+      const int p = res.find_pivot_in_col(k, k);
+
+      if (p == -1)
+         throw std::runtime_error("Can't invert a singular matrix");
+
+      if (p != k)
+         res.swap_rows(p, k);
+
+      pivotRows[k] = p;
+
+      const T pivot = res(k,k);
+      res(k,k) = 1;
+      res.in_place_div_row(k, pivot);
+
+      const T *pivotRow = &res(k,0);
+      const int grain = std::max(1, parallel_grain<T>::value / n);
+
+      parallel_for(0, n, grain, [&res, k, n, pivotRow](int b, int e) {
+
+         for (int i=b; i < e; i++) {
+
+            if (i == k)
+               continue;
+
+            T *row = &res(i,0);
+            const T f = row[k];
+
+            if (f == 0)
+               continue;
+
+            row[k] = 0;
+
+            for (int j=0; j < n; j++)
+               row[j] -= f * pivotRow[j];
+         }
+      });
+   }
+
+   for (int k=n-1; k >= 0; k--) {
+
+      if (pivotRows[k] == k)
+         continue;
+
+      for (int i=0; i < n; i++)
+         res.swap(i, k, i, pivotRows[k]);
+   }
+
+   res._rowSwapsCount = 0;
+   return res;
+}
+
+/*
+ * Reference implementation: adjugate matrix divided by the determinant.
+ * It computes n^2 minors, so it is O(n^5): use it only for checking.
+ */
+template <class T>
+matrix<T> matrix<T>::compute_inverse_by_cofactors() const {
+
    T det = determinant();
 
    if (det == 0)
@@ -627,43 +1396,35 @@ matrix<T> matrix<T>::compute_inverse() const {
 template <class T>
 matrix<T> matrix<T>::sub_matrix_erasing_row_col(int row, int col) const {
 
-   matrix res;
-
-   if (row != -1 && col != -1)
-      res = matrix(_rows-1,_cols-1);
-   else if (row == -1 && col != -1)
-      res = matrix(_rows,_cols-1);
-   else if (row != -1 && col == -1)
-      res = matrix(_rows-1,_cols);
-   else
+   if (row == -1 && col == -1)
       return *this;
 
-   int currR=0;
-   int currC=0;
-   int i,j;
+   // The result is made of (up to) four blocks of this matrix: the rows
+   // above/below the erased row times the columns left/right of the erased
+   // column.
 
-   for (i=0; i < _rows; i++) {
+   const int rAbove = row != -1 ? row : _rows;
+   const int cLeft = col != -1 ? col : _cols;
+   const int rBelow = _rows - rAbove - (row != -1);
+   const int cRight = _cols - cLeft - (col != -1);
 
-      if (i == row)
-         continue;
-
-      currC=0;
+   matrix res(rAbove + rBelow, cLeft + cRight);
 
-      for (j=0; j < _cols; j++) {
+   res.attach_sub_matrix(block(0, 0, rAbove, cLeft), 0, 0);
 
-         if (j == col)
-            continue;
+   if (cRight > 0)
+      res.attach_sub_matrix(block(0, cLeft+1, rAbove, cRight), 0, cLeft);
 
-         res(currR,currC) = get(i,j);
+   if (rBelow > 0) {
 
-         currC++;
-      }
+      res.attach_sub_matrix(block(rAbove+1, 0, rBelow, cLeft), rAbove, 0);
 
-      currR++;
+      if (cRight > 0)
+         res.attach_sub_matrix(block(rAbove+1, cLeft+1, rBelow, cRight),
+                               rAbove, cLeft);
    }
 
    return res;
-
 }
 
 template <class T>
@@ -682,14 +1443,52 @@ void matrix<T>::in_place_div_row(int row, const T& k) {
 
 
 template <class T>
-matrix<T> matrix<T>::row_reduce() const {
-
+matrix<T> matrix<T>::row_reduce() const & {
 
-   if (_rows == 1 || _cols == 1) {
+   if (_rows == 1 || _cols == 1)
       return *this;
+
+   matrix res;
+
+   if (with_real_parts(*this, [&res](auto&& re) {
+          res = from_real_parts(std::move(re).row_reduce());
+       }))
+   {
+      return res;
    }
 
-   matrix t = make_triangular();
+   res = *this;
+   res.in_place_row_reduce();
+   return res;
+}
+
+template <class T>
+matrix<T> matrix<T>::row_reduce() && {
+
+   in_place_row_reduce();
+   return std::move(*this);
+}
+
+template <class T>
+void matrix<T>::in_place_row_reduce() {
+
+   if (_rows == 1 || _cols == 1)
+      return;
+
+   in_place_row_reduce(is_exact_number<T>());
+}
+
+template <class T>
+void matrix<T>::in_place_row_reduce(std::true_type) {
+   fraction_free_elimination(true);
+}
+
+template <class T>
+void matrix<T>::in_place_row_reduce(std::false_type) {
+
+   in_place_make_triangular();
+
+   matrix& t = *this;
 
    int j=0;
 
@@ -740,21 +1539,20 @@ matrix<T> matrix<T>::row_reduce() const {
 
       }
    }
-
-   return t;
 }
 
 template <class T>
-void matrix<T>::attach_sub_matrix(const matrix<T>& m, int row, int col) {
+void matrix<T>::attach_sub_matrix(const const_matrix_view<T>& m, int row, int col) {
 
-   for (int i=0; i+row < _rows && i < m._rows; i++)
-      for (int j=0; j+col < _cols && j < m._cols; j++)
-         get(i+row,j+col) = m(i,j);
+   const int nr = std::min(m.rows(), _rows - row);
+   const int nc = std::min(m.cols(), _cols - col);
 
+   if (nr > 0 && nc > 0)
+      block(row, col, nr, nc) = m.block(0, 0, nr, nc);
 }
 
 template <class T>
-void matrix<T>::attach_col(const matrix<T>& srcMatrix, int srcCol, int destCol) {
+void matrix<T>::attach_col(const const_matrix_view<T>& srcMatrix, int srcCol, int destCol) {
 
    if (srcMatrix.rows() != rows())
       throw std::domain_error("srcMatrix must have the same number of rows as destination matrix");
@@ -764,7 +1562,7 @@ void matrix<T>::attach_col(const matrix<T>& srcMatrix, int srcCol, int destCol)
 }
 
 template <class T>
-void matrix<T>::attach_row(const matrix<T>& srcMatrix, int srcRow, int destRow) {
+void matrix<T>::attach_row(const const_matrix_view<T>& srcMatrix, int srcRow, int destRow) {
 
    if (srcMatrix.cols() != cols())
       throw std::domain_error("srcMatrix must have the same number of cols as dest matrix");
@@ -774,14 +1572,14 @@ void matrix<T>::attach_row(const matrix<T>& srcMatrix, int srcRow, int destRow)
 }
 
 template <class T>
-matrix<T> matrix<T>::add_row(const matrix<T>& row) {
+matrix<T> matrix<T>::add_row(const const_matrix_view<T>& row) {
 
    matrix res(_rows+1, _cols);
 
-   if (row._rows != 1)
+   if (row.rows() != 1)
       throw std::domain_error("Row matrix MUST have only ONE row");
 
-   if (row._cols != _cols)
+   if (row.cols() != _cols)
       throw std::domain_error("The number of cols must be the same");
 
    res.attach_sub_matrix(*this, 0, 0);
@@ -791,14 +1589,14 @@ matrix<T> matrix<T>::add_row(const matrix<T>& row) {
 }
 
 template <class T>
-matrix<T> matrix<T>::add_col(const matrix<T>& col) {
+matrix<T> matrix<T>::add_col(const const_matrix_view<T>& col) {
 
    matrix res(_rows, _cols+1);
 
-   if (col._cols != 1)
+   if (col.cols() != 1)
       throw std::domain_error("Col matrix MUST have only ONE column");
 
-   if (col._rows != _rows)
+   if (col.rows() != _rows)
       throw std::domain_error("The number of rows must be the same");
 
    res.attach_sub_matrix(*this, 0, 0);
@@ -919,6 +1717,53 @@ matrix<T> matrix<T>::col_space(matrix *cols) const {
 template <class T>
 matrix<T> matrix<T>::random(int rows, int cols, int min,
                             int max, int decimals, double zero_prob)
+{
+   std::random_device rdev;
+   const uint64_t seed = (static_cast<uint64_t>(rdev()) << 32) | rdev();
+
+   return random(rows, cols, min, max, decimals, zero_prob, seed);
+}
+
+template <class T>
+matrix<T> matrix<T>::random(int rows, int cols, int min, int max,
+                            int decimals, double zero_prob, uint64_t seed)
+{
+   assert(zero_prob >= 0.0f && zero_prob <= 1.0f);
+   assert(decimals <= 6);
+
+   long long den = 1;
+
+   for (int k = 0; k < decimals; k++)
+      den *= 10;
+
+   matrix res(rows,cols);
+   const int grain = std::max(1, parallel_grain<T>::value / std::max(1, cols));
+
+   // Row i is stream i: the result doesn't depend on how rows are split.
+   parallel_for(0, rows, grain, [&res, min, max, den, zero_prob, seed](int rb, int re) {
+
+      for (int i=rb; i < re; i++) {
+
+         philox_engine e(seed, i);
+
+         for (int j=0; j < res._cols; j++) {
+
+            if (random_uniform01(e) < zero_prob)
+               continue;
+
+            const long long v = random_int(e, min * den, max * den);
+            res(i, j) = T( static_cast<long double>(v) / den );
+         }
+      }
+   });
+
+   return res;
+}
+
+template <class T>
+template <class Engine, class>
+matrix<T> matrix<T>::random(int rows, int cols, int min, int max,
+                            int decimals, double zero_prob, Engine& e)
 {
    using namespace std;
 
@@ -932,9 +1777,6 @@ matrix<T> matrix<T>::random(int rows, int cols, int min,
    for (int k = 0; k < decimals; k++)
       den *= 10.0;
 
-   random_device rdev;
-   default_random_engine e(rdev());
-
    uniform_int_distribution<> dist(min * (int)den, max * (int)den);
    uniform_int_distribution<> zerodist(0, 999);
 
@@ -991,56 +1833,48 @@ int matrix<T>::find_elem(const T& elem) const {
    return -1;
 }
 
+/*
+ * Partial pivoting for floating point types: the element with the largest
+ * magnitude in col, at or below fromRow, is chosen.
+ */
 template <class T>
-void matrix<T>::pretty_print(int precision) const {
-
+int matrix<T>::find_pivot_in_col(int col, int fromRow, std::true_type) const {
 
-   int i,j,k,maxlen=0;
-   printf("matrix (%i x %i)\n", _rows, _cols);
-
-   if (!_rows || !_cols)
-      return;
+   int best = -1;
+   T bestVal = T(0);
 
-   std::vector<std::string> strmatrix(_rows * _cols);
-
-#define getelem(r,c) (strmatrix[((r) * _cols + (c))])
-
-   for (i=0; i < _rows; i++) {
-      for (j=0; j < _cols; j++) {
+   for (int i=fromRow; i < rows(); i++) {
 
-         T num = get(i,j);
+      const T v = std::abs(get(i,col));
 
-         const std::string& s = to_string(num, precision);
-         getelem(i,j) = s + " | ";
-
-         if ((int)s.size() > maxlen)
-            maxlen = s.size();
+      if (v > bestVal) {
+         bestVal = v;
+         best = i;
       }
    }
 
-   printf("\n");
-
-   for (i=0; i < _rows; i++) {
-
-      for (j=0; j < _cols; j++) {
-
-         if (j==0)
-            printf("| ");
-
-         int diff = maxlen - (getelem(i,j).size() - 3);
+   return best;
+}
 
-         for (k=0; k < diff; k++)
-            printf(" ");
+/*
+ * Exact types: any non-zero element is as good as another, take the first.
+ */
+template <class T>
+int matrix<T>::find_pivot_in_col(int col, int fromRow, std::false_type) const {
 
-         printf("%s", getelem(i,j).c_str());
-      }
+   for (int i=fromRow; i < rows(); i++)
+      if (get(i,col) != 0)
+         return i;
 
-      printf("\n");
-   }
+   return -1;
+}
 
-   printf("\n");
+// See matrix_writer.h for the other outputs (ostreams, buffers, CSV).
+template <class T>
+void matrix<T>::pretty_print(int precision) const {
 
-#undef getelem
+   text_writer w(stdout);
+   write_pretty(w, view(), precision);
 }
 
 template <class T>
@@ -1087,52 +1921,15 @@ bool matrix<T>::is_col_null(int col) const {
 template <class T>
 void matrix<T>::print_mathematica_style() const {
 
-   printf("{");
-
-   for (int i=0; i < _rows; i++) {
-
-      printf("{");
-
-      for (int j=0; j < _cols; j++) {
-
-         printf("%s", to_string(get(i,j)).c_str());
-
-         if (j < _cols-1)
-            printf(",");
-      }
-
-      printf("}");
-
-      if (i < _rows-1)
-         printf(",\n");
-   }
-
-   printf("}\n");
+   text_writer w(stdout);
+   write_mathematica(w, view());
 }
 
 template <class T>
 void matrix<T>::print_matlab_style() const {
 
-
-   printf("[");
-
-   for (int i=0; i < _rows; i++) {
-
-
-      for (int j=0; j < _cols; j++) {
-
-         printf("%s", to_string(to_frac_in_decimal_form(get(i,j))).c_str());
-
-         if (j < _cols-1)
-            printf(" ");
-      }
-
-
-      if (i < _rows-1)
-         printf(";\n");
-   }
-
-   printf("]\n");
+   text_writer w(stdout);
+   write_matlab(w, view());
 }
 
 } // namespace vmatrixlib
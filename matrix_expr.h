@@ -0,0 +1,166 @@
+
+#pragma once
+
+#include <stdexcept>
+
+namespace vmatrixlib {
+
+/*
+ * Expression templates for the element-wise matrix arithmetic.
+ *
+ * operator+, operator- and operator*(scalar) don't compute anything: they
+ * return a small object describing the operation. The actual loop runs
+ * when the expression is assigned to a matrix (or used to construct one),
+ * once, element by element, directly into the destination buffer. Thus:
+ *
+ *    C = A + B*2 - D;
+ *
+ * allocates nothing if C already has the right size, and never creates
+ * the temporaries B*2 and A + B*2.
+ *
+ * NOTE: as with any expression template library, don't store expressions
+ * with 'auto': they keep references to their matrix operands.
+ */
+
+template <class T>
+class matrix;
+
+template <class E>
+class matrix_expr {
+
+public:
+
+   const E& derived() const { return static_cast<const E&>(*this); }
+
+   int rows() const { return derived().rows(); }
+   int cols() const { return derived().cols(); }
+};
+
+/*
+ * How an expression node keeps its operands: matrices by reference,
+ * everything else (other nodes, which are tiny) by value, since nested
+ * nodes are usually temporaries which won't outlive the full expression.
+ */
+template <class E>
+struct matrix_expr_operand {
+   typedef const E type;
+};
+
+template <class T>
+struct matrix_expr_operand<matrix<T>> {
+   typedef const matrix<T>& type;
+};
+
+/*
+ * Whether evaluating an expression may read the elements in [first, last)
+ * at other positions than the one being written. Matrix operands are read
+ * position by position; views can be transposed or shifted blocks.
+ */
+template <class E>
+inline bool matrix_expr_aliases(const matrix_expr<E>& e,
+                                const void *first, const void *last)
+{
+   return e.derived().aliases(first, last);
+}
+
+template <class T>
+inline bool matrix_expr_aliases(const matrix<T>&, const void *, const void *)
+{
+   return false;
+}
+
+struct matrix_expr_add {
+   template <class T>
+   static T apply(const T& a, const T& b) { return a + b; }
+};
+
+struct matrix_expr_sub {
+   template <class T>
+   static T apply(const T& a, const T& b) { return a - b; }
+};
+
+template <class L, class R, class Op>
+class matrix_binary_expr : public matrix_expr<matrix_binary_expr<L, R, Op>> {
+
+public:
+
+   typedef typename L::number_type number_type;
+
+   matrix_binary_expr(const L& l, const R& r) : _l(l), _r(r) {
+
+      if (l.rows() != r.rows() || l.cols() != r.cols())
+         throw std::domain_error("Argument matrix and object matrix MUST have the same size");
+   }
+
+   int rows() const { return _l.rows(); }
+   int cols() const { return _l.cols(); }
+
+   number_type operator()(int r, int c) const {
+      return Op::apply(_l(r, c), _r(r, c));
+   }
+
+   bool aliases(const void *first, const void *last) const {
+      return matrix_expr_aliases(_l, first, last) ||
+             matrix_expr_aliases(_r, first, last);
+   }
+
+private:
+
+   typename matrix_expr_operand<L>::type _l;
+   typename matrix_expr_operand<R>::type _r;
+};
+
+template <class E>
+class matrix_scaled_expr : public matrix_expr<matrix_scaled_expr<E>> {
+
+public:
+
+   typedef typename E::number_type number_type;
+
+   matrix_scaled_expr(const E& e, const number_type& k) : _e(e), _k(k) { }
+
+   int rows() const { return _e.rows(); }
+   int cols() const { return _e.cols(); }
+
+   number_type operator()(int r, int c) const { return _e(r, c) * _k; }
+
+   bool aliases(const void *first, const void *last) const {
+      return matrix_expr_aliases(_e, first, last);
+   }
+
+private:
+
+   typename matrix_expr_operand<E>::type _e;
+   const number_type _k;
+};
+
+
+template <class L, class R>
+inline matrix_binary_expr<L, R, matrix_expr_add>
+operator+(const matrix_expr<L>& l, const matrix_expr<R>& r)
+{
+   return matrix_binary_expr<L, R, matrix_expr_add>(l.derived(), r.derived());
+}
+
+template <class L, class R>
+inline matrix_binary_expr<L, R, matrix_expr_sub>
+operator-(const matrix_expr<L>& l, const matrix_expr<R>& r)
+{
+   return matrix_binary_expr<L, R, matrix_expr_sub>(l.derived(), r.derived());
+}
+
+template <class E>
+inline matrix_scaled_expr<E>
+operator*(const matrix_expr<E>& e, const typename E::number_type& k)
+{
+   return matrix_scaled_expr<E>(e.derived(), k);
+}
+
+template <class E>
+inline matrix_scaled_expr<E>
+operator*(const typename E::number_type& k, const matrix_expr<E>& e)
+{
+   return matrix_scaled_expr<E>(e.derived(), k);
+}
+
+} // namespace vmatrixlib
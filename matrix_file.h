@@ -0,0 +1,465 @@
+
+#pragma once
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <climits>
+#include <string>
+#include <memory>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <stdexcept>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+#include "matrix.h"
+
+namespace vmatrixlib {
+
+/*
+ * Binary matrix files: a 64 byte header followed by the elements, in row
+ * or column major order, in the byte order of the machine which wrote them
+ * (recorded in the header, checked on reading).
+ *
+ * The data starts at a 64 byte offset, so a mapped file is suitably
+ * aligned for any element type: mapped_matrix_file gives a view on the
+ * elements of a file mapped in memory, with no copy and no read until the
+ * pages are touched. A column major file is viewed through a transposed
+ * view, still without copying.
+ *
+ * Only plain arithmetic elements are supported (float, double, int32_t,
+ * int64_t): frac and complex_frac are not plain data. As everywhere in
+ * the library, rows * cols must fit in an int.
+ */
+
+enum class matrix_layout : uint32_t { row_major = 0, col_major = 1 };
+enum class map_mode { read_only, read_write };
+
+template <class T>
+struct matrix_file_type;
+
+template <> struct matrix_file_type<float>   { static constexpr uint32_t tag = 1; };
+template <> struct matrix_file_type<double>  { static constexpr uint32_t tag = 2; };
+template <> struct matrix_file_type<int32_t> { static constexpr uint32_t tag = 3; };
+template <> struct matrix_file_type<int64_t> { static constexpr uint32_t tag = 4; };
+
+struct matrix_file_header {
+
+   char magic[8];           // "VMATRIX"
+   uint32_t version;
+   uint32_t byte_order;     // matrix_file_byte_order, as written
+   uint32_t type;           // matrix_file_type<T>::tag
+   uint32_t elem_size;
+   uint32_t layout;         // matrix_layout
+   uint32_t reserved0;
+   uint64_t rows;
+   uint64_t cols;
+   uint64_t data_offset;
+   uint64_t reserved1;
+};
+
+static_assert(sizeof(matrix_file_header) == 64, "The header must be 64 bytes");
+
+constexpr const uint32_t matrix_file_version = 1;
+constexpr const uint32_t matrix_file_byte_order = 0x01020304;
+
+namespace matrix_file_detail {
+
+   template <class T>
+   matrix_file_header make_header(int rows, int cols, matrix_layout layout)
+   {
+      matrix_file_header h;
+
+      memset(&h, 0, sizeof(h));
+      memcpy(h.magic, "VMATRIX", 8);
+
+      h.version = matrix_file_version;
+      h.byte_order = matrix_file_byte_order;
+      h.type = matrix_file_type<T>::tag;
+      h.elem_size = sizeof(T);
+      h.layout = static_cast<uint32_t>(layout);
+      h.rows = rows;
+      h.cols = cols;
+      h.data_offset = sizeof(matrix_file_header);
+
+      return h;
+   }
+
+   // Throws unless the file holds a complete matrix of T's.
+   template <class T>
+   void check_header(const matrix_file_header& h, uint64_t fileSize)
+   {
+      if (fileSize < sizeof(h) || memcmp(h.magic, "VMATRIX", 8))
+         throw std::runtime_error("Not a matrix file");
+
+      if (h.version != matrix_file_version)
+         throw std::runtime_error("Unsupported matrix file version");
+
+      if (h.byte_order != matrix_file_byte_order)
+         throw std::runtime_error("The matrix file was written with another byte order");
+
+      if (h.type != matrix_file_type<T>::tag || h.elem_size != sizeof(T))
+         throw std::runtime_error("The matrix file holds another element type");
+
+      if (h.layout > static_cast<uint32_t>(matrix_layout::col_major))
+         throw std::runtime_error("Invalid layout in matrix file");
+
+      if (h.rows > INT_MAX || h.cols > INT_MAX ||
+          (h.cols && h.rows > INT_MAX / h.cols))
+      {
+         throw std::runtime_error("The matrix in the file is too big");
+      }
+
+      // Written so as not to wrap around, whatever data_offset is.
+      if (h.data_offset < sizeof(h) || h.data_offset % sizeof(T) ||
+          h.data_offset > fileSize ||
+          (fileSize - h.data_offset) / sizeof(T) < h.rows * h.cols)
+      {
+         throw std::runtime_error("Truncated or corrupted matrix file");
+      }
+   }
+
+   // A whole file, mapped in memory.
+   struct mapping {
+      void *addr = nullptr;
+      uint64_t length = 0;
+   };
+
+   // With create, the file is created (or truncated) with the given length.
+   inline mapping map_file(const std::string& path, bool writable,
+                           bool create, uint64_t length)
+   {
+      mapping m;
+
+#ifdef _WIN32
+
+      HANDLE file = CreateFileA(path.c_str(),
+                                GENERIC_READ | (writable ? GENERIC_WRITE : 0),
+                                FILE_SHARE_READ, nullptr,
+                                create ? CREATE_ALWAYS : OPEN_EXISTING,
+                                FILE_ATTRIBUTE_NORMAL, nullptr);
+
+      if (file == INVALID_HANDLE_VALUE)
+         throw std::runtime_error("Can't open " + path);
+
+      LARGE_INTEGER size;
+      size.QuadPart = static_cast<LONGLONG>(length);
+
+      if (create && (!SetFilePointerEx(file, size, nullptr, FILE_BEGIN) ||
+                     !SetEndOfFile(file)))
+      {
+         CloseHandle(file);
+         throw std::runtime_error("Can't resize " + path);
+      }
+
+      if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+         CloseHandle(file);
+         throw std::runtime_error("Can't map the empty file " + path);
+      }
+
+      HANDLE fileMapping = CreateFileMappingA(file, nullptr,
+                                              writable ? PAGE_READWRITE : PAGE_READONLY,
+                                              0, 0, nullptr);
+      CloseHandle(file);
+
+      if (!fileMapping)
+         throw std::runtime_error("Can't map " + path);
+
+      m.addr = MapViewOfFile(fileMapping, writable ? FILE_MAP_WRITE : FILE_MAP_READ,
+                             0, 0, 0);
+      m.length = static_cast<uint64_t>(size.QuadPart);
+
+      // The view keeps the mapping (and the file) alive.
+      CloseHandle(fileMapping);
+
+      if (!m.addr)
+         throw std::runtime_error("Can't map " + path);
+
+#else
+
+      const int flags = (writable ? O_RDWR : O_RDONLY) | (create ? O_CREAT | O_TRUNC : 0);
+      const int fd = open(path.c_str(), flags, 0644);
+
+      if (fd < 0)
+         throw std::runtime_error("Can't open " + path);
+
+      struct stat st;
+
+      if ((create && ftruncate(fd, static_cast<off_t>(length))) || fstat(fd, &st)) {
+         close(fd);
+         throw std::runtime_error("Can't resize " + path);
+      }
+
+      if (st.st_size == 0) {
+         close(fd);
+         throw std::runtime_error("Can't map the empty file " + path);
+      }
+
+      m.length = static_cast<uint64_t>(st.st_size);
+      m.addr = mmap(nullptr, m.length, PROT_READ | (writable ? PROT_WRITE : 0),
+                    MAP_SHARED, fd, 0);
+
+      // The mapping stays valid after the file is closed.
+      close(fd);
+
+      if (m.addr == MAP_FAILED) {
+         m.addr = nullptr;
+         throw std::runtime_error("Can't map " + path);
+      }
+
+#endif
+
+      return m;
+   }
+
+   inline void unmap_file(mapping& m)
+   {
+      if (!m.addr)
+         return;
+
+#ifdef _WIN32
+      UnmapViewOfFile(m.addr);
+#else
+      munmap(m.addr, m.length);
+#endif
+
+      m.addr = nullptr;
+      m.length = 0;
+   }
+
+   inline bool flush_mapping(const mapping& m)
+   {
+#ifdef _WIN32
+      return FlushViewOfFile(m.addr, 0) != 0;
+#else
+      return msync(m.addr, m.length, MS_SYNC) == 0;
+#endif
+   }
+
+   struct file_closer {
+      void operator()(FILE *f) const { fclose(f); }
+   };
+
+} // namespace matrix_file_detail
+
+
+/*
+ * Writes the elements row by row (or, for col_major, column by column):
+ * the view may be a block or a transposed view.
+ */
+template <class T>
+void write_matrix_file(const std::string& path, const const_matrix_view<T>& m,
+                       matrix_layout layout = matrix_layout::row_major)
+{
+   const matrix_file_header h =
+      matrix_file_detail::make_header<T>(m.rows(), m.cols(), layout);
+
+   std::unique_ptr<FILE, matrix_file_detail::file_closer> f(fopen(path.c_str(), "wb"));
+
+   if (!f)
+      throw std::runtime_error("Can't create " + path);
+
+   // In column major order, the lines written are the columns.
+   const const_matrix_view<T> lines =
+      layout == matrix_layout::row_major ? m : m.transposed();
+
+   std::vector<T> buf(lines.col_stride() == 1 ? 0 : lines.cols());
+   bool ok = fwrite(&h, sizeof(h), 1, f.get()) == 1;
+
+   for (int i=0; i < lines.rows() && ok && lines.cols(); i++) {
+
+      const T *src = &lines(i,0);
+
+      if (!buf.empty()) {
+
+         for (int j=0; j < lines.cols(); j++)
+            buf[j] = lines(i,j);
+
+         src = buf.data();
+      }
+
+      ok = fwrite(src, sizeof(T), lines.cols(), f.get()) == static_cast<size_t>(lines.cols());
+   }
+
+   if (!ok || fclose(f.release()))
+      throw std::runtime_error("Can't write " + path);
+}
+
+template <class T>
+void write_matrix_file(const std::string& path, const matrix<T>& m,
+                       matrix_layout layout = matrix_layout::row_major)
+{
+   write_matrix_file(path, m.view(), layout);
+}
+
+template <class T>
+class mapped_matrix_file {
+
+public:
+
+   explicit mapped_matrix_file(const std::string& path,
+                               map_mode mode = map_mode::read_only);
+
+   // Creates (or truncates) a zero-filled matrix file and maps it read-write.
+   static mapped_matrix_file create(const std::string& path, int rows, int cols,
+                                    matrix_layout layout = matrix_layout::row_major);
+
+   mapped_matrix_file(const mapped_matrix_file&) = delete;
+   mapped_matrix_file& operator=(const mapped_matrix_file&) = delete;
+
+   mapped_matrix_file(mapped_matrix_file&& m) noexcept;
+   mapped_matrix_file& operator=(mapped_matrix_file&& m) noexcept;
+
+   ~mapped_matrix_file() { matrix_file_detail::unmap_file(_map); }
+
+   int rows() const { return static_cast<int>(_header.rows); }
+   int cols() const { return static_cast<int>(_header.cols); }
+   matrix_layout layout() const { return static_cast<matrix_layout>(_header.layout); }
+   bool is_writable() const { return _writable; }
+
+   const_matrix_view<T> view() const;
+
+   // Writing through the view writes the file. Requires map_mode::read_write.
+   matrix_view<T> mutable_view();
+
+   // Writes the changed pages back to the file now.
+   void flush();
+
+protected:
+
+   mapped_matrix_file() : _writable(false) { }
+
+   matrix_file_detail::mapping _map;
+   matrix_file_header _header;
+   bool _writable;
+
+   T *data() const {
+      return reinterpret_cast<T *>(static_cast<char *>(_map.addr) + _header.data_offset);
+   }
+};
+
+
+template <class T>
+mapped_matrix_file<T>::mapped_matrix_file(const std::string& path, map_mode mode)
+   : _writable(mode == map_mode::read_write)
+{
+   _map = matrix_file_detail::map_file(path, _writable, false, 0);
+
+   memset(&_header, 0, sizeof(_header));
+   memcpy(&_header, _map.addr, std::min<uint64_t>(sizeof(_header), _map.length));
+
+   try {
+      matrix_file_detail::check_header<T>(_header, _map.length);
+   } catch (...) {
+      matrix_file_detail::unmap_file(_map);
+      throw;
+   }
+}
+
+template <class T>
+mapped_matrix_file<T>
+mapped_matrix_file<T>::create(const std::string& path, int rows, int cols,
+                              matrix_layout layout)
+{
+   if (rows < 0 || cols < 0 || (cols && rows > INT_MAX / cols))
+      throw std::domain_error("Invalid matrix size");
+
+   mapped_matrix_file res;
+
+   res._header = matrix_file_detail::make_header<T>(rows, cols, layout);
+   res._writable = true;
+   res._map = matrix_file_detail::map_file(path, true, true,
+                                           res._header.data_offset +
+                                           static_cast<uint64_t>(rows) * cols * sizeof(T));
+
+   memcpy(res._map.addr, &res._header, sizeof(res._header));
+   return res;
+}
+
+template <class T>
+mapped_matrix_file<T>::mapped_matrix_file(mapped_matrix_file&& m) noexcept
+   : _map(m._map), _header(m._header), _writable(m._writable)
+{
+   m._map = matrix_file_detail::mapping();
+}
+
+template <class T>
+mapped_matrix_file<T>& mapped_matrix_file<T>::operator=(mapped_matrix_file&& m) noexcept
+{
+   if (this != &m) {
+
+      matrix_file_detail::unmap_file(_map);
+
+      _map = m._map;
+      _header = m._header;
+      _writable = m._writable;
+      m._map = matrix_file_detail::mapping();
+   }
+
+   return *this;
+}
+
+template <class T>
+const_matrix_view<T> mapped_matrix_file<T>::view() const
+{
+   if (layout() == matrix_layout::row_major)
+      return const_matrix_view<T>(data(), rows(), cols(), cols());
+
+   return const_matrix_view<T>(data(), rows(), cols(), 1, rows());
+}
+
+template <class T>
+matrix_view<T> mapped_matrix_file<T>::mutable_view()
+{
+   if (!_writable)
+      throw std::runtime_error("The matrix file is mapped read-only");
+
+   if (layout() == matrix_layout::row_major)
+      return matrix_view<T>(data(), rows(), cols(), cols());
+
+   return matrix_view<T>(data(), rows(), cols(), 1, rows());
+}
+
+template <class T>
+void mapped_matrix_file<T>::flush()
+{
+   if (_writable && !matrix_file_detail::flush_mapping(_map))
+      throw std::runtime_error("Can't write the mapped matrix file");
+}
+
+// Through a mapping, which also works for files over 2 GB everywhere.
+template <class T>
+matrix<T> read_matrix_file(const std::string& path)
+{
+   const mapped_matrix_file<T> file(path);
+   const const_matrix_view<T> v = file.view();
+
+   matrix<T> res(v.rows(), v.cols());
+
+   if (res.size() == 0)
+      return res;
+
+   if (file.layout() == matrix_layout::row_major)
+      std::copy(v.data(), v.data() + res.size(), &res(0));
+   else
+      transpose_copy(v.cols(), v.rows(), v.data(), v.rows(), &res(0), v.cols());
+
+   return res;
+}
+
+} // namespace vmatrixlib
@@ -0,0 +1,715 @@
+
+#pragma once
+
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <climits>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <limits>
+#include <algorithm>
+#include <stdexcept>
+#include <type_traits>
+
+#include "matrix_file.h"
+#include "matrix_writer.h"
+
+namespace vmatrixlib {
+
+/*
+ * Parsers for the text of matrix_writer.h: Matlab ([a b; c d]),
+ * Mathematica ({{a,b},{c,d}}) and CSV (one line per row). They read a
+ * memory buffer, or a file mapped in memory, and fill the matrix directly:
+ * the text is never copied.
+ *
+ * The rows are found first with a scan for the row delimiters (no number
+ * text contains them); then the rows are parsed in parallel, each one
+ * straight into its row of the matrix.
+ *
+ * Elements are the ones to_string() writes: integers, fractions a/b,
+ * decimals (with an exponent, nan, inf) and, for complex_frac, the sums of
+ * a real and an imaginary part: 1/3+2i, -i, (1/2)i, 1.5-(3/4)i. Doubles
+ * are read with std::from_chars when the library has it (they read back
+ * exactly what write_csv() wrote), otherwise with strtod. fracs keep the
+ * integers, fractions and decimals whose digits fit exactly, and hold the
+ * value read otherwise (not rounded). Other number types are built from a
+ * long long fraction, or exactly from the decimal digits.
+ *
+ * Fields are separated by blanks or commas (Matlab), commas (Mathematica)
+ * or the given separator (CSV); blanks around them are ignored. Malformed
+ * text and rows of different lengths throw a std::runtime_error.
+ */
+
+namespace reader_detail {
+
+   inline bool is_blank(char c) {
+      return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+   }
+
+   inline const char *skip_blanks(const char *p, const char *last) {
+
+      while (p < last && is_blank(*p))
+         p++;
+
+      return p;
+   }
+
+   // The end of [first, last) without the trailing blanks.
+   inline const char *trim_blanks(const char *first, const char *last) {
+
+      while (last > first && is_blank(last[-1]))
+         last--;
+
+      return last;
+   }
+
+   inline bool ends_number(const char *p, const char *last) {
+      return p == last || (*p != '.' && *p != 'e' && *p != 'E');
+   }
+
+   // Decimal digits with an optional sign; nullptr on overflow or no digits.
+   template <class I>
+   const char *parse_integer(const char *p, const char *last, I& val)
+   {
+      const bool neg = p < last && *p == '-';
+
+      if (p < last && (*p == '-' || *p == '+'))
+         p++;
+
+      const char *digits = p;
+      const unsigned long long limit =
+         static_cast<unsigned long long>(std::numeric_limits<I>::max()) + (neg ? 1 : 0);
+      unsigned long long u = 0;
+
+      for (; p < last && *p >= '0' && *p <= '9'; p++) {
+
+         const unsigned d = static_cast<unsigned>(*p - '0');
+
+         if (u > (limit - d) / 10)
+            return nullptr;
+
+         u = u * 10 + d;
+      }
+
+      if (p == digits)
+         return nullptr;
+
+      val = neg ? static_cast<I>(0ULL - u) : static_cast<I>(u);
+      return p;
+   }
+
+   template <class F>
+   const char *parse_float_only(const char *p, const char *last, F& val)
+   {
+      if (p < last && *p == '+')
+         p++;
+
+#if VMATRIXLIB_FP_TO_CHARS
+      const std::from_chars_result r = std::from_chars(p, last, val);
+      return r.ec == std::errc() ? r.ptr : nullptr;
+#else
+      // strtold() wants a NUL-terminated string: numbers are short.
+      char buf[text_writer::max_number_chars];
+      const size_t n = std::min<size_t>(last - p, sizeof(buf) - 1);
+
+      memcpy(buf, p, n);
+      buf[n] = 0;
+
+      char *end;
+      val = static_cast<F>(strtold(buf, &end));
+      return end == buf ? nullptr : p + (end - buf);
+#endif
+   }
+
+   // A decimal, or a quotient of two decimals.
+   template <class F>
+   const char *parse_float(const char *p, const char *last, F& val)
+   {
+      p = parse_float_only(p, last, val);
+
+      if (!p || p == last || *p != '/')
+         return p;
+
+      F den;
+      p = parse_float_only(p + 1, last, den);
+
+      if (!p || den == 0)
+         return nullptr;
+
+      val /= den;
+      return p;
+   }
+
+   // v = v * 10 + d; false if an integer type overflows.
+   template <class A>
+   bool times_ten_plus(A& v, unsigned d, std::true_type)
+   {
+      if (v > (std::numeric_limits<A>::max() - static_cast<A>(d)) / 10)
+         return false;
+
+      v = v * 10 + static_cast<A>(d);
+      return true;
+   }
+
+   template <class A>
+   bool times_ten_plus(A& v, unsigned d, std::false_type)
+   {
+      v = v * A(10) + A(static_cast<int>(d));
+      return true;
+   }
+
+   template <class A>
+   bool times_ten_plus(A& v, unsigned d) {
+      return times_ten_plus(v, d, std::is_integral<A>());
+   }
+
+   /*
+    * The whole of [p, last) as a plain decimal, -12.5e-3: its digits without
+    * the dot (in A, >= 0), their power of ten and the sign. false for
+    * anything else (nan, inf, quotients) or if the digits overflow A.
+    */
+   template <class A>
+   bool parse_decimal(const char *p, const char *last, A& digits, int& exp10, bool& neg)
+   {
+      neg = p < last && *p == '-';
+
+      if (p < last && (*p == '-' || *p == '+'))
+         p++;
+
+      digits = A(0);
+      exp10 = 0;
+
+      bool dot = false, any = false;
+
+      for (; p < last; p++) {
+
+         if (*p == '.' && !dot) {
+            dot = true;
+            continue;
+         }
+
+         if (*p < '0' || *p > '9')
+            break;
+
+         if (!times_ten_plus(digits, static_cast<unsigned>(*p - '0')))
+            return false;
+
+         exp10 -= dot;
+         any = true;
+      }
+
+      if (!any)
+         return false;
+
+      if (p < last && (*p == 'e' || *p == 'E')) {
+
+         int e;
+         p = parse_integer(p + 1, last, e);
+
+         // Beyond the long double range anyway.
+         if (!p || e > 5000 || e < -5000)
+            return false;
+
+         exp10 += e;
+      }
+
+      return p == last;
+   }
+
+   // v * 10^n; false if an integer type overflows.
+   template <class A>
+   bool times_pow10(A& v, int n)
+   {
+      for (int i=0; i < n; i++)
+         if (!times_ten_plus(v, 0))
+            return false;
+
+      return true;
+   }
+
+   /*
+    * parse_number(p, last, x): reads the longest number at p into x, and
+    * returns its end (nullptr if there is no number).
+    */
+
+   template <class T>
+   const char *parse_number(const char *p, const char *last, T& x,
+                            std::true_type, std::false_type)
+   {
+      return parse_float(p, last, x);
+   }
+
+   template <class T>
+   const char *parse_number(const char *p, const char *last, T& x,
+                            std::false_type, std::true_type)
+   {
+      const char *q = parse_integer(p, last, x);
+      return q && ends_number(q, last) && (q == last || *q != '/') ? q : nullptr;
+   }
+
+   // Any other number type, built from a long long fraction or a long double.
+   template <class T>
+   const char *parse_number(const char *p, const char *last, T& x,
+                            std::false_type, std::false_type)
+   {
+      long long num, den = 1;
+      const char *q = parse_integer(p, last, num);
+
+      if (q && ends_number(q, last) && q < last && *q == '/') {
+
+         const char *r = parse_integer(q + 1, last, den);
+         q = r && ends_number(r, last) && den != 0 ? r : nullptr;
+      }
+
+      if (q && ends_number(q, last)) {
+         x = den == 1 ? T(num) : T(num) / T(den);
+         return q;
+      }
+
+      long double f;
+      q = parse_float(p, last, f);
+
+      if (!q)
+         return nullptr;
+
+      // Decimals exactly (1.5e-9 isn't 0); nan, inf and quotients as f.
+      T digits, scale(1);
+      int exp10;
+      bool neg;
+
+      if (parse_decimal(p, q, digits, exp10, neg) && times_pow10(scale, std::abs(exp10))) {
+
+         if (neg)
+            digits = -digits;
+
+         x = exp10 >= 0 ? digits * scale : digits / scale;
+
+      } else {
+
+         x = T(f);
+      }
+
+      return q;
+   }
+
+   template <class T>
+   const char *parse_number(const char *p, const char *last, T& x)
+   {
+      return parse_number(p, last, x, std::is_floating_point<T>(), std::is_integral<T>());
+   }
+
+   template <class I, class F>
+   const char *parse_number(const char *p, const char *last, frac<I, F>& x)
+   {
+      I num, den = 1;
+      const char *q = parse_integer(p, last, num);
+
+      if (q && ends_number(q, last) && q < last && *q == '/') {
+
+         const char *r = parse_integer(q + 1, last, den);
+         q = r && ends_number(r, last) && den != 0 ? r : nullptr;
+      }
+
+      if (q && ends_number(q, last)) {
+         x = frac<I, F>(num, den);
+         return q;
+      }
+
+      // A decimal, or integers which overflow I.
+      F f;
+      q = parse_float(p, last, f);
+
+      if (!q)
+         return nullptr;
+
+      // Exact if digits and power of ten fit I: 0.25, 4e3; the value read
+      // otherwise (not rounded to a few decimals).
+      I digits;
+      int exp10;
+      bool neg;
+
+      den = 1;
+
+      if (parse_decimal(p, q, digits, exp10, neg) &&
+          times_pow10(exp10 >= 0 ? digits : den, std::abs(exp10)))
+         x = frac<I, F>(neg ? -digits : digits, den);
+      else
+         x = frac<I, F>::make_dec_frac(f);
+
+      return q;
+   }
+
+   // A real or an imaginary term: r, ri, i, -i, (r)i, -(r)i.
+   template <class F>
+   const char *parse_complex_term(const char *p, const char *last, F& x, bool& imag)
+   {
+      const bool neg = p < last && *p == '-';
+      const char *q = p < last && (*p == '-' || *p == '+') ? p + 1 : p;
+
+      if (q < last && *q == 'i') {
+         x = neg ? F(-1) : F(1);
+         imag = true;
+         return q + 1;
+      }
+
+      if (q < last && *q == '(') {
+
+         q = parse_number(q + 1, last, x);
+
+         if (!q || last - q < 2 || q[0] != ')' || q[1] != 'i')
+            return nullptr;
+
+         if (neg)
+            x = -x;
+
+         imag = true;
+         return q + 2;
+      }
+
+      q = parse_number(p < last && *p == '+' ? p + 1 : p, last, x);
+
+      if (!q)
+         return nullptr;
+
+      imag = q < last && *q == 'i';
+      return imag ? q + 1 : q;
+   }
+
+   template <class F>
+   const char *parse_number(const char *p, const char *last, complex_frac<F>& x)
+   {
+      F re = F(), im = F();
+      bool imag;
+
+      p = parse_complex_term(p, last, re, imag);
+
+      if (!p)
+         return nullptr;
+
+      if (imag) {
+         x = complex_frac<F>(F(), re);
+         return p;
+      }
+
+      if (p < last && (*p == '+' || *p == '-')) {
+
+         p = parse_complex_term(p, last, im, imag);
+
+         if (!p || !imag)
+            return nullptr;
+      }
+
+      x = complex_frac<F>(re, im);
+      return p;
+   }
+
+   struct text_row {
+      const char *first;
+      const char *last;
+   };
+
+   /*
+    * Calls f(first, last, j) for the j-th field of the row, stopping when it
+    * returns false. Returns the number of fields, or -1 if f failed.
+    * sep == ' ' stands for blanks and commas.
+    */
+   template <class Func>
+   int for_each_field(const text_row& row, char sep, Func f)
+   {
+      const char *p = skip_blanks(row.first, row.last);
+      const char *last = trim_blanks(p, row.last);
+
+      if (p == last)
+         return 0;
+
+      for (int j=0; ; j++) {
+
+         const char *e = p;
+
+         if (sep == ' ') {
+
+            while (e < last && !is_blank(*e) && *e != ',')
+               e++;
+
+         } else {
+
+            e = static_cast<const char *>(memchr(p, sep, last - p));
+
+            if (!e)
+               e = last;
+         }
+
+         if (!f(p, trim_blanks(p, e), j))
+            return -1;
+
+         if (e == last)
+            return j + 1;
+
+         if (sep == ' ') {
+
+            e = skip_blanks(e, last);
+
+            if (e < last && *e == ',')
+               e = skip_blanks(e + 1, last);
+
+         } else {
+
+            e = skip_blanks(e + 1, last);
+         }
+
+         p = e;
+      }
+   }
+
+   // Parses the rows into a matrix (in parallel); what names the format.
+   template <class T>
+   matrix<T> parse_rows(const std::vector<text_row>& rows, char sep, const char *what)
+   {
+      const int nrows = static_cast<int>(rows.size());
+
+      if (!nrows)
+         return matrix<T>();
+
+      const int cols = for_each_field(rows[0], sep, [](const char *, const char *, int) {
+         return true;
+      });
+
+      if (cols && nrows > INT_MAX / cols)
+         throw std::runtime_error(std::string("Too many elements in the ") + what + " text");
+
+      matrix<T> res(nrows, cols);
+
+      // The first bad row, if any: parallel_for() would rethrow the one of
+      // whichever chunk failed first.
+      std::atomic<int> badRow(nrows);
+      const int grain = std::max(1, parallel_grain<T>::value / std::max(1, cols));
+
+      parallel_for(0, nrows, grain, [&](int rb, int re) {
+
+         for (int i=rb; i < re; i++) {
+
+            T *row = cols ? &res(i,0) : nullptr;
+
+            const int n = for_each_field(rows[i], sep,
+               [row, cols](const char *first, const char *last, int j) {
+                  return j < cols && parse_number(first, last, row[j]) == last;
+               }
+            );
+
+            if (n != cols) {
+
+               int bad = badRow.load();
+
+               while (i < bad && !badRow.compare_exchange_weak(bad, i)) { }
+               return;
+            }
+         }
+      });
+
+      if (badRow.load() < nrows) {
+         throw std::runtime_error(std::string("Invalid or misaligned row ") +
+                                  std::to_string(badRow.load() + 1) +
+                                  " in the " + what + " text");
+      }
+
+      return res;
+   }
+
+   inline void syntax_error(const char *what) {
+      throw std::runtime_error(std::string("Malformed ") + what + " text");
+   }
+
+   // The rows between the outer brackets, separated by ';'.
+   inline std::vector<text_row> matlab_rows(const char *first, const char *last)
+   {
+      std::vector<text_row> rows;
+
+      first = skip_blanks(first, last);
+      last = trim_blanks(first, last);
+
+      if (last - first < 2 || *first != '[' || last[-1] != ']')
+         syntax_error("Matlab");
+
+      const char *p = first + 1;
+      last--;
+
+      if (skip_blanks(p, last) == last)
+         return rows;
+
+      while (true) {
+
+         const char *e = static_cast<const char *>(memchr(p, ';', last - p));
+
+         rows.push_back(text_row{ p, e ? e : last });
+
+         if (!e)
+            return rows;
+
+         p = e + 1;
+      }
+   }
+
+   // The rows of {{...},{...}}.
+   inline std::vector<text_row> mathematica_rows(const char *first, const char *last)
+   {
+      std::vector<text_row> rows;
+
+      const char *p = skip_blanks(first, last);
+
+      if (p == last || *p != '{')
+         syntax_error("Mathematica");
+
+      p = skip_blanks(p + 1, last);
+
+      if (p < last && *p == '}')
+         p++;
+      else while (true) {
+
+         if (p == last || *p != '{')
+            syntax_error("Mathematica");
+
+         const char *e = static_cast<const char *>(memchr(p + 1, '}', last - p - 1));
+
+         if (!e)
+            syntax_error("Mathematica");
+
+         rows.push_back(text_row{ p + 1, e });
+         p = skip_blanks(e + 1, last);
+
+         if (p < last && *p == '}') {
+            p++;
+            break;
+         }
+
+         if (p == last || *p != ',')
+            syntax_error("Mathematica");
+
+         p = skip_blanks(p + 1, last);
+      }
+
+      if (skip_blanks(p, last) != last)
+         syntax_error("Mathematica");
+
+      return rows;
+   }
+
+   // One row per line; the blank lines at the end are ignored.
+   inline std::vector<text_row> csv_rows(const char *first, const char *last)
+   {
+      std::vector<text_row> rows;
+
+      last = trim_blanks(first, last);
+
+      for (const char *p = first; p < last; ) {
+
+         const char *e = static_cast<const char *>(memchr(p, '\n', last - p));
+
+         if (!e)
+            e = last;
+
+         rows.push_back(text_row{ p, e });
+         p = e + 1;
+      }
+
+      return rows;
+   }
+
+   // f(first, last) on the whole file, mapped in memory.
+   template <class Func>
+   auto with_mapped_text(const std::string& path, Func f) -> decltype(f(nullptr, nullptr))
+   {
+      matrix_file_detail::mapping map = matrix_file_detail::map_file(path, false, false, 0);
+      const char *text = static_cast<const char *>(map.addr);
+
+      try {
+
+         auto res = f(text, text + map.length);
+         matrix_file_detail::unmap_file(map);
+         return res;
+
+      } catch (...) {
+
+         matrix_file_detail::unmap_file(map);
+         throw;
+      }
+   }
+
+} // namespace reader_detail
+
+// [a b; c d], as write_matlab() writes it.
+template <class T>
+matrix<T> read_matlab(const char *text, size_t size)
+{
+   return reader_detail::parse_rows<T>(
+      reader_detail::matlab_rows(text, text + size), ' ', "Matlab"
+   );
+}
+
+// {{a,b},{c,d}}, as write_mathematica() writes it.
+template <class T>
+matrix<T> read_mathematica(const char *text, size_t size)
+{
+   return reader_detail::parse_rows<T>(
+      reader_detail::mathematica_rows(text, text + size), ',', "Mathematica"
+   );
+}
+
+// Rows on separate lines, as write_csv() writes them.
+template <class T>
+matrix<T> read_csv(const char *text, size_t size, char sep = ',')
+{
+   if (reader_detail::is_blank(sep))
+      throw std::domain_error("The CSV separator can't be a blank");
+
+   return reader_detail::parse_rows<T>(
+      reader_detail::csv_rows(text, text + size), sep, "CSV"
+   );
+}
+
+template <class T>
+matrix<T> read_matlab(const std::string& text) {
+   return read_matlab<T>(text.data(), text.size());
+}
+
+template <class T>
+matrix<T> read_mathematica(const std::string& text) {
+   return read_mathematica<T>(text.data(), text.size());
+}
+
+template <class T>
+matrix<T> read_csv(const std::string& text, char sep = ',') {
+   return read_csv<T>(text.data(), text.size(), sep);
+}
+
+/*
+ * The same, from a text file mapped in memory. As for mapped_matrix_file,
+ * mapping an empty file is an error.
+ */
+
+template <class T>
+matrix<T> read_matlab_file(const std::string& path)
+{
+   return reader_detail::with_mapped_text(path, [](const char *first, const char *last) {
+      return read_matlab<T>(first, last - first);
+   });
+}
+
+template <class T>
+matrix<T> read_mathematica_file(const std::string& path)
+{
+   return reader_detail::with_mapped_text(path, [](const char *first, const char *last) {
+      return read_mathematica<T>(first, last - first);
+   });
+}
+
+template <class T>
+matrix<T> read_csv_file(const std::string& path, char sep = ',')
+{
+   return reader_detail::with_mapped_text(path, [sep](const char *first, const char *last) {
+      return read_csv<T>(first, last - first, sep);
+   });
+}
+
+} // namespace vmatrixlib
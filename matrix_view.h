@@ -0,0 +1,221 @@
+
+#pragma once
+
+#include <cassert>
+#include <functional>
+#include "matrix_expr.h"
+
+namespace vmatrixlib {
+
+/*
+ * Non-owning views over matrix elements.
+ *
+ * A view is just a pointer to its first element, its size and two strides:
+ * element (r, c) lives at ptr[r * rowStride + c * colStride]. That's
+ * enough to describe without copying a whole matrix, a row, a column,
+ * any rectangular block and the transpose of any of those.
+ *
+ * Views are cheap to copy and don't own anything: they must not outlive
+ * the matrix (or buffer) they refer to, and resizing that matrix
+ * invalidates them.
+ *
+ * Both kinds of views are matrix expressions, so they can be combined
+ * with +, - and * (scalar) and assigned to matrices. Assigning to a
+ * matrix_view writes through it:
+ *
+ *    A.block(0, 0, 2, 2) = B.block(1, 1, 2, 2) * k;
+ */
+
+template <class T>
+class const_matrix_view : public matrix_expr<const_matrix_view<T>> {
+
+public:
+
+   typedef T number_type;
+
+   const_matrix_view()
+      : _ptr(nullptr), _rows(0), _cols(0), _rowStride(0), _colStride(1) { }
+
+   const_matrix_view(const T *ptr, int rows, int cols,
+                     int rowStride, int colStride = 1)
+      : _ptr(const_cast<T *>(ptr)), _rows(rows), _cols(cols),
+        _rowStride(rowStride), _colStride(colStride) { }
+
+   int rows() const { return _rows; }
+   int cols() const { return _cols; }
+   int size() const { return _rows * _cols; }
+   int row_stride() const { return _rowStride; }
+   int col_stride() const { return _colStride; }
+   const T *data() const { return _ptr; }
+
+   const T& operator()(int r, int c) const {
+
+      assert(r >= 0 && r < _rows && c >= 0 && c < _cols);
+      return _ptr[r * _rowStride + c * _colStride];
+   }
+
+   const_matrix_view block(int r, int c, int nr, int nc) const {
+
+      assert(r >= 0 && nr >= 0 && r + nr <= _rows);
+      assert(c >= 0 && nc >= 0 && c + nc <= _cols);
+
+      return const_matrix_view(_ptr + r * _rowStride + c * _colStride,
+                               nr, nc, _rowStride, _colStride);
+   }
+
+   const_matrix_view row(int r) const { return block(r, 0, 1, _cols); }
+   const_matrix_view col(int c) const { return block(0, c, _rows, 1); }
+
+   const_matrix_view transposed() const {
+      return const_matrix_view(_ptr, _cols, _rows, _colStride, _rowStride);
+   }
+
+   // Whether any element may lie in [first, last).
+   bool aliases(const void *first, const void *last) const {
+
+      if (!size())
+         return false;
+
+      const T *end = _ptr + (_rows - 1) * _rowStride + (_cols - 1) * _colStride + 1;
+      const std::less<const void *> less;
+
+      return less(_ptr, last) && less(first, end);
+   }
+
+protected:
+
+   // Not const: matrix_view shares this representation. Only matrix_view
+   // hands out mutable access to the elements.
+   T *_ptr;
+
+   int _rows;
+   int _cols;
+   int _rowStride;
+   int _colStride;
+};
+
+
+template <class T>
+class matrix_view : public const_matrix_view<T> {
+
+   typedef const_matrix_view<T> base;
+
+public:
+
+   matrix_view() = default;
+
+   matrix_view(T *ptr, int rows, int cols, int rowStride, int colStride = 1)
+      : base(ptr, rows, cols, rowStride, colStride) { }
+
+   matrix_view(const matrix_view&) = default;
+
+   // Views have reference semantics: assignment copies the elements.
+   matrix_view& operator=(const matrix_view& v) {
+      return operator=(static_cast<const matrix_expr<base>&>(v));
+   }
+
+   template <class E>
+   matrix_view& operator=(const matrix_expr<E>& e);
+
+   template <class E>
+   matrix_view& operator+=(const matrix_expr<E>& e);
+
+   template <class E>
+   matrix_view& operator-=(const matrix_expr<E>& e);
+
+   matrix_view& operator*=(const T& k);
+
+   T *data() const { return this->_ptr; }
+
+   T& operator()(int r, int c) const {
+
+      assert(r >= 0 && r < this->_rows && c >= 0 && c < this->_cols);
+      return this->_ptr[r * this->_rowStride + c * this->_colStride];
+   }
+
+   matrix_view block(int r, int c, int nr, int nc) const {
+
+      assert(r >= 0 && nr >= 0 && r + nr <= this->_rows);
+      assert(c >= 0 && nc >= 0 && c + nc <= this->_cols);
+
+      return matrix_view(this->_ptr + r * this->_rowStride + c * this->_colStride,
+                         nr, nc, this->_rowStride, this->_colStride);
+   }
+
+   matrix_view row(int r) const { return block(r, 0, 1, this->_cols); }
+   matrix_view col(int c) const { return block(0, c, this->_rows, 1); }
+
+   matrix_view transposed() const {
+      return matrix_view(this->_ptr, this->_cols, this->_rows,
+                         this->_colStride, this->_rowStride);
+   }
+
+private:
+
+   template <class E>
+   void check_size(const E& e) const {
+
+      if (e.rows() != this->_rows || e.cols() != this->_cols)
+         throw std::domain_error("Argument matrix and object matrix MUST have the same size");
+   }
+};
+
+/*
+ * NOTE: the elements are updated position by position, with no temporary
+ * (unlike matrix::operator=), so the expression may refer to the same
+ * elements of the view, but not to other overlapping elements (e.g.
+ * A.view() = A.view().transposed()).
+ */
+template <class T>
+template <class E>
+matrix_view<T>& matrix_view<T>::operator=(const matrix_expr<E>& expr) {
+
+   const E& e = expr.derived();
+   check_size(e);
+
+   for (int r = 0; r < this->_rows; r++)
+      for (int c = 0; c < this->_cols; c++)
+         (*this)(r, c) = e(r, c);
+
+   return *this;
+}
+
+template <class T>
+template <class E>
+matrix_view<T>& matrix_view<T>::operator+=(const matrix_expr<E>& expr) {
+
+   const E& e = expr.derived();
+   check_size(e);
+
+   for (int r = 0; r < this->_rows; r++)
+      for (int c = 0; c < this->_cols; c++)
+         (*this)(r, c) += e(r, c);
+
+   return *this;
+}
+
+template <class T>
+template <class E>
+matrix_view<T>& matrix_view<T>::operator-=(const matrix_expr<E>& expr) {
+
+   const E& e = expr.derived();
+   check_size(e);
+
+   for (int r = 0; r < this->_rows; r++)
+      for (int c = 0; c < this->_cols; c++)
+         (*this)(r, c) -= e(r, c);
+
+   return *this;
+}
+
+template <class T>
+matrix_view<T>& matrix_view<T>::operator*=(const T& k) {
+
+   for (int r = 0; r < this->_rows; r++)
+      for (int c = 0; c < this->_cols; c++)
+         (*this)(r, c) *= k;
+
+   return *this;
+}
+
+} // namespace vmatrixlib
@@ -0,0 +1,619 @@
+
+#pragma once
+
+#include <cmath>
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <limits>
+#include <ostream>
+#include <algorithm>
+#include <type_traits>
+
+#if __cplusplus >= 201703L && defined(__has_include)
+#if __has_include(<charconv>)
+#include <charconv>
+#endif
+#endif
+
+#include "complex_frac.h"
+#include "matrix_view.h"
+
+namespace vmatrixlib {
+
+template <class T>
+class matrix;
+
+/*
+ * Streaming text output of matrices: pretty (as pretty_print()), Matlab,
+ * Mathematica and CSV.
+ *
+ * A text_writer collects the text in a fixed buffer and hands it to a
+ * FILE* or an ostream when full, or writes straight into a caller's
+ * buffer. Arithmetic elements, fracs and complex_fracs are formatted in
+ * place in the buffer: no std::string per element and no format string to
+ * parse. With std::to_chars for floating point (C++17 libraries which have
+ * it), formatting is no longer the bottleneck of dumping big matrices; the
+ * fallback is a single snprintf per number. Other number types go through
+ * their to_string().
+ *
+ * precision is the one of to_string(): at most that many decimals, with
+ * the trailing zeros dropped, and the scientific notation for non-integers
+ * of magnitude <= 1e-6 or >= 1e12. A negative precision gives the shortest
+ * text which reads back to the same double (the default for CSV).
+ */
+
+#if defined(__cpp_lib_to_chars) && __cpp_lib_to_chars >= 201611L
+#define VMATRIXLIB_FP_TO_CHARS 1
+#else
+#define VMATRIXLIB_FP_TO_CHARS 0
+#endif
+
+class text_writer {
+
+public:
+
+   explicit text_writer(FILE *f)
+      : _file(f), _stream(nullptr), _buf(writer_buffer_size),
+        _ptr(_buf.data()), _end(_buf.data() + _buf.size()),
+        _flushed(0), _truncated(false) { }
+
+   explicit text_writer(std::ostream& s)
+      : _file(nullptr), _stream(&s), _buf(writer_buffer_size),
+        _ptr(_buf.data()), _end(_buf.data() + _buf.size()),
+        _flushed(0), _truncated(false) { }
+
+   /*
+    * Into buf, NUL-terminated by flush() (or the destructor): text which
+    * doesn't fit is dropped and truncated() tells it. With size 0, buf is
+    * never touched (and may be null).
+    */
+   text_writer(char *buf, size_t size)
+      : _file(nullptr), _stream(nullptr), _callerBuffer(true),
+        _begin(size ? buf : nullptr), _ptr(_begin),
+        _end(size ? buf + size - 1 : nullptr),
+        _flushed(0), _truncated(false)
+   {
+      if (_ptr)
+         *_ptr = 0;
+   }
+
+   text_writer(const text_writer&) = delete;
+   text_writer& operator=(const text_writer&) = delete;
+
+   ~text_writer() { flush(); }
+
+   void put(char c) {
+
+      if (_ptr == _end && !make_room(1))
+         return;
+
+      *_ptr++ = c;
+   }
+
+   void write(const char *s, size_t n);
+   void write(const char *s) { write(s, strlen(s)); }
+   void write(const std::string& s) { write(s.data(), s.size()); }
+
+   void fill(char c, int count) {
+      for (int i=0; i < count; i++)
+         put(c);
+   }
+
+   // Hands the buffered text to the FILE* or ostream, or terminates buf.
+   void flush();
+
+   // Characters written so far (kept, for a caller's buffer).
+   size_t written() const { return _flushed + (_ptr - begin()); }
+   bool truncated() const { return _truncated; }
+
+   // Room needed to format any arithmetic element or frac.
+   static constexpr const int max_number_chars = 128;
+
+   // Room needed to format any element formatted in place (complex_frac).
+   static constexpr const int max_element_chars = 2 * max_number_chars + 8;
+
+protected:
+
+   static constexpr const size_t writer_buffer_size = 1 << 16;
+
+   FILE *_file;
+   std::ostream *_stream;
+   std::vector<char> _buf;
+   bool _callerBuffer = false;
+   char *_begin = nullptr;
+   char *_ptr;
+   char *_end;
+   size_t _flushed;
+   bool _truncated;
+
+   char *begin() const {
+      return _callerBuffer ? _begin : const_cast<char *>(_buf.data());
+   }
+
+   bool make_room(size_t n);
+};
+
+inline void text_writer::write(const char *s, size_t n)
+{
+   while (n) {
+
+      if (_ptr == _end && !make_room(1))
+         return;
+
+      const size_t k = std::min(n, static_cast<size_t>(_end - _ptr));
+
+      memcpy(_ptr, s, k);
+      _ptr += k;
+      s += k;
+      n -= k;
+   }
+}
+
+inline void text_writer::flush()
+{
+   if (_callerBuffer) {
+
+      if (_ptr)
+         *_ptr = 0;
+
+      return;
+   }
+
+   const size_t n = _ptr - _buf.data();
+
+   if (!n)
+      return;
+
+   if (_file)
+      fwrite(_buf.data(), 1, n, _file);
+   else
+      _stream->write(_buf.data(), n);
+
+   _flushed += n;
+   _ptr = _buf.data();
+}
+
+inline bool text_writer::make_room(size_t n)
+{
+   if (!_callerBuffer) {
+      flush();
+      return true;
+   }
+
+   if (static_cast<size_t>(_end - _ptr) < n)
+      _truncated = true;
+
+   return !_truncated;
+}
+
+
+namespace writer_detail {
+
+   // Digits of an unsigned integer, backwards from end; returns the first.
+   inline char *format_unsigned(unsigned long long u, char *end)
+   {
+      static const char pairs[] =
+         "0001020304050607080910111213141516171819"
+         "2021222324252627282930313233343536373839"
+         "4041424344454647484950515253545556575859"
+         "6061626364656667686970717273747576777879"
+         "8081828384858687888990919293949596979899";
+
+      while (u >= 100) {
+         const unsigned d = static_cast<unsigned>(u % 100) * 2;
+         u /= 100;
+         *--end = pairs[d + 1];
+         *--end = pairs[d];
+      }
+
+      if (u >= 10) {
+         const unsigned d = static_cast<unsigned>(u) * 2;
+         *--end = pairs[d + 1];
+         *--end = pairs[d];
+      } else {
+         *--end = static_cast<char>('0' + u);
+      }
+
+      return end;
+   }
+
+   template <class I>
+   char *format_integer(I val, char *p)
+   {
+      char tmp[24];
+      char *end = tmp + sizeof(tmp);
+
+      const bool neg = val < 0;
+      const unsigned long long u = neg ? 0ULL - static_cast<unsigned long long>(val)
+                                       : static_cast<unsigned long long>(val);
+      const char *first = format_unsigned(u, end);
+
+      if (neg)
+         *p++ = '-';
+
+      memcpy(p, first, end - first);
+      return p + (end - first);
+   }
+
+   // Drops the trailing zeros of the decimals, and the dot if none is left.
+   inline char *trim_decimals(char *first, char *last)
+   {
+      char *dot = static_cast<char *>(memchr(first, '.', last - first));
+
+      if (!dot)
+         return last;
+
+      while (last > dot + 1 && last[-1] == '0')
+         last--;
+
+      return last == dot + 1 ? dot : last;
+   }
+
+   // nullptr if it doesn't fit (huge integers).
+   template <class F>
+   char *format_fixed(F x, int precision, char *p, char *end)
+   {
+#if VMATRIXLIB_FP_TO_CHARS
+      const std::to_chars_result r =
+         std::to_chars(p, end, x, std::chars_format::fixed, precision);
+
+      return r.ec == std::errc() ? r.ptr : nullptr;
+#else
+      const int n = snprintf(p, end - p, "%.*Lf", precision, static_cast<long double>(x));
+      return n < 0 || n >= end - p ? nullptr : p + n;
+#endif
+   }
+
+   template <class F>
+   char *format_scientific(F x, int precision, char *p, char *end)
+   {
+#if VMATRIXLIB_FP_TO_CHARS
+      char *last = std::to_chars(p, end, x, std::chars_format::scientific, precision).ptr;
+
+      for (char *q = p; q < last; q++)
+         if (*q == 'e')
+            *q = 'E';
+
+      return last;
+#else
+      const int n = snprintf(p, end - p, "%.*LE", precision, static_cast<long double>(x));
+      return n < 0 ? p : p + std::min<int>(n, static_cast<int>(end - p) - 1);
+#endif
+   }
+
+   template <class F>
+   char *format_shortest(F x, char *p, char *end)
+   {
+#if VMATRIXLIB_FP_TO_CHARS
+      return std::to_chars(p, end, x).ptr;
+#else
+      const int digits = std::numeric_limits<F>::max_digits10;
+      const int n = snprintf(p, end - p, "%.*Lg", digits, static_cast<long double>(x));
+      return n < 0 ? p : p + std::min<int>(n, static_cast<int>(end - p) - 1);
+#endif
+   }
+
+   // Same text as fpnum_to_string(), for precision >= 0.
+   template <class F>
+   char *format_float(F x, int precision, char *p, char *end)
+   {
+      if (std::isnan(x)) {
+         memcpy(p, "nan", 3);
+         return p + 3;
+      }
+
+      if (std::isinf(x)) {
+         memcpy(p, x < 0 ? "-inf" : "inf", x < 0 ? 4 : 3);
+         return p + (x < 0 ? 4 : 3);
+      }
+
+      if (precision < 0)
+         return format_shortest(x, p, end);
+
+      if (x != std::trunc(x)) {
+
+         const F absx = std::fabs(x);
+
+         if (absx <= F(1e-6) || absx >= F(1e12))
+            return format_scientific(x, 3, p, end);
+      }
+
+      char *last = format_fixed(x, precision, p, end);
+
+      if (!last)
+         return format_scientific(x, 3, p, end);
+
+      return precision ? trim_decimals(p, last) : last;
+   }
+
+   template <class T>
+   char *format_number(const T& x, int precision, char *p, char *end, std::true_type)
+   {
+      return format_float(x, precision, p, end);
+   }
+
+   template <class T>
+   char *format_number(const T& x, int, char *p, char *, std::false_type)
+   {
+      return format_integer(x, p);
+   }
+
+   // Formatted in place: arithmetic types and fracs.
+   template <class T>
+   struct formats_in_place : std::is_arithmetic<T> { };
+
+   template <class I, class F>
+   struct formats_in_place<frac<I, F>> : std::true_type { };
+
+   template <class F>
+   struct formats_in_place<complex_frac<F>> : formats_in_place<F> { };
+
+   // Formats x in buf (max_number_chars long) and returns its end.
+   template <class T>
+   char *format_element(const T& x, int precision, char *buf)
+   {
+      return format_number(x, precision, buf, buf + text_writer::max_number_chars,
+                           std::is_floating_point<T>());
+   }
+
+   template <class I, class F>
+   char *format_element(const frac<I, F>& f, int precision, char *p)
+   {
+      if (f.is_using_fp())
+         return format_element(to_float(f), precision, p);
+
+      const I num = f.int_numerator();
+      const I den = f.int_denominator();
+
+      p = format_integer(den > 0 ? num : -num, p);
+
+      if (den != 1 && den != -1) {
+         *p++ = '/';
+         p = format_integer(den > 0 ? den : -den, p);
+      }
+
+      return p;
+   }
+
+   /*
+    * Same text as to_string(complex_frac), built from the frac path (each
+    * part gets max_number_chars). A negative precision matches only exact
+    * +/-1 imaginary parts to "i": to_string() has no shortest form.
+    */
+   template <class F>
+   char *format_element(const complex_frac<F>& c, int precision, char *p)
+   {
+      const F re = c.real_part();
+      F im = c.imag_part();
+
+      const bool hasRe = to_float(re) != 0.0;
+      const auto x = to_float(im);
+
+      if (hasRe)
+         p = format_element(re, precision, p);
+
+      if (x == 0.0) {
+
+         if (!hasRe)
+            *p++ = '0';
+
+         return p;
+      }
+
+      const long double eps = precision < 0 ? 0.0L : powl(10, -precision);
+
+      if (x == 1.0 || fabsl(x - 1.0) < eps) {
+
+         if (hasRe)
+            *p++ = '+';
+
+         *p++ = 'i';
+         return p;
+      }
+
+      if (x == -1.0 || fabsl(x + 1.0) < eps) {
+         *p++ = '-';
+         *p++ = 'i';
+         return p;
+      }
+
+      if (hasRe) {
+
+         if (x < 0.0) {
+            *p++ = '-';
+            im = -im;
+         } else {
+            *p++ = '+';
+         }
+      }
+
+      const bool parens = denominator(im) != 1.0;
+
+      if (parens)
+         *p++ = '(';
+
+      p = format_element(im, precision, p);
+
+      if (parens)
+         *p++ = ')';
+
+      *p++ = 'i';
+      return p;
+   }
+
+   template <class T>
+   void write_element(text_writer& w, const T& x, int precision, int width,
+                      std::true_type)
+   {
+      char buf[text_writer::max_element_chars];
+      const int n = static_cast<int>(format_element(x, precision, buf) - buf);
+
+      w.fill(' ', width - n);
+      w.write(buf, n);
+   }
+
+   template <class T>
+   void write_element(text_writer& w, const T& x, int precision, int width,
+                      std::false_type)
+   {
+      // to_string() has no shortest form: its default precision instead.
+      const std::string s = to_string(x, precision < 0 ? 6 : precision);
+
+      w.fill(' ', width - static_cast<int>(s.size()));
+      w.write(s);
+   }
+
+   template <class T>
+   int element_length(const T& x, int precision, std::true_type)
+   {
+      char buf[text_writer::max_element_chars];
+      return static_cast<int>(format_element(x, precision, buf) - buf);
+   }
+
+   template <class T>
+   int element_length(const T& x, int precision, std::false_type)
+   {
+      return static_cast<int>(to_string(x, precision < 0 ? 6 : precision).size());
+   }
+
+} // namespace writer_detail
+
+// Right-aligned in width characters, if shorter.
+template <class T>
+void write_element(text_writer& w, const T& x, int precision, int width = 0)
+{
+   writer_detail::write_element(w, x, precision, width,
+                                writer_detail::formats_in_place<T>());
+}
+
+namespace writer_detail {
+
+   // Elements of a row separated by sep.
+   template <class T>
+   void write_row(text_writer& w, const const_matrix_view<T>& m, int i,
+                  char sep, int precision, bool decimalForm)
+   {
+      for (int j=0; j < m.cols(); j++) {
+
+         if (j)
+            w.put(sep);
+
+         if (decimalForm)
+            write_element(w, to_frac_in_decimal_form(m(i,j)), precision);
+         else
+            write_element(w, m(i,j), precision);
+      }
+   }
+
+} // namespace writer_detail
+
+/*
+ * The layout of pretty_print(): a header, then the elements right-aligned
+ * in columns of the same width. The width is measured first, so nothing
+ * is kept in memory: each element is formatted twice.
+ */
+template <class T>
+void write_pretty(text_writer& w, const const_matrix_view<T>& m, int precision = 6)
+{
+   char header[64];
+   snprintf(header, sizeof(header), "matrix (%i x %i)\n", m.rows(), m.cols());
+   w.write(header);
+
+   if (!m.rows() || !m.cols())
+      return;
+
+   int maxlen = 0;
+
+   for (int i=0; i < m.rows(); i++)
+      for (int j=0; j < m.cols(); j++)
+         maxlen = std::max(maxlen, writer_detail::element_length(
+                              m(i,j), precision, writer_detail::formats_in_place<T>()));
+
+   w.put('\n');
+
+   for (int i=0; i < m.rows(); i++) {
+
+      w.write("| ", 2);
+
+      for (int j=0; j < m.cols(); j++) {
+         write_element(w, m(i,j), precision, maxlen);
+         w.write(" | ", 3);
+      }
+
+      w.put('\n');
+   }
+
+   w.put('\n');
+}
+
+// [a b; c d], with the elements in decimal form (as print_matlab_style()).
+template <class T>
+void write_matlab(text_writer& w, const const_matrix_view<T>& m, int precision = 6)
+{
+   w.put('[');
+
+   for (int i=0; i < m.rows(); i++) {
+
+      writer_detail::write_row(w, m, i, ' ', precision, true);
+
+      if (i < m.rows() - 1)
+         w.write(";\n", 2);
+   }
+
+   w.write("]\n", 2);
+}
+
+// {{a,b},{c,d}} (as print_mathematica_style()).
+template <class T>
+void write_mathematica(text_writer& w, const const_matrix_view<T>& m, int precision = 6)
+{
+   w.put('{');
+
+   for (int i=0; i < m.rows(); i++) {
+
+      w.put('{');
+      writer_detail::write_row(w, m, i, ',', precision, false);
+      w.put('}');
+
+      if (i < m.rows() - 1)
+         w.write(",\n", 2);
+   }
+
+   w.write("}\n", 2);
+}
+
+// One line per row. By default, doubles are written to read back exactly.
+template <class T>
+void write_csv(text_writer& w, const const_matrix_view<T>& m,
+               int precision = -1, char sep = ',')
+{
+   for (int i=0; i < m.rows(); i++) {
+      writer_detail::write_row(w, m, i, sep, precision, false);
+      w.put('\n');
+   }
+}
+
+template <class T>
+void write_pretty(text_writer& w, const matrix<T>& m, int precision = 6) {
+   write_pretty(w, m.view(), precision);
+}
+
+template <class T>
+void write_matlab(text_writer& w, const matrix<T>& m, int precision = 6) {
+   write_matlab(w, m.view(), precision);
+}
+
+template <class T>
+void write_mathematica(text_writer& w, const matrix<T>& m, int precision = 6) {
+   write_mathematica(w, m.view(), precision);
+}
+
+template <class T>
+void write_csv(text_writer& w, const matrix<T>& m, int precision = -1, char sep = ',') {
+   write_csv(w, m.view(), precision, sep);
+}
+
+} // namespace vmatrixlib
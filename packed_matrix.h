@@ -0,0 +1,409 @@
+
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+
+#include "matrix.h"
+
+namespace vmatrixlib {
+
+/*
+ * Packed storage for triangular and symmetric matrices: only the n(n+1)/2
+ * elements of one triangle are stored, row by row, so that each row is
+ * still contiguous:
+ *
+ *    - lower: row i holds the columns 0..i
+ *    - upper: row i holds the columns i..n-1
+ *
+ * symmetric_matrix stores its lower triangle. As in compact_matrix.h,
+ * elements are read by value with get() or operator() (the other triangle
+ * reads as zero, or mirrored for symmetric matrices) and written with
+ * set().
+ */
+
+enum class triangle { lower, upper };
+
+template <class T>
+class triangular_matrix {
+
+public:
+
+   typedef T number_type;
+
+   triangular_matrix() : _size(0), _triangle(triangle::lower) { }
+   triangular_matrix(int n, triangle t);
+
+   // Takes the given triangle of m, ignoring the rest.
+   triangular_matrix(const matrix<T>& m, triangle t);
+
+   int size() const { return _size; }
+   triangle which() const { return _triangle; }
+   bool is_lower() const { return _triangle == triangle::lower; }
+
+   T get(int r, int c) const;
+   void set(int r, int c, const T& val);
+
+   T operator()(int r, int c) const { return get(r, c); }
+
+   matrix<T> to_dense() const;
+   size_t memory_bytes() const;
+
+   T determinant() const;
+
+   // The product of two lower (or two upper) matrices stays triangular.
+   triangular_matrix operator*(const triangular_matrix& m) const;
+   matrix<T> operator*(const matrix<T>& m) const;
+
+   // Forward (lower) or back (upper) substitution, for all columns of b.
+   matrix<T> solve(const matrix<T>& b) const;
+
+protected:
+
+   int _size;
+   triangle _triangle;
+   std::vector<T> _data;
+
+   // Stored part of row r: columns [row_begin(r), row_end(r)).
+   int row_begin(int r) const { return is_lower() ? 0 : r; }
+   int row_end(int r) const { return is_lower() ? r + 1 : _size; }
+
+   // Pointer to the element (r, 0), which may be out of the stored part.
+   const T *row_ptr(int r) const { return _data.data() + row_offset(r) - row_begin(r); }
+   T *row_ptr(int r) { return _data.data() + row_offset(r) - row_begin(r); }
+
+   size_t row_offset(int r) const;
+};
+
+template <class T>
+class symmetric_matrix {
+
+public:
+
+   typedef T number_type;
+
+   symmetric_matrix() : _size(0) { }
+   explicit symmetric_matrix(int n);
+
+   // Takes the lower triangle of m.
+   explicit symmetric_matrix(const matrix<T>& m);
+
+   int size() const { return _size; }
+
+   T get(int r, int c) const { return _data[index(r, c)]; }
+   void set(int r, int c, const T& val) { _data[index(r, c)] = val; }
+
+   T operator()(int r, int c) const { return get(r, c); }
+
+   matrix<T> to_dense() const;
+   size_t memory_bytes() const;
+
+   matrix<T> operator*(const matrix<T>& m) const;
+
+protected:
+
+   int _size;
+   std::vector<T> _data;
+
+   size_t index(int r, int c) const {
+
+      assert(r >= 0 && r < _size && c >= 0 && c < _size);
+
+      if (r < c)
+         std::swap(r, c);
+
+      return static_cast<size_t>(r) * (r + 1) / 2 + c;
+   }
+};
+
+
+template <class T>
+triangular_matrix<T>::triangular_matrix(int n, triangle t)
+   : _size(n), _triangle(t)
+{
+   if (n < 0)
+      throw std::domain_error("Invalid matrix size");
+
+   _data.resize(static_cast<size_t>(n) * (n + 1) / 2);
+}
+
+template <class T>
+triangular_matrix<T>::triangular_matrix(const matrix<T>& m, triangle t)
+   : triangular_matrix(m.rows(), t)
+{
+   if (!m.is_square())
+      throw std::domain_error("A triangular matrix must be square");
+
+   for (int r=0; r < _size; r++) {
+
+      const T *src = &m(r,0);
+      std::copy(src + row_begin(r), src + row_end(r), row_ptr(r) + row_begin(r));
+   }
+}
+
+template <class T>
+size_t triangular_matrix<T>::row_offset(int r) const
+{
+   const size_t i = r;
+
+   if (is_lower())
+      return i * (i + 1) / 2;
+
+   return i * _size - i * (i - 1) / 2;
+}
+
+template <class T>
+T triangular_matrix<T>::get(int r, int c) const
+{
+   assert(r >= 0 && r < _size && c >= 0 && c < _size);
+
+   if (c < row_begin(r) || c >= row_end(r))
+      return T(0);
+
+   return row_ptr(r)[c];
+}
+
+template <class T>
+void triangular_matrix<T>::set(int r, int c, const T& val)
+{
+   assert(r >= 0 && r < _size && c >= 0 && c < _size);
+
+   if (c < row_begin(r) || c >= row_end(r)) {
+
+      if (val != 0)
+         throw std::domain_error("Non-zero element outside of the triangle");
+
+      return;
+   }
+
+   row_ptr(r)[c] = val;
+}
+
+template <class T>
+matrix<T> triangular_matrix<T>::to_dense() const
+{
+   matrix<T> res(_size, _size);
+
+   for (int r=0; r < _size; r++) {
+
+      const T *src = row_ptr(r);
+      std::copy(src + row_begin(r), src + row_end(r), &res(r, row_begin(r)));
+   }
+
+   return res;
+}
+
+template <class T>
+size_t triangular_matrix<T>::memory_bytes() const {
+   return sizeof(*this) + _data.capacity() * sizeof(T);
+}
+
+template <class T>
+T triangular_matrix<T>::determinant() const
+{
+   T det = T(1);
+
+   for (int i=0; i < _size && det != 0; i++)
+      det *= row_ptr(i)[i];
+
+   return det;
+}
+
+/*
+ * Row r of the result is the combination of the rows of m with the
+ * coefficients in row r: for a lower L1 * L2, only the rows k <= r of L2,
+ * each of which ends at column k.
+ */
+template <class T>
+triangular_matrix<T> triangular_matrix<T>::operator*(const triangular_matrix& m) const
+{
+   if (m._size != _size || m._triangle != _triangle)
+      throw std::domain_error("The matrices must have the same size and triangle");
+
+   triangular_matrix res(_size, _triangle);
+   const int grain = std::max(1, parallel_grain<T>::value / std::max(1, _size));
+
+   parallel_for(0, _size, grain, [this, &m, &res](int rb, int re) {
+
+      for (int r=rb; r < re; r++) {
+
+         const T *a = row_ptr(r);
+         T *dest = res.row_ptr(r);
+
+         for (int k=row_begin(r); k < row_end(r); k++) {
+
+            if (a[k] == 0)
+               continue;
+
+            const T *src = m.row_ptr(k);
+
+            // The columns where both row r and row k of m are stored.
+            const int cb = std::max(row_begin(r), m.row_begin(k));
+            const int ce = std::min(row_end(r), m.row_end(k));
+
+            for (int c=cb; c < ce; c++)
+               dest[c] += a[k] * src[c];
+         }
+      }
+   });
+
+   return res;
+}
+
+template <class T>
+matrix<T> triangular_matrix<T>::operator*(const matrix<T>& m) const
+{
+   if (m.rows() != _size)
+      throw std::domain_error("Right matrix must have rows count equals to first matrix's columns count");
+
+   const int n = m.cols();
+   matrix<T> res(_size, n);
+   const int grain = std::max(1, parallel_grain<T>::value / std::max(1, _size * n / 2));
+
+   parallel_for(0, _size, grain, [this, &m, &res, n](int rb, int re) {
+
+      for (int r=rb; r < re; r++) {
+
+         const T *a = row_ptr(r);
+         T *dest = &res(r,0);
+
+         for (int k=row_begin(r); k < row_end(r); k++) {
+
+            if (a[k] == 0)
+               continue;
+
+            const T *src = &m(k,0);
+
+            for (int c=0; c < n; c++)
+               dest[c] += a[k] * src[c];
+         }
+      }
+   });
+
+   return res;
+}
+
+template <class T>
+matrix<T> triangular_matrix<T>::solve(const matrix<T>& b) const
+{
+   if (b.rows() != _size)
+      throw std::domain_error("The right-hand side must have as many rows as the system matrix");
+
+   // Not determinant() == 0: in floating point, the product underflows.
+   for (int i=0; i < _size; i++)
+      if (row_ptr(i)[i] == 0)
+         throw std::runtime_error("Can't solve a singular system");
+
+   const int k = b.cols();
+   matrix<T> x = b;
+
+   for (int s=0; s < _size; s++) {
+
+      // Lower: top to bottom. Upper: bottom to top.
+      const int i = is_lower() ? s : _size - 1 - s;
+      const T *a = row_ptr(i);
+      T *xi = &x(i,0);
+
+      for (int j=row_begin(i); j < row_end(i); j++) {
+
+         if (j == i || a[j] == 0)
+            continue;
+
+         const T *xj = &x(j,0);
+
+         for (int c=0; c < k; c++)
+            xi[c] -= a[j] * xj[c];
+      }
+
+      x.in_place_div_row(i, a[i]);
+   }
+
+   return x;
+}
+
+
+template <class T>
+symmetric_matrix<T>::symmetric_matrix(int n)
+   : _size(n)
+{
+   if (n < 0)
+      throw std::domain_error("Invalid matrix size");
+
+   _data.resize(static_cast<size_t>(n) * (n + 1) / 2);
+}
+
+template <class T>
+symmetric_matrix<T>::symmetric_matrix(const matrix<T>& m)
+   : symmetric_matrix(m.rows())
+{
+   if (!m.is_square())
+      throw std::domain_error("A symmetric matrix must be square");
+
+   for (int r=0; r < _size; r++)
+      std::copy(&m(r,0), &m(r,0) + r + 1, &_data[index(r, 0)]);
+}
+
+template <class T>
+matrix<T> symmetric_matrix<T>::to_dense() const
+{
+   matrix<T> res(_size, _size);
+
+   for (int r=0; r < _size; r++) {
+
+      const T *src = &_data[index(r, 0)];
+
+      for (int c=0; c <= r; c++) {
+         res(r,c) = src[c];
+         res(c,r) = src[c];
+      }
+   }
+
+   return res;
+}
+
+template <class T>
+size_t symmetric_matrix<T>::memory_bytes() const {
+   return sizeof(*this) + _data.capacity() * sizeof(T);
+}
+
+/*
+ * Row r of S is its packed row r (columns 0..r) followed by the column r
+ * below the diagonal, which is read with a stride growing by one per row.
+ */
+template <class T>
+matrix<T> symmetric_matrix<T>::operator*(const matrix<T>& m) const
+{
+   if (m.rows() != _size)
+      throw std::domain_error("Right matrix must have rows count equals to first matrix's columns count");
+
+   const int n = m.cols();
+   matrix<T> res(_size, n);
+   const int grain = std::max(1, parallel_grain<T>::value / std::max(1, _size * n));
+
+   parallel_for(0, _size, grain, [this, &m, &res, n](int rb, int re) {
+
+      for (int r=rb; r < re; r++) {
+
+         T *dest = &res(r,0);
+         const T *packed = &_data[index(r, 0)];
+
+         for (int k=0; k < _size; k++) {
+
+            const T& a = k <= r ? packed[k] : _data[index(k, r)];
+
+            if (a == 0)
+               continue;
+
+            const T *src = &m(k,0);
+
+            for (int c=0; c < n; c++)
+               dest[c] += a * src[c];
+         }
+      }
+   });
+
+   return res;
+}
+
+} // namespace vmatrixlib
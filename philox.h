@@ -0,0 +1,140 @@
+
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <limits>
+
+namespace vmatrixlib {
+
+/*
+ * Philox4x32-10 (Salmon et al., "Parallel random numbers: as easy as 1, 2,
+ * 3", SC11): a counter-based generator. The n-th block of four numbers is
+ * a bijection of (n, key), so any element of the sequence is computed
+ * without computing the ones before it.
+ *
+ * philox_engine gives independent sequences for different (seed, stream)
+ * pairs: the random matrix generators use one stream per row, so rows are
+ * filled in parallel and the result doesn't depend on the number of
+ * threads. It is a UniformRandomBitGenerator, but the distributions below
+ * should be preferred to the std ones, whose output is implementation
+ * defined: with them, a seed gives the same matrix on every platform.
+ */
+
+struct philox_block {
+   uint32_t v[4];
+};
+
+inline philox_block philox4x32_10(philox_block ctr, uint32_t k0, uint32_t k1)
+{
+   const uint32_t m0 = 0xD2511F53, m1 = 0xCD9E8D57;
+   const uint32_t w0 = 0x9E3779B9, w1 = 0xBB67AE85;
+
+   for (int round=0; round < 10; round++) {
+
+      const uint64_t p0 = static_cast<uint64_t>(m0) * ctr.v[0];
+      const uint64_t p1 = static_cast<uint64_t>(m1) * ctr.v[2];
+
+      ctr = philox_block{ {
+         static_cast<uint32_t>(p1 >> 32) ^ ctr.v[1] ^ k0,
+         static_cast<uint32_t>(p1),
+         static_cast<uint32_t>(p0 >> 32) ^ ctr.v[3] ^ k1,
+         static_cast<uint32_t>(p0)
+      } };
+
+      k0 += w0;
+      k1 += w1;
+   }
+
+   return ctr;
+}
+
+class philox_engine {
+
+public:
+
+   typedef uint32_t result_type;
+
+   explicit philox_engine(uint64_t seed = 0, uint64_t stream = 0)
+      : _k0(static_cast<uint32_t>(seed)), _k1(static_cast<uint32_t>(seed >> 32)),
+        _counter(0), _stream(stream), _next(4) { }
+
+   static constexpr result_type min() { return 0; }
+   static constexpr result_type max() { return std::numeric_limits<uint32_t>::max(); }
+
+   result_type operator()() {
+
+      if (_next == 4) {
+
+         const philox_block ctr = { {
+            static_cast<uint32_t>(_counter), static_cast<uint32_t>(_counter >> 32),
+            static_cast<uint32_t>(_stream), static_cast<uint32_t>(_stream >> 32)
+         } };
+
+         _block = philox4x32_10(ctr, _k0, _k1);
+         _counter++;
+         _next = 0;
+      }
+
+      return _block.v[_next++];
+   }
+
+   // Skips n numbers.
+   void discard(uint64_t n) {
+
+      while (n && _next < 4) {
+         _next++;
+         n--;
+      }
+
+      _counter += n / 4;
+
+      if (n % 4) {
+         (*this)();
+         _next = static_cast<int>(n % 4);
+      }
+   }
+
+protected:
+
+   uint32_t _k0, _k1;
+   uint64_t _counter;
+   uint64_t _stream;
+   philox_block _block;
+   int _next;
+};
+
+// In [0, 1), with 53 random bits.
+template <class Engine>
+inline double random_uniform01(Engine& e)
+{
+   const uint64_t hi = static_cast<uint32_t>(e()) >> 5;
+   const uint64_t lo = static_cast<uint32_t>(e()) >> 6;
+
+   return static_cast<double>((hi << 26) | lo) * (1.0 / 9007199254740992.0);
+}
+
+// An integer in [lo, hi].
+template <class Engine>
+inline long long random_int(Engine& e, long long lo, long long hi)
+{
+   const uint64_t span = static_cast<uint64_t>(hi - lo) + 1;
+   const uint64_t r = (static_cast<uint64_t>(static_cast<uint32_t>(e())) << 32) |
+                      static_cast<uint32_t>(e());
+
+   // With a 64 bit draw, the bias of the modulo is negligible.
+   return span ? lo + static_cast<long long>(r % span) : lo + static_cast<long long>(r);
+}
+
+// Normal, with the Box-Muller transform (one of the two values is dropped).
+template <class Engine>
+inline double random_gaussian(Engine& e, double mean = 0.0, double stddev = 1.0)
+{
+   const double u1 = 1.0 - random_uniform01(e);    // (0, 1]
+   const double u2 = random_uniform01(e);
+
+   return mean + stddev * std::sqrt(-2.0 * std::log(u1)) *
+                 std::cos(6.283185307179586 * u2);
+}
+
+} // namespace vmatrixlib
@@ -0,0 +1,219 @@
+
+#pragma once
+
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+
+#include "matrix.h"
+#include "householder.h"
+
+namespace vmatrixlib {
+
+/*
+ * Householder QR factorization, A = Q*R or, with column pivoting,
+ * A*P = Q*R, for floating point types.
+ *
+ * Like lu_factorization, everything is stored in a single matrix: R on and
+ * above the diagonal, the Householder vectors below it (see householder.h).
+ * Q is never formed unless asked for with q(): apply_qt() applies it as
+ * the product of its reflectors.
+ *
+ * Without pivoting, the factorization is blocked (compact WY) and runs at
+ * matrix product speed. Column pivoting is unblocked, but it makes the
+ * factorization rank-revealing: use it for rank() and for least squares
+ * problems which may be rank-deficient.
+ */
+
+enum class qr_pivoting { none, columns };
+
+template <class T>
+class qr_factorization {
+
+public:
+
+   explicit qr_factorization(const matrix<T>& a,
+                             qr_pivoting pivoting = qr_pivoting::none);
+   explicit qr_factorization(matrix<T>&& a,
+                             qr_pivoting pivoting = qr_pivoting::none);
+
+   int rows() const { return _qr.rows(); }
+   int cols() const { return _qr.cols(); }
+   int rank() const { return _rank; }
+
+   bool is_pivoted() const { return _pivoted; }
+
+   // perm[j] is the column of A which ended up in column j.
+   const std::vector<int>& permutation() const { return _perm; }
+   const matrix<T>& packed() const { return _qr; }
+
+   /*
+    * The thin factors are Q (m x k) and R (k x n), with k = min(m, n);
+    * the full ones Q (m x m) and R (m x n).
+    */
+   matrix<T> q(bool thin = true) const;
+   matrix<T> r(bool thin = true) const;
+
+   // b := Q^T * b
+   void apply_qt(matrix<T>& b) const;
+
+   /*
+    * The x minimizing ||A*x - b||, for each column of b. A rank-deficient
+    * A requires column pivoting: then the free variables are set to zero
+    * (basic solution).
+    */
+   matrix<T> solve_least_squares(const matrix<T>& b) const;
+
+protected:
+
+   matrix<T> _qr;
+   std::vector<T> _tau;
+   std::vector<int> _perm;
+   bool _pivoted;
+   int _rank;
+
+   void factorize();
+};
+
+
+template <class T>
+qr_factorization<T>::qr_factorization(const matrix<T>& a, qr_pivoting pivoting)
+   : _qr(a), _pivoted(pivoting == qr_pivoting::columns), _rank(0)
+{
+   factorize();
+}
+
+template <class T>
+qr_factorization<T>::qr_factorization(matrix<T>&& a, qr_pivoting pivoting)
+   : _qr(std::move(a)), _pivoted(pivoting == qr_pivoting::columns), _rank(0)
+{
+   factorize();
+}
+
+template <class T>
+void qr_factorization<T>::factorize()
+{
+   const int m = rows();
+   const int n = cols();
+
+   _tau.assign(std::min(m, n), T(0));
+   _perm.resize(n);
+
+   if (m == 0 || n == 0)
+      return;
+
+   if (_pivoted) {
+
+      householder_qr_pivoted(m, n, &_qr(0,0), n, _tau.data(), _perm.data());
+
+   } else {
+
+      for (int j=0; j < n; j++)
+         _perm[j] = j;
+
+      householder_qr(m, n, &_qr(0,0), n, _tau.data());
+   }
+
+   _rank = householder_rank(m, n, &_qr(0,0), n);
+}
+
+template <class T>
+void qr_factorization<T>::apply_qt(matrix<T>& b) const
+{
+   if (b.rows() != rows())
+      throw std::domain_error("The matrix must have as many rows as the factorized one");
+
+   const int m = rows();
+   const int k = b.cols();
+   std::vector<T> work(k);
+
+   if (k == 0)
+      return;
+
+   for (int j=0; j < static_cast<int>(_tau.size()); j++)
+      householder_apply_left(m - j, k, &_qr(j,j), cols(), _tau[j],
+                             &b(j,0), k, work.data());
+}
+
+/*
+ * Q = H(0) * ... * H(k-1) * I, applying the reflectors backwards: H(j)
+ * only touches the rows and columns from j on, and the identity is still
+ * untouched outside of that block.
+ */
+template <class T>
+matrix<T> qr_factorization<T>::q(bool thin) const
+{
+   const int m = rows();
+   const int qcols = thin ? static_cast<int>(_tau.size()) : m;
+   matrix<T> res(m, qcols);
+   std::vector<T> work(qcols);
+
+   for (int i=0; i < qcols; i++)
+      res(i,i) = T(1);
+
+   for (int j=static_cast<int>(_tau.size())-1; j >= 0; j--)
+      householder_apply_left(m - j, qcols - j, &_qr(j,j), cols(), _tau[j],
+                             &res(j,j), qcols, work.data());
+
+   return res;
+}
+
+template <class T>
+matrix<T> qr_factorization<T>::r(bool thin) const
+{
+   const int n = cols();
+   const int rrows = thin ? static_cast<int>(_tau.size()) : rows();
+   matrix<T> res(rrows, n);
+
+   for (int i=0; i < std::min(rrows, n); i++)
+      for (int j=i; j < n; j++)
+         res(i,j) = _qr(i,j);
+
+   return res;
+}
+
+template <class T>
+matrix<T> qr_factorization<T>::solve_least_squares(const matrix<T>& b) const
+{
+   const int n = cols();
+   const int k = b.cols();
+   const int r = _pivoted ? _rank : static_cast<int>(_tau.size());
+
+   if (b.rows() != rows())
+      throw std::domain_error("The right-hand side must have as many rows as the system matrix");
+
+   if (!_pivoted && _rank < r)
+      throw std::runtime_error("Rank-deficient least squares problem: use column pivoting");
+
+   matrix<T> y = b;
+   matrix<T> x(n, k);
+
+   apply_qt(y);
+
+   // Back substitution with R(0:r, 0:r), whole rows at a time.
+   for (int i=r-1; i >= 0; i--) {
+
+      T *yi = &y(i,0);
+
+      for (int j=i+1; j < r; j++) {
+
+         const T& u = _qr(i,j);
+         const T *yj = &y(j,0);
+
+         for (int c=0; c < k; c++)
+            yi[c] -= u * yj[c];
+      }
+
+      const T d = _qr(i,i);
+
+      for (int c=0; c < k; c++)
+         yi[c] /= d;
+   }
+
+   for (int i=0; i < r; i++)
+      x.attach_row(y, i, _perm[i]);
+
+   return x;
+}
+
+} // namespace vmatrixlib
@@ -0,0 +1,223 @@
+
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+#include <stdexcept>
+
+#include "matrix.h"
+#include "sparse_matrix.h"
+#include "philox.h"
+
+namespace vmatrixlib {
+
+/*
+ * Random matrices with a given structure, for tests and benchmarks:
+ *
+ *    - random_gaussian_matrix: independent normal elements.
+ *    - random_spd_matrix: symmetric, strictly diagonally dominant with a
+ *      positive diagonal, hence positive definite.
+ *    - random_banded_matrix: normal elements in the band, zeros outside.
+ *    - random_low_rank_matrix: U*V with normal U (rows x rank) and V
+ *      (rank x cols), so of the given rank with probability 1.
+ *    - random_with_pattern: normal elements where the pattern is non-zero.
+ *
+ * Like matrix::random() with a seed, row i is drawn from the Philox stream
+ * i of the seed: the rows are filled in parallel, and a seed always gives
+ * the same matrix. The elements are computed as doubles, then converted
+ * to T.
+ */
+
+namespace random_detail {
+
+   // A second, independent seed derived from the first one.
+   inline uint64_t derived_seed(uint64_t seed) {
+      return seed ^ 0x9E3779B97F4A7C15ULL;
+   }
+
+   // f(engine, row index, pointer to the row), for every row.
+   template <class T, class F>
+   void fill_rows(matrix<T>& m, uint64_t seed, F f)
+   {
+      const int grain = std::max(1, parallel_grain<T>::value / std::max(1, m.cols()));
+
+      parallel_for(0, m.rows(), grain, [&m, seed, &f](int rb, int re) {
+
+         for (int i=rb; i < re; i++) {
+
+            philox_engine e(seed, i);
+            f(e, i, m.cols() ? &m(i,0) : nullptr);
+         }
+      });
+   }
+
+} // namespace random_detail
+
+template <class T>
+matrix<T> random_gaussian_matrix(int rows, int cols, uint64_t seed,
+                                 double mean = 0.0, double stddev = 1.0)
+{
+   matrix<T> res(rows, cols);
+
+   random_detail::fill_rows(res, seed, [cols, mean, stddev](philox_engine& e, int, T *row) {
+
+      for (int j=0; j < cols; j++)
+         row[j] = T(static_cast<long double>(random_gaussian(e, mean, stddev)));
+   });
+
+   return res;
+}
+
+/*
+ * The lower triangle is uniform in [-1, 1] and mirrored by tiles with the
+ * transpose kernel; then A(i,i) = 1 + sum of |A(i,j)|, j != i. The sum is
+ * done on the doubles, since T may have no order (complex_frac): A(i,j)
+ * below the diagonal is the j-th uniform of the stream of row i, and
+ * Philox jumps to it in O(1).
+ */
+template <class T>
+matrix<T> random_spd_matrix(int n, uint64_t seed)
+{
+   matrix<T> res(n, n);
+
+   random_detail::fill_rows(res, seed, [](philox_engine& e, int i, T *row) {
+
+      for (int j=0; j < i; j++)
+         row[j] = T(static_cast<long double>(2.0 * random_uniform01(e) - 1.0));
+   });
+
+   const int grain = std::max(transpose_tile,
+                              parallel_grain<T>::value / std::max(1, n));
+
+   parallel_for(0, n, grain, [&res, n](int rb, int re) {
+
+      for (int i=rb; i < re; i++)
+         for (int j=i+1; j < re; j++)
+            res(i,j) = res(j,i);
+
+      if (re < n)
+         transpose_copy(n - re, re - rb, &res(re,rb), n, &res(rb,re), n);
+   });
+
+   parallel_for(0, n, grain, [&res, n, seed](int rb, int re) {
+
+      for (int i=rb; i < re; i++) {
+
+         philox_engine row(seed, i);
+         double d = 1.0;
+
+         for (int j=0; j < i; j++)
+            d += std::fabs(2.0 * random_uniform01(row) - 1.0);
+
+         for (int j=i+1; j < n; j++) {
+
+            philox_engine col(seed, j);
+            col.discard(2 * static_cast<uint64_t>(i));
+            d += std::fabs(2.0 * random_uniform01(col) - 1.0);
+         }
+
+         res(i,i) = T(static_cast<long double>(d));
+      }
+   });
+
+   return res;
+}
+
+// A(i,j) is in the band if i - lower <= j <= i + upper.
+template <class T>
+matrix<T> random_banded_matrix(int rows, int cols, int lower, int upper,
+                               uint64_t seed)
+{
+   if (lower < 0 || upper < 0)
+      throw std::domain_error("The band widths must be non-negative");
+
+   matrix<T> res(rows, cols);
+
+   random_detail::fill_rows(res, seed, [cols, lower, upper](philox_engine& e, int i, T *row) {
+
+      const int jb = std::max(0, i - lower);
+      const int je = std::min(cols - 1, i + upper);
+
+      for (int j=jb; j <= je; j++)
+         row[j] = T(static_cast<long double>(random_gaussian(e)));
+   });
+
+   return res;
+}
+
+template <class T>
+matrix<T> random_low_rank_matrix(int rows, int cols, int rank, uint64_t seed)
+{
+   if (rank < 0 || rank > std::min(rows, cols))
+      throw std::domain_error("The rank can't exceed the smallest dimension");
+
+   const matrix<T> u = random_gaussian_matrix<T>(rows, rank, seed);
+   const matrix<T> v = random_gaussian_matrix<T>(rank, cols,
+                                                 random_detail::derived_seed(seed));
+
+   if (rank == 0)
+      return matrix<T>(rows, cols);
+
+   return u * v;
+}
+
+// Same shape as the pattern, non-zero exactly where it is non-zero.
+template <class T, class U>
+matrix<T> random_with_pattern(const matrix<U>& pattern, uint64_t seed)
+{
+   const int cols = pattern.cols();
+   matrix<T> res(pattern.rows(), cols);
+
+   random_detail::fill_rows(res, seed, [&pattern, cols](philox_engine& e, int i, T *row) {
+
+      for (int j=0; j < cols; j++) {
+
+         if (pattern(i,j) == 0)
+            continue;
+
+         double x;
+
+         do {
+            x = random_gaussian(e);
+         } while (x == 0);
+
+         row[j] = T(static_cast<long double>(x));
+      }
+   });
+
+   return res;
+}
+
+// The structure of the pattern with new values, by rows (CSR) or columns.
+template <class T>
+sparse_matrix<T> random_with_pattern(const sparse_matrix<T>& pattern, uint64_t seed)
+{
+   sparse_matrix<T> res = pattern;
+   std::vector<T>& values = res.values();
+   const std::vector<int>& starts = res.starts();
+   const int outer = static_cast<int>(starts.size()) - 1;
+
+   parallel_for(0, outer, 64, [&values, &starts, seed](int ob, int oe) {
+
+      for (int k=ob; k < oe; k++) {
+
+         philox_engine e(seed, k);
+
+         for (int p=starts[k]; p < starts[k + 1]; p++) {
+
+            double x;
+
+            do {
+               x = random_gaussian(e);
+            } while (x == 0);
+
+            values[p] = T(static_cast<long double>(x));
+         }
+      }
+   });
+
+   return res;
+}
+
+} // namespace vmatrixlib
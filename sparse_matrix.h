@@ -0,0 +1,945 @@
+
+#pragma once
+
+#include <set>
+#include <cmath>
+#include <vector>
+#include <limits>
+#include <utility>
+#include <algorithm>
+#include <stdexcept>
+#include <type_traits>
+
+#include "matrix.h"
+
+namespace vmatrixlib {
+
+/*
+ * Compressed sparse matrices.
+ *
+ * Only the non-zero elements are stored, in one of the two classic
+ * compressed layouts:
+ *
+ *    - CSR (compressed sparse rows): for each row, the column indices and
+ *      the values of its non-zero elements, in increasing column order.
+ *    - CSC (compressed sparse columns): the same, column by column.
+ *
+ * Both use three arrays: starts[k] is the position in indices/values of
+ * the first element of row (or column) k, and starts[outer] == nnz().
+ * Thus memory is O(rows + nnz) for CSR and O(cols + nnz) for CSC.
+ *
+ * The matrices are immutable: build them from a dense matrix or from a
+ * list of (row, col, value) triplets.
+ */
+
+template <class T>
+struct sparse_triplet {
+   int row;
+   int col;
+   T value;
+};
+
+enum class sparse_layout { csr, csc };
+
+template <class T>
+class sparse_lu;
+
+template <class T>
+class sparse_matrix {
+
+public:
+
+   typedef T number_type;
+
+   sparse_matrix() : _rows(0), _cols(0), _layout(sparse_layout::csr), _starts(1) { }
+   sparse_matrix(int rows, int cols, sparse_layout layout = sparse_layout::csr);
+
+   explicit sparse_matrix(const matrix<T>& m,
+                          sparse_layout layout = sparse_layout::csr);
+
+   // Duplicate triplets are summed.
+   static sparse_matrix from_triplets(int rows, int cols,
+                                      std::vector<sparse_triplet<T>> triplets,
+                                      sparse_layout layout = sparse_layout::csr);
+
+   int rows() const { return _rows; }
+   int cols() const { return _cols; }
+   int nnz() const { return static_cast<int>(_values.size()); }
+   sparse_layout layout() const { return _layout; }
+
+   const std::vector<int>& starts() const { return _starts; }
+   const std::vector<int>& indices() const { return _indices; }
+   const std::vector<T>& values() const { return _values; }
+
+   // The values can be changed in place, not the structure.
+   std::vector<T>& values() { return _values; }
+
+   T get(int r, int c) const;
+
+   matrix<T> to_dense() const;
+   sparse_matrix to_csr() const { return with_layout(sparse_layout::csr); }
+   sparse_matrix to_csc() const { return with_layout(sparse_layout::csc); }
+   sparse_matrix with_layout(sparse_layout layout) const;
+
+   // The CSR arrays of A are the CSC arrays of A^T: no element is moved.
+   sparse_matrix transpose() const;
+
+   // y = A * x, with x of cols() elements and y of rows() elements.
+   void spmv(const T *x, T *y) const;
+
+   matrix<T> operator*(const matrix<T>& m) const;
+   sparse_matrix operator*(const sparse_matrix& m) const;
+
+   int rank() const;
+   sparse_matrix null_space() const;
+
+protected:
+
+   int _rows;
+   int _cols;
+   sparse_layout _layout;
+
+   std::vector<int> _starts;
+   std::vector<int> _indices;
+   std::vector<T> _values;
+
+   int outer_size() const {
+      return _layout == sparse_layout::csr ? _rows : _cols;
+   }
+};
+
+
+template <class T>
+sparse_matrix<T>::sparse_matrix(int rows, int cols, sparse_layout layout)
+   : _rows(rows), _cols(cols), _layout(layout)
+{
+   if (rows < 0 || cols < 0)
+      throw std::domain_error("Invalid matrix size");
+
+   _starts.assign(outer_size() + 1, 0);
+}
+
+template <class T>
+sparse_matrix<T>::sparse_matrix(const matrix<T>& m, sparse_layout layout)
+   : sparse_matrix(m.rows(), m.cols(), layout)
+{
+   const bool csr = layout == sparse_layout::csr;
+   const int outer = outer_size();
+   const int inner = csr ? _cols : _rows;
+
+   for (int k=0; k < outer; k++) {
+
+      for (int i=0; i < inner; i++) {
+
+         const T& v = csr ? m(k,i) : m(i,k);
+
+         if (v != 0) {
+            _indices.push_back(i);
+            _values.push_back(v);
+         }
+      }
+
+      _starts[k+1] = nnz();
+   }
+}
+
+template <class T>
+sparse_matrix<T>
+sparse_matrix<T>::from_triplets(int rows, int cols,
+                                std::vector<sparse_triplet<T>> triplets,
+                                sparse_layout layout)
+{
+   sparse_matrix res(rows, cols, layout);
+   const bool csr = layout == sparse_layout::csr;
+
+   for (const sparse_triplet<T>& t : triplets) {
+      if (t.row < 0 || t.row >= rows || t.col < 0 || t.col >= cols)
+         throw std::domain_error("Triplet out of the matrix bounds");
+   }
+
+   std::sort(triplets.begin(), triplets.end(),
+             [csr](const sparse_triplet<T>& a, const sparse_triplet<T>& b) {
+                return csr ? std::make_pair(a.row, a.col) < std::make_pair(b.row, b.col)
+                           : std::make_pair(a.col, a.row) < std::make_pair(b.col, b.row);
+             });
+
+   size_t i = 0;
+
+   while (i < triplets.size()) {
+
+      const int r = triplets[i].row, c = triplets[i].col;
+      T v = triplets[i].value;
+
+      for (i++; i < triplets.size() && triplets[i].row == r && triplets[i].col == c; i++)
+         v += triplets[i].value;
+
+      if (v == 0)
+         continue;
+
+      res._indices.push_back(csr ? c : r);
+      res._values.push_back(v);
+      res._starts[(csr ? r : c) + 1]++;
+   }
+
+   for (int k=0; k < res.outer_size(); k++)
+      res._starts[k+1] += res._starts[k];
+
+   return res;
+}
+
+template <class T>
+T sparse_matrix<T>::get(int r, int c) const
+{
+   assert(r >= 0 && r < _rows && c >= 0 && c < _cols);
+
+   const bool csr = _layout == sparse_layout::csr;
+   const int outer = csr ? r : c;
+   const int inner = csr ? c : r;
+
+   const auto b = _indices.begin() + _starts[outer];
+   const auto e = _indices.begin() + _starts[outer+1];
+   const auto it = std::lower_bound(b, e, inner);
+
+   if (it == e || *it != inner)
+      return T(0);
+
+   return _values[it - _indices.begin()];
+}
+
+template <class T>
+matrix<T> sparse_matrix<T>::to_dense() const
+{
+   matrix<T> res(_rows, _cols);
+   const bool csr = _layout == sparse_layout::csr;
+
+   for (int k=0; k < outer_size(); k++) {
+      for (int p=_starts[k]; p < _starts[k+1]; p++) {
+
+         if (csr)
+            res(k, _indices[p]) = _values[p];
+         else
+            res(_indices[p], k) = _values[p];
+      }
+   }
+
+   return res;
+}
+
+/*
+ * CSR <-> CSC conversion: a counting sort of the elements by their inner
+ * index, O(rows + cols + nnz).
+ */
+template <class T>
+sparse_matrix<T> sparse_matrix<T>::with_layout(sparse_layout layout) const
+{
+   if (layout == _layout)
+      return *this;
+
+   sparse_matrix res(_rows, _cols, layout);
+   const int outer = outer_size();
+
+   res._indices.resize(nnz());
+   res._values.resize(nnz());
+
+   for (int p=0; p < nnz(); p++)
+      res._starts[_indices[p] + 1]++;
+
+   for (int k=0; k < res.outer_size(); k++)
+      res._starts[k+1] += res._starts[k];
+
+   std::vector<int> next(res._starts.begin(), res._starts.end() - 1);
+
+   // Walking our outer index in order keeps the new inner indices sorted.
+   for (int k=0; k < outer; k++) {
+      for (int p=_starts[k]; p < _starts[k+1]; p++) {
+
+         const int q = next[_indices[p]]++;
+         res._indices[q] = k;
+         res._values[q] = _values[p];
+      }
+   }
+
+   return res;
+}
+
+template <class T>
+sparse_matrix<T> sparse_matrix<T>::transpose() const
+{
+   sparse_matrix res = *this;
+
+   std::swap(res._rows, res._cols);
+   res._layout = _layout == sparse_layout::csr ? sparse_layout::csc
+                                               : sparse_layout::csr;
+   return res;
+}
+
+template <class T>
+void sparse_matrix<T>::spmv(const T *x, T *y) const
+{
+   if (_layout == sparse_layout::csr) {
+
+      const int grain =
+         std::max(1, parallel_grain<T>::value / std::max(1, nnz() / std::max(1, _rows)));
+
+      parallel_for(0, _rows, grain, [this, x, y](int b, int e) {
+
+         for (int i=b; i < e; i++) {
+
+            T sum = T(0);
+
+            for (int p=_starts[i]; p < _starts[i+1]; p++)
+               sum += _values[p] * x[_indices[p]];
+
+            y[i] = sum;
+         }
+      });
+
+      return;
+   }
+
+   // CSC: scatter each column into y.
+   for (int i=0; i < _rows; i++)
+      y[i] = T(0);
+
+   for (int j=0; j < _cols; j++) {
+
+      if (x[j] == 0)
+         continue;
+
+      for (int p=_starts[j]; p < _starts[j+1]; p++)
+         y[_indices[p]] += _values[p] * x[j];
+   }
+}
+
+/*
+ * Sparse * dense: each non-zero a(i,k) adds a(i,k) * m.row(k) to the row i
+ * of the result, so both m and the result are walked along their rows.
+ */
+template <class T>
+matrix<T> sparse_matrix<T>::operator*(const matrix<T>& m) const
+{
+   if (m.rows() != _cols)
+      throw std::domain_error("Right matrix must have rows count equals to first matrix's columns count");
+
+   const sparse_matrix a = to_csr();
+   const int n = m.cols();
+   matrix<T> res(_rows, n);
+
+   const int grain = std::max(1, parallel_grain<T>::value /
+                                 std::max(1, n * std::max(1, nnz() / std::max(1, _rows))));
+
+   parallel_for(0, _rows, grain, [&a, &m, &res, n](int b, int e) {
+
+      for (int i=b; i < e; i++) {
+
+         T *dest = &res(i,0);
+
+         for (int p=a._starts[i]; p < a._starts[i+1]; p++) {
+
+            const T& v = a._values[p];
+            const T *src = &m(a._indices[p], 0);
+
+            for (int j=0; j < n; j++)
+               dest[j] += v * src[j];
+         }
+      }
+   });
+
+   return res;
+}
+
+/*
+ * Dense * sparse: as above, row i of the result is the combination of the
+ * rows of the sparse matrix with the coefficients in row i of m.
+ */
+template <class T>
+matrix<T> operator*(const matrix<T>& m, const sparse_matrix<T>& s)
+{
+   if (s.rows() != m.cols())
+      throw std::domain_error("Right matrix must have rows count equals to first matrix's columns count");
+
+   const sparse_matrix<T> b = s.to_csr();
+   const std::vector<int>& starts = b.starts();
+   const std::vector<int>& indices = b.indices();
+   const std::vector<T>& values = b.values();
+   matrix<T> res(m.rows(), s.cols());
+
+   const int grain = std::max(1, parallel_grain<T>::value / std::max(1, b.nnz()));
+
+   parallel_for(0, m.rows(), grain, [&](int rb, int re) {
+
+      for (int i=rb; i < re; i++) {
+
+         T *dest = &res(i,0);
+
+         for (int k=0; k < m.cols(); k++) {
+
+            const T& f = m(i,k);
+
+            if (f == 0)
+               continue;
+
+            for (int p=starts[k]; p < starts[k+1]; p++)
+               dest[indices[p]] += f * values[p];
+         }
+      }
+   });
+
+   return res;
+}
+
+/*
+ * Sparse * sparse, row by row (Gustavson's algorithm): row i of the result
+ * is accumulated in a dense scratch row, while a list keeps track of its
+ * non-zero columns. Chunks of rows are computed in parallel, each with its
+ * own scratch row, and then concatenated.
+ */
+template <class T>
+sparse_matrix<T> sparse_matrix<T>::operator*(const sparse_matrix& m) const
+{
+   if (m._rows != _cols)
+      throw std::domain_error("Right matrix must have rows count equals to first matrix's columns count");
+
+   const sparse_matrix a = to_csr();
+   const sparse_matrix b = m.to_csr();
+   const int n = b._cols;
+
+   struct chunk {
+      std::vector<int> counts;
+      std::vector<int> indices;
+      std::vector<T> values;
+   };
+
+   const int chunkSize = std::max(1, parallel_grain<T>::value / 8);
+   const int chunksCount = (_rows + chunkSize - 1) / chunkSize;
+   std::vector<chunk> chunks(chunksCount);
+
+   parallel_for(0, chunksCount, 1, [&](int cb, int ce) {
+
+      std::vector<T> acc(n);
+      std::vector<char> used(n, 0);
+      std::vector<int> cols;
+
+      for (int ch=cb; ch < ce; ch++) {
+
+         chunk& out = chunks[ch];
+         const int rEnd = std::min(_rows, (ch + 1) * chunkSize);
+
+         for (int i=ch * chunkSize; i < rEnd; i++) {
+
+            cols.clear();
+
+            for (int p=a._starts[i]; p < a._starts[i+1]; p++) {
+
+               const T& v = a._values[p];
+               const int k = a._indices[p];
+
+               for (int q=b._starts[k]; q < b._starts[k+1]; q++) {
+
+                  const int j = b._indices[q];
+
+                  if (!used[j]) {
+                     used[j] = 1;
+                     acc[j] = v * b._values[q];
+                     cols.push_back(j);
+                  } else {
+                     acc[j] += v * b._values[q];
+                  }
+               }
+            }
+
+            std::sort(cols.begin(), cols.end());
+            int count = 0;
+
+            for (int j : cols) {
+
+               used[j] = 0;
+
+               if (acc[j] != 0) {
+                  out.indices.push_back(j);
+                  out.values.push_back(acc[j]);
+                  count++;
+               }
+            }
+
+            out.counts.push_back(count);
+         }
+      }
+   });
+
+   sparse_matrix res(_rows, n);
+   int row = 0;
+
+   for (chunk& ch : chunks) {
+
+      for (int count : ch.counts) {
+         res._starts[row+1] = res._starts[row] + count;
+         row++;
+      }
+
+      res._indices.insert(res._indices.end(), ch.indices.begin(), ch.indices.end());
+      res._values.insert(res._values.end(), ch.values.begin(), ch.values.end());
+   }
+
+   return res;
+}
+
+
+/*
+ * Sparse LU factorization with Markowitz pivoting: P*A*Q = L*U.
+ *
+ * Eliminating with the pivots of a dense algorithm would quickly fill the
+ * sparse matrix in. Instead, at each step, the pivot (r, c) is chosen
+ * among the elements of the few sparsest columns so that it minimizes the
+ * Markowitz cost (rowCount(r) - 1) * (colCount(c) - 1), an upper bound of
+ * the fill-in the step can generate. For floating point types, a pivot is
+ * also required to be at least sparse_pivot_threshold times the biggest
+ * element of its column (threshold pivoting), for stability; for exact
+ * types, any non-zero is as good as any other.
+ *
+ * Works on rectangular matrices too: the elimination stops when nothing
+ * non-zero is left, and the number of pivots is the rank. The columns
+ * without a pivot are the free variables of the null space.
+ *
+ * The factors are stored step by step: the pivot row at step k (U) and
+ * the multipliers used to eliminate the pivot column from the other rows
+ * (L), so memory is O(nnz(L) + nnz(U)).
+ */
+
+// Number of columns (the sparsest ones) searched for the pivot at each step.
+constexpr const int sparse_markowitz_cols = 4;
+constexpr const double sparse_pivot_threshold = 0.1;
+
+template <class T>
+class sparse_lu {
+
+public:
+
+   explicit sparse_lu(const sparse_matrix<T>& a);
+
+   int rows() const { return _rows; }
+   int cols() const { return _cols; }
+   int rank() const { return static_cast<int>(_pivotRows.size()); }
+
+   bool is_singular() const { return _rows != _cols || rank() < _rows; }
+
+   // Number of elements stored in the L and U factors.
+   int factors_nnz() const {
+      return static_cast<int>(_lValues.size() + _uValues.size());
+   }
+
+   T determinant() const;
+
+   matrix<T> solve(const matrix<T>& b) const;
+   matrix<T> solve_many(const matrix<T>& b) const;
+
+   // The columns of the result (CSC) are a basis of the null space.
+   sparse_matrix<T> null_space() const;
+
+protected:
+
+   typedef std::vector<std::pair<int, T>> sparse_row;
+
+   int _rows;
+   int _cols;
+
+   // The pivot of step k is (_pivotRows[k], _pivotCols[k]).
+   std::vector<int> _pivotRows;
+   std::vector<int> _pivotCols;
+
+   // U: the pivot row of each step, pivot first.
+   std::vector<int> _uStarts;
+   std::vector<int> _uIndices;
+   std::vector<T> _uValues;
+
+   // L: at step k, row _lIndices[p] -= _lValues[p] * pivot row.
+   std::vector<int> _lStarts;
+   std::vector<int> _lIndices;
+   std::vector<T> _lValues;
+
+   void factorize(const sparse_matrix<T>& a);
+
+   static double magnitude(const T& v, std::true_type) { return std::abs(v); }
+   static double magnitude(const T&, std::false_type) { return 1.0; }
+
+   static double magnitude(const T& v) {
+      return magnitude(v, std::is_floating_point<T>());
+   }
+
+   static int permutation_sign(const std::vector<int>& perm);
+};
+
+
+template <class T>
+sparse_lu<T>::sparse_lu(const sparse_matrix<T>& a)
+   : _rows(a.rows()), _cols(a.cols())
+{
+   factorize(a);
+}
+
+template <class T>
+void sparse_lu<T>::factorize(const sparse_matrix<T>& s)
+{
+   const sparse_matrix<T> a = s.to_csr();
+
+   std::vector<sparse_row> rows(_rows);
+   std::vector<std::vector<int>> colRows(_cols);
+   std::vector<int> colCount(_cols, 0);
+   std::vector<char> rowActive(_rows, 1);
+
+   // For floating point types, what's smaller than this is a zero.
+   double dropTol = 0.0;
+
+   for (int i=0; i < _rows; i++) {
+      for (int p=a.starts()[i]; p < a.starts()[i+1]; p++) {
+
+         const int j = a.indices()[p];
+         rows[i].emplace_back(j, a.values()[p]);
+         colRows[j].push_back(i);
+         colCount[j]++;
+
+         if (std::is_floating_point<T>::value)
+            dropTol = std::max(dropTol, magnitude(a.values()[p]));
+      }
+   }
+
+   dropTol *= std::numeric_limits<double>::epsilon() * std::max(_rows, _cols);
+
+   // Active columns with at least one non-zero, by count.
+   std::set<std::pair<int, int>> queue;
+
+   for (int j=0; j < _cols; j++)
+      if (colCount[j] > 0)
+         queue.insert(std::make_pair(colCount[j], j));
+
+   auto update_count = [&](int j, int delta) {
+
+      queue.erase(std::make_pair(colCount[j], j));
+      colCount[j] += delta;
+
+      if (colCount[j] > 0)
+         queue.insert(std::make_pair(colCount[j], j));
+   };
+
+   auto find = [&rows](int r, int c) -> T * {
+
+      sparse_row& row = rows[r];
+
+      auto it = std::lower_bound(row.begin(), row.end(), c,
+                                 [](const std::pair<int, T>& e, int col) {
+                                    return e.first < col;
+                                 });
+
+      return it != row.end() && it->first == c ? &it->second : nullptr;
+   };
+
+   _uStarts.push_back(0);
+   _lStarts.push_back(0);
+
+   while (!queue.empty()) {
+
+      long long bestCost = std::numeric_limits<long long>::max();
+      int pr = -1, pc = -1;
+      int examined = 0;
+
+      for (auto it = queue.begin();
+           it != queue.end() && examined < sparse_markowitz_cols; ++it, examined++)
+      {
+         const int c = it->second;
+         std::vector<int>& list = colRows[c];
+         double colMax = 0.0;
+
+         // Drop the stale entries: inactive rows and lost elements.
+         std::sort(list.begin(), list.end());
+         list.erase(std::unique(list.begin(), list.end()), list.end());
+         list.erase(std::remove_if(list.begin(), list.end(), [&](int r) {
+            return !rowActive[r] || !find(r, c);
+         }), list.end());
+
+         for (int r : list)
+            colMax = std::max(colMax, magnitude(*find(r, c)));
+
+         for (int r : list) {
+
+            if (magnitude(*find(r, c)) < sparse_pivot_threshold * colMax)
+               continue;
+
+            const long long cost =
+               static_cast<long long>(rows[r].size() - 1) * (colCount[c] - 1);
+
+            if (cost < bestCost) {
+               bestCost = cost;
+               pr = r;
+               pc = c;
+            }
+         }
+
+         if (bestCost == 0)
+            break;
+      }
+
+      assert(pr != -1);
+
+      // The pivot row goes into U, pivot first.
+      const sparse_row pivotRow = rows[pr];
+      const T pivot = *find(pr, pc);
+
+      _pivotRows.push_back(pr);
+      _pivotCols.push_back(pc);
+      _uIndices.push_back(pc);
+      _uValues.push_back(pivot);
+
+      for (const auto& e : pivotRow) {
+         if (e.first != pc) {
+            _uIndices.push_back(e.first);
+            _uValues.push_back(e.second);
+         }
+      }
+
+      _uStarts.push_back(static_cast<int>(_uValues.size()));
+
+      rowActive[pr] = 0;
+
+      for (const auto& e : pivotRow)
+         update_count(e.first, -1);
+
+      // Eliminate the pivot column from the other active rows.
+      for (int i : colRows[pc]) {
+
+         if (!rowActive[i])
+            continue;
+
+         const T *aic = find(i, pc);
+
+         if (!aic)
+            continue;
+
+         const T f = *aic / pivot;
+         const sparse_row& old = rows[i];
+         sparse_row res;
+         res.reserve(old.size() + pivotRow.size());
+
+         size_t p = 0, q = 0;
+
+         while (p < old.size() || q < pivotRow.size()) {
+
+            const int jp = p < old.size() ? old[p].first : _cols;
+            const int jq = q < pivotRow.size() ? pivotRow[q].first : _cols;
+
+            if (jp < jq) {
+
+               res.push_back(old[p++]);
+
+            } else if (jq < jp) {
+
+               // Fill-in.
+               const T v = -(f * pivotRow[q].second);
+               const int j = jq;
+               q++;
+
+               if (v == 0 || magnitude(v) <= dropTol)
+                  continue;
+
+               res.emplace_back(j, v);
+               colRows[j].push_back(i);
+               update_count(j, +1);
+
+            } else {
+
+               const int j = jp;
+               const T v = old[p++].second - f * pivotRow[q++].second;
+
+               if (j == pc)
+                  continue;
+
+               if (v == 0 || magnitude(v) <= dropTol) {
+                  update_count(j, -1);
+                  continue;
+               }
+
+               res.emplace_back(j, v);
+            }
+         }
+
+         rows[i].swap(res);
+         _lIndices.push_back(i);
+         _lValues.push_back(f);
+      }
+
+      _lStarts.push_back(static_cast<int>(_lValues.size()));
+
+      queue.erase(std::make_pair(colCount[pc], pc));
+      colCount[pc] = 0;
+      std::vector<int>().swap(colRows[pc]);
+      sparse_row().swap(rows[pr]);
+   }
+}
+
+template <class T>
+int sparse_lu<T>::permutation_sign(const std::vector<int>& perm)
+{
+   std::vector<char> visited(perm.size(), 0);
+   int sign = 1;
+
+   for (size_t i=0; i < perm.size(); i++) {
+
+      if (visited[i])
+         continue;
+
+      size_t len = 0;
+
+      for (size_t j=i; !visited[j]; j = perm[j]) {
+         visited[j] = 1;
+         len++;
+      }
+
+      if (len % 2 == 0)
+         sign = -sign;
+   }
+
+   return sign;
+}
+
+template <class T>
+T sparse_lu<T>::determinant() const
+{
+   if (_rows != _cols)
+      throw std::domain_error("Determinant can be computed only for square matrices");
+
+   if (is_singular())
+      return T(0);
+
+   T det = T(1);
+
+   for (int k=0; k < rank(); k++)
+      det *= _uValues[_uStarts[k]];
+
+   if (permutation_sign(_pivotRows) * permutation_sign(_pivotCols) < 0)
+      det = -det;
+
+   return det;
+}
+
+template <class T>
+matrix<T> sparse_lu<T>::solve(const matrix<T>& b) const
+{
+   if (b.cols() != 1)
+      throw std::domain_error("The right-hand side must be a column vector");
+
+   return solve_many(b);
+}
+
+template <class T>
+matrix<T> sparse_lu<T>::solve_many(const matrix<T>& b) const
+{
+   if (b.rows() != _rows)
+      throw std::domain_error("The right-hand side must have as many rows as the system matrix");
+
+   if (is_singular())
+      throw std::runtime_error("Can't solve a singular system");
+
+   const int n = _rows;
+   const int k = b.cols();
+   matrix<T> y = b;
+   matrix<T> x(n, k);
+
+   // Replay the elimination on the right-hand sides.
+   for (int s=0; s < n; s++) {
+
+      const T *yp = &y(_pivotRows[s], 0);
+
+      for (int p=_lStarts[s]; p < _lStarts[s+1]; p++) {
+
+         T *yi = &y(_lIndices[p], 0);
+         const T& f = _lValues[p];
+
+         for (int c=0; c < k; c++)
+            yi[c] -= f * yp[c];
+      }
+   }
+
+   // Back substitution, in reverse pivot order.
+   for (int s=n-1; s >= 0; s--) {
+
+      T *xs = &x(_pivotCols[s], 0);
+      const T *ys = &y(_pivotRows[s], 0);
+
+      for (int c=0; c < k; c++)
+         xs[c] = ys[c];
+
+      for (int p=_uStarts[s]+1; p < _uStarts[s+1]; p++) {
+
+         const T& u = _uValues[p];
+         const T *xj = &x(_uIndices[p], 0);
+
+         for (int c=0; c < k; c++)
+            xs[c] -= u * xj[c];
+      }
+
+      const T pivot = _uValues[_uStarts[s]];
+
+      for (int c=0; c < k; c++)
+         xs[c] /= pivot;
+   }
+
+   return x;
+}
+
+/*
+ * One basis vector per free column f: x(f) = 1, the other free variables
+ * are zero, and the pivot variables follow by back substitution.
+ */
+template <class T>
+sparse_matrix<T> sparse_lu<T>::null_space() const
+{
+   std::vector<char> isPivotCol(_cols, 0);
+   std::vector<sparse_triplet<T>> triplets;
+   std::vector<T> x(_cols);
+   int basisCol = 0;
+
+   for (int c : _pivotCols)
+      isPivotCol[c] = 1;
+
+   for (int f=0; f < _cols; f++) {
+
+      if (isPivotCol[f])
+         continue;
+
+      std::fill(x.begin(), x.end(), T(0));
+      x[f] = T(1);
+
+      for (int s=rank()-1; s >= 0; s--) {
+
+         T sum = T(0);
+
+         for (int p=_uStarts[s]+1; p < _uStarts[s+1]; p++)
+            if (x[_uIndices[p]] != 0)
+               sum += _uValues[p] * x[_uIndices[p]];
+
+         if (sum != 0)
+            x[_pivotCols[s]] = -sum / _uValues[_uStarts[s]];
+      }
+
+      for (int j=0; j < _cols; j++)
+         if (x[j] != 0)
+            triplets.push_back(sparse_triplet<T>{ j, basisCol, x[j] });
+
+      basisCol++;
+   }
+
+   return sparse_matrix<T>::from_triplets(_cols, basisCol, std::move(triplets),
+                                          sparse_layout::csc);
+}
+
+
+template <class T>
+int sparse_matrix<T>::rank() const {
+   return sparse_lu<T>(*this).rank();
+}
+
+template <class T>
+sparse_matrix<T> sparse_matrix<T>::null_space() const {
+   return sparse_lu<T>(*this).null_space();
+}
+
+} // namespace vmatrixlib
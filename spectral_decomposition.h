@@ -0,0 +1,541 @@
+
+#pragma once
+
+#include <cmath>
+#include <vector>
+#include <limits>
+#include <numeric>
+#include <algorithm>
+#include <stdexcept>
+#include <type_traits>
+
+#include "matrix.h"
+#include "householder.h"
+
+namespace vmatrixlib {
+
+/*
+ * Eigenvalues of symmetric matrices and singular values, for floating
+ * point types.
+ *
+ *    - symmetric_eigen_decomposition: A = V * diag(values) * V^T, with the
+ *      eigenvalues in ascending order. A is reduced to tridiagonal form
+ *      with Householder reflectors, then the tridiagonal matrix is
+ *      diagonalized with the implicit QL algorithm (Wilkinson shifts).
+ *    - svd_decomposition: A = U * diag(values) * V^T (thin: U is m x k and
+ *      V is n x k, k = min(m, n)), with the singular values in descending
+ *      order. One-sided Jacobi, after a QR when A is tall, which leaves a
+ *      square problem. Jacobi is slower than Golub-Kahan, but it computes
+ *      even the smallest singular values to high relative accuracy.
+ *
+ * With spectral_output::values, the vectors are neither accumulated nor
+ * stored, which saves most of the work.
+ */
+
+enum class spectral_output { values, values_and_vectors };
+
+constexpr const int spectral_max_iterations = 60;
+
+template <class T>
+class symmetric_eigen_decomposition {
+
+public:
+
+   explicit symmetric_eigen_decomposition(
+      const matrix<T>& a, spectral_output output = spectral_output::values_and_vectors);
+
+   int size() const { return static_cast<int>(_values.size()); }
+   bool has_vectors() const { return _hasVectors; }
+
+   const std::vector<T>& values() const { return _values; }
+
+   // The eigenvectors, as columns, in the order of values().
+   matrix<T> vectors() const;
+
+protected:
+
+   std::vector<T> _values;
+   matrix<T> _vectorsT;          // one eigenvector per row
+   bool _hasVectors;
+
+   void tridiagonalize(matrix<T>& a, std::vector<T>& e);
+   void diagonalize(std::vector<T>& e);
+   void sort();
+};
+
+template <class T>
+class svd_decomposition {
+
+public:
+
+   explicit svd_decomposition(
+      const matrix<T>& a, spectral_output output = spectral_output::values_and_vectors);
+
+   bool has_vectors() const { return _hasVectors; }
+
+   const std::vector<T>& values() const { return _values; }
+
+   const matrix<T>& u() const;
+   const matrix<T>& v() const;
+
+   // Singular values above max(m, n) * eps * values()[0].
+   int rank() const;
+
+protected:
+
+   int _rows;
+   int _cols;
+   std::vector<T> _values;
+   matrix<T> _u;
+   matrix<T> _v;
+   bool _hasVectors;
+
+   void jacobi(matrix<T>& b, matrix<T> *vt);
+};
+
+
+template <class T>
+symmetric_eigen_decomposition<T>::symmetric_eigen_decomposition(
+   const matrix<T>& a, spectral_output output)
+   : _hasVectors(output == spectral_output::values_and_vectors)
+{
+   static_assert(std::is_floating_point<T>::value,
+                 "Eigenvalues can be computed only for floating point types");
+
+   if (!a.is_square())
+      throw std::domain_error("Eigenvalues can be computed only for square matrices");
+
+   matrix<T> m = a;
+   std::vector<T> e;
+
+   tridiagonalize(m, e);
+   diagonalize(e);
+   sort();
+}
+
+/*
+ * At step k, the reflector computed from row k (beyond the diagonal)
+ * zeroes A(k, k+2:) and, by symmetry, A(k+2:, k). Applying it on both
+ * sides of the trailing block is a symmetric rank-2 update:
+ *
+ *    p = tau * A22 * v,   w = p - (tau/2) * (p^T v) * v,
+ *    A22 -= v * w^T + w * v^T
+ *
+ * The reflectors are kept in the rows of a, then multiplied together into
+ * Q^T if the vectors are needed.
+ */
+template <class T>
+void symmetric_eigen_decomposition<T>::tridiagonalize(matrix<T>& a, std::vector<T>& e)
+{
+   const int n = a.rows();
+   std::vector<T> tau(std::max(0, n - 2)), v(n), w(n);
+
+   _values.resize(n);
+   e.assign(n, T(0));
+
+   for (int k=0; k < n-2; k++) {
+
+      const int m = n - k - 1;
+      T *row = &a(k, k+1);
+
+      e[k] = householder_vector(m, row, 1, &tau[k]);
+
+      if (tau[k] == 0)
+         continue;
+
+      v[0] = T(1);
+      std::copy(row + 1, row + m, v.begin() + 1);
+
+      const T t = tau[k];
+      const int grain = std::max(1, parallel_grain<T>::value / m);
+
+      parallel_for(0, m, grain, [&a, &v, &w, k, m, t](int rb, int re) {
+
+         for (int i=rb; i < re; i++) {
+
+            const T *ai = &a(k+1+i, k+1);
+            T sum = T(0);
+
+            for (int j=0; j < m; j++)
+               sum += ai[j] * v[j];
+
+            w[i] = t * sum;
+         }
+      });
+
+      T pv = T(0);
+
+      for (int i=0; i < m; i++)
+         pv += w[i] * v[i];
+
+      const T f = t * pv / 2;
+
+      for (int i=0; i < m; i++)
+         w[i] -= f * v[i];
+
+      parallel_for(0, m, grain, [&a, &v, &w, k, m](int rb, int re) {
+
+         for (int i=rb; i < re; i++) {
+
+            T *ai = &a(k+1+i, k+1);
+            const T vi = v[i], wi = w[i];
+
+            for (int j=0; j < m; j++)
+               ai[j] -= vi * w[j] + wi * v[j];
+         }
+      });
+   }
+
+   for (int k=0; k < n; k++)
+      _values[k] = a(k,k);
+
+   if (n >= 2)
+      e[n-2] = a(n-2, n-1);
+
+   if (!_hasVectors)
+      return;
+
+   // Q^T = H(n-3) * ... * H(0), each acting on the rows from k+1 on.
+   _vectorsT = matrix<T>(n, n);
+   _vectorsT.make_identity();
+
+   for (int k=0; k < n-2; k++)
+      householder_apply_left(n - k - 1, n, &a(k, k+1), 1, tau[k],
+                             &_vectorsT(k+1, 0), n, w.data());
+}
+
+/*
+ * Implicit QL with Wilkinson shifts on the tridiagonal matrix (diagonal in
+ * _values, e[i] coupling i and i+1): as in EISPACK's tql2. The rotations
+ * act on pairs of columns of Q, that is on pairs of rows of _vectorsT.
+ */
+template <class T>
+void symmetric_eigen_decomposition<T>::diagonalize(std::vector<T>& e)
+{
+   const int n = size();
+   const T eps = std::numeric_limits<T>::epsilon();
+   std::vector<T>& d = _values;
+
+   for (int l=0; l < n; l++) {
+
+      int iter = 0;
+      int m;
+
+      do {
+
+         for (m=l; m < n-1; m++) {
+
+            const T dd = std::abs(d[m]) + std::abs(d[m+1]);
+
+            if (std::abs(e[m]) <= eps * dd)
+               break;
+         }
+
+         if (m == l)
+            break;
+
+         if (iter++ == spectral_max_iterations)
+            throw std::runtime_error("Eigenvalues: no convergence");
+
+         T g = (d[l+1] - d[l]) / (2 * e[l]);
+         T r = std::hypot(g, T(1));
+
+         g = d[m] - d[l] + e[l] / (g + (g >= 0 ? r : -r));
+
+         T s = 1, c = 1, p = 0;
+         int i;
+
+         for (i=m-1; i >= l; i--) {
+
+            T f = s * e[i];
+            const T b = c * e[i];
+
+            e[i+1] = r = std::hypot(f, g);
+
+            if (r == 0) {
+               d[i+1] -= p;
+               e[m] = 0;
+               break;
+            }
+
+            s = f / r;
+            c = g / r;
+            g = d[i+1] - p;
+            r = (d[i] - g) * s + 2 * c * b;
+            p = s * r;
+            d[i+1] = g + p;
+            g = c * r - b;
+
+            if (_hasVectors) {
+
+               T *zi = &_vectorsT(i, 0);
+               T *zi1 = &_vectorsT(i+1, 0);
+
+               for (int k=0; k < n; k++) {
+                  f = zi1[k];
+                  zi1[k] = s * zi[k] + c * f;
+                  zi[k] = c * zi[k] - s * f;
+               }
+            }
+         }
+
+         if (r == 0 && i >= l)
+            continue;
+
+         d[l] -= p;
+         e[l] = g;
+         e[m] = 0;
+
+      } while (m != l);
+   }
+}
+
+template <class T>
+void symmetric_eigen_decomposition<T>::sort()
+{
+   const int n = size();
+   std::vector<int> order(n);
+
+   std::iota(order.begin(), order.end(), 0);
+   std::sort(order.begin(), order.end(),
+             [this](int i, int j) { return _values[i] < _values[j]; });
+
+   std::vector<T> values(n);
+   matrix<T> vectorsT(_hasVectors ? n : 0, _hasVectors ? n : 0);
+
+   for (int i=0; i < n; i++) {
+
+      values[i] = _values[order[i]];
+
+      if (_hasVectors)
+         vectorsT.attach_row(_vectorsT, order[i], i);
+   }
+
+   _values.swap(values);
+
+   if (_hasVectors)
+      _vectorsT = std::move(vectorsT);
+}
+
+template <class T>
+matrix<T> symmetric_eigen_decomposition<T>::vectors() const
+{
+   if (!_hasVectors)
+      throw std::runtime_error("The eigenvectors were not computed");
+
+   return _vectorsT.transpose();
+}
+
+
+template <class T>
+svd_decomposition<T>::svd_decomposition(const matrix<T>& a, spectral_output output)
+   : _rows(a.rows()), _cols(a.cols()),
+     _hasVectors(output == spectral_output::values_and_vectors)
+{
+   static_assert(std::is_floating_point<T>::value,
+                 "Singular values can be computed only for floating point types");
+
+   // Work on A^T when A is wide: then swap U and V.
+   const bool wide = _rows < _cols;
+   matrix<T> work = wide ? a.transpose() : a;
+   const int m = work.rows();
+   const int n = work.cols();
+
+   if (n == 0)
+      return;
+
+   /*
+    * Tall: A = Q*R, and the SVD of the square R gives the one of A with
+    * U = Q * U_R. Jacobi then works on n rows instead of m.
+    */
+   std::vector<T> tau(n);
+   householder_qr(m, n, &work(0,0), n, tau.data());
+
+   // B = R^T: the columns of R are the rows of B, which Jacobi rotates.
+   matrix<T> b(n, n);
+
+   for (int i=0; i < n; i++)
+      for (int j=i; j < n; j++)
+         b(j,i) = work(i,j);
+
+   matrix<T> vt;
+
+   if (_hasVectors) {
+      vt = matrix<T>(n, n);
+      vt.make_identity();
+   }
+
+   jacobi(b, _hasVectors ? &vt : nullptr);
+
+   if (!_hasVectors)
+      return;
+
+   // The rows of B are now sigma(i) * (column i of U_R).
+   matrix<T> u(m, n);
+   std::vector<T> wk(n);
+
+   for (int i=0; i < n; i++)
+      for (int j=0; j < n; j++)
+         u(j,i) = _values[i] != 0 ? b(i,j) / _values[i] : T(i == j);
+
+   // U = Q * [U_R; 0]
+   for (int j=n-1; j >= 0; j--)
+      householder_apply_left(m - j, n, &work(j,j), n, tau[j],
+                             &u(j,0), n, wk.data());
+
+   if (wide) {
+      _u = vt.transpose();
+      _v = std::move(u);
+   } else {
+      _u = std::move(u);
+      _v = vt.transpose();
+   }
+}
+
+/*
+ * One-sided Jacobi (Hestenes): rotate pairs of rows of B until they are
+ * all orthogonal. Then the singular values are the norms of the rows, and
+ * the rotations, accumulated in vt, give V^T.
+ */
+template <class T>
+void svd_decomposition<T>::jacobi(matrix<T>& b, matrix<T> *vt)
+{
+   const int n = b.rows();
+   const T eps = std::numeric_limits<T>::epsilon();
+   std::vector<T> norms(n);
+
+   for (int sweep=0; sweep < spectral_max_iterations; sweep++) {
+
+      bool rotated = false;
+
+      for (int i=0; i < n; i++) {
+
+         T s = T(0);
+         const T *bi = &b(i,0);
+
+         for (int k=0; k < n; k++)
+            s += bi[k] * bi[k];
+
+         norms[i] = s;
+      }
+
+      for (int i=0; i < n-1; i++) {
+
+         for (int j=i+1; j < n; j++) {
+
+            T *bi = &b(i,0);
+            T *bj = &b(j,0);
+            T gamma = T(0);
+
+            for (int k=0; k < n; k++)
+               gamma += bi[k] * bj[k];
+
+            const T alpha = norms[i];
+            const T beta = norms[j];
+
+            if (std::abs(gamma) <= eps * std::sqrt(alpha * beta))
+               continue;
+
+            rotated = true;
+
+            const T zeta = (beta - alpha) / (2 * gamma);
+            const T t = (zeta >= 0 ? T(1) : T(-1)) /
+                        (std::abs(zeta) + std::sqrt(1 + zeta * zeta));
+            const T c = 1 / std::sqrt(1 + t * t);
+            const T s = c * t;
+
+            for (int k=0; k < n; k++) {
+               const T x = bi[k];
+               bi[k] = c * x - s * bj[k];
+               bj[k] = s * x + c * bj[k];
+            }
+
+            norms[i] = alpha - t * gamma;
+            norms[j] = beta + t * gamma;
+
+            if (vt) {
+
+               T *vi = &(*vt)(i,0);
+               T *vj = &(*vt)(j,0);
+
+               for (int k=0; k < n; k++) {
+                  const T x = vi[k];
+                  vi[k] = c * x - s * vj[k];
+                  vj[k] = s * x + c * vj[k];
+               }
+            }
+         }
+      }
+
+      if (!rotated)
+         break;
+   }
+
+   // Sort by descending singular value, with the rows of B and vt.
+   std::vector<int> order(n);
+   std::iota(order.begin(), order.end(), 0);
+
+   for (int i=0; i < n; i++) {
+
+      T s = T(0);
+
+      for (int k=0; k < n; k++)
+         s += b(i,k) * b(i,k);
+
+      norms[i] = std::sqrt(s);
+   }
+
+   std::sort(order.begin(), order.end(),
+             [&norms](int i, int j) { return norms[i] > norms[j]; });
+
+   _values.resize(n);
+
+   matrix<T> sb(n, n), svt(vt ? n : 0, vt ? n : 0);
+
+   for (int i=0; i < n; i++) {
+
+      _values[i] = norms[order[i]];
+      sb.attach_row(b, order[i], i);
+
+      if (vt)
+         svt.attach_row(*vt, order[i], i);
+   }
+
+   b = std::move(sb);
+
+   if (vt)
+      *vt = std::move(svt);
+}
+
+template <class T>
+const matrix<T>& svd_decomposition<T>::u() const
+{
+   if (!_hasVectors)
+      throw std::runtime_error("The singular vectors were not computed");
+
+   return _u;
+}
+
+template <class T>
+const matrix<T>& svd_decomposition<T>::v() const
+{
+   if (!_hasVectors)
+      throw std::runtime_error("The singular vectors were not computed");
+
+   return _v;
+}
+
+template <class T>
+int svd_decomposition<T>::rank() const
+{
+   if (_values.empty())
+      return 0;
+
+   const T tol = std::max(_rows, _cols) * std::numeric_limits<T>::epsilon() *
+                 _values[0];
+
+   return static_cast<int>(std::count_if(_values.begin(), _values.end(),
+                                         [tol](const T& s) { return s > tol; }));
+}
+
+} // namespace vmatrixlib
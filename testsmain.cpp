@@ -1,13 +1,60 @@
 
 #include <cstring>
+#include <cstdlib>
 #include <iostream>
+#include <sstream>
 #include <random>
+#include <atomic>
+#include <new>
+#include <functional>
+#include <algorithm>
 
 #include "matrix.h"
+#include "lu_factorization.h"
+#include "qr_factorization.h"
+#include "cholesky_factorization.h"
+#include "spectral_decomposition.h"
+#include "compact_matrix.h"
+#include "packed_matrix.h"
+#include "sparse_matrix.h"
+#include "iterative_solvers.h"
+#include "random_matrix.h"
+#include "matrix_file.h"
+#include "matrix_writer.h"
+#include "matrix_reader.h"
 
 using namespace std;
 using namespace vmatrixlib;
 
+static atomic<long> allocations_count(0);
+
+/*
+ * The replacement operator new counts the allocations, and the replacement
+ * operator delete frees them: both use malloc/free, so the pairing is
+ * right, but GCC warns for every delete-expression inlined with them.
+ */
+#if defined(__GNUC__) && __GNUC__ >= 11
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+void *operator new(size_t size)
+{
+   allocations_count++;
+
+   if (void *p = malloc(size ? size : 1))
+      return p;
+
+   throw bad_alloc();
+}
+
+void operator delete(void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+
+#if defined(__GNUC__) && __GNUC__ >= 11
+#pragma GCC diagnostic pop
+#endif
+
 void testing_float_to_frac()
 {
    random_device rdev;
@@ -54,6 +101,74 @@ void testing_float_to_frac()
    cout << "[PASS]\n";
 }
 
+void testing_frac_arithmetic()
+{
+   typedef frac<long long, long double> fr;
+
+   cout << "Testing frac arithmetic... ";
+   cout.flush();
+
+   random_device rdev;
+   default_random_engine e(rdev());
+   uniform_int_distribution<long long> dist(-100000, 100000);
+
+   for (int i = 0; i < 100000; i++) {
+
+      const long long d1 = dist(e), d2 = dist(e);
+
+      if (d1 == 0 || d2 == 0)
+         continue;
+
+      const fr a(dist(e), d1), b(dist(e), d2);
+      const fr res[] = { a + b, a - b, a * b };
+
+      const long double expected[] = {
+         to_float(a) + to_float(b),
+         to_float(a) - to_float(b),
+         to_float(a) * to_float(b)
+      };
+
+      for (int k = 0; k < 3; k++) {
+
+         const long double val = to_float(res[k]);
+         const bool exact = !res[k].is_using_fp();
+
+         if (fabsl(val - expected[k]) > 1e-12L * (1 + fabsl(expected[k])) ||
+             (exact && (res[k].int_denominator() <= 0 ||
+                        gcd(res[k].int_numerator(),
+                            res[k].int_denominator()) != 1)))
+         {
+            cout << "[FAIL]\n";
+            cout << to_string(a) << " op" << k << " " << to_string(b)
+                 << " = " << to_string(res[k]) << endl;
+            return;
+         }
+      }
+   }
+
+   const fr big(numeric_limits<long long>::max() / 2, 1LL);
+   const fr prod = big * fr(3LL, 1LL);
+
+   if (!prod.is_using_fp() ||
+       fabsl(to_float(prod) - 3 * to_float(big)) > 1e-6L * to_float(prod))
+   {
+      cout << "[FAIL]\n";
+      cout << "No floating point fallback on overflow\n";
+      return;
+   }
+
+   // LLONG_MIN can't be negated: it must not stay exact, whatever the sign of den.
+   const fr smallest(numeric_limits<long long>::min(), 1LL);
+
+   if (!smallest.is_using_fp() || to_float(-smallest) != ldexpl(1.0L, 63)) {
+      cout << "[FAIL]\n";
+      cout << "LLONG_MIN must fall back to floating point\n";
+      return;
+   }
+
+   cout << "[PASS]\n";
+}
+
 void testing_triang_matrix()
 {
    cout << "Making many random matrixes triangular... ";
@@ -82,7 +197,7 @@ void testing_inv_matrix()
       vmatrix inv = A.compute_inverse();
       vmatrix invinv = inv.compute_inverse();
 
-      if (invinv != A) {
+      if (invinv != A || inv != A.compute_inverse_by_cofactors()) {
 
          cout << "[FAIL]\n";
          cout << "A:\n";
@@ -99,6 +214,1808 @@ void testing_inv_matrix()
 
    }
 
+   fast_vmatrix F = fast_vmatrix::random(200, 200, -10, 10, 3, 0.0);
+   fast_vmatrix I = F * F.compute_inverse();
+
+   for (int i = 0; i < I.rows(); i++) {
+      for (int j = 0; j < I.cols(); j++) {
+         if (fabs(I(i, j) - (i == j ? 1.0 : 0.0)) > 1e-8) {
+            cout << "[FAIL]\n";
+            printf("A * A^-1 (%i,%i) = %e\n", i, j, I(i, j));
+            return;
+         }
+      }
+   }
+
+   cout << "[PASS]\n";
+}
+
+void testing_matrix_product()
+{
+   cout << "Multiplying fast matrixes... ";
+   cout.flush();
+
+   random_device rdev;
+   default_random_engine e(rdev());
+   uniform_int_distribution<> dims(1, 150);
+
+   for (int i = 0; i < 30; i++) {
+
+      const int r = dims(e), n = dims(e), c = dims(e);
+
+      fast_vmatrix A = fast_vmatrix::random(r, n, -10, 10, 2, 0.1);
+      fast_vmatrix B = fast_vmatrix::random(n, c, -10, 10, 2, 0.1);
+      fast_vmatrix C = A * B;
+
+      for (int x = 0; x < r; x++) {
+         for (int y = 0; y < c; y++) {
+
+            double expected = 0;
+
+            for (int k = 0; k < n; k++)
+               expected += A(x, k) * B(k, y);
+
+            if (fabs(C(x, y) - expected) > 1e-9 * (1 + fabs(expected))) {
+               cout << "[FAIL]\n";
+               printf("(%i x %i) * (%i x %i): C(%i,%i) = %f, expected %f\n",
+                      r, n, n, c, x, y, C(x, y), expected);
+               return;
+            }
+         }
+      }
+   }
+
+   cout << "[PASS]\n";
+}
+
+void testing_parallel_ops()
+{
+   cout << "Comparing parallel and serial matrix ops... ";
+   cout.flush();
+
+   const int saved_threads = get_num_threads();
+
+   fast_vmatrix A = fast_vmatrix::random(301, 257, -10, 10, 2, 0.1);
+   fast_vmatrix B = fast_vmatrix::random(257, 190, -10, 10, 2, 0.1);
+   vmatrix V = vmatrix::random(40, 40, -10, 10, 1, 0.3);
+
+   set_num_threads(1);
+
+   fast_vmatrix prod1 = A * B;
+   fast_vmatrix tr1 = A.transpose();
+   fast_vmatrix sum1 = A + A * 3.0;
+   vmatrix vprod1 = V * V;
+
+   set_num_threads(4);
+
+   fast_vmatrix prod4 = A * B;
+   fast_vmatrix tr4 = A.transpose();
+   fast_vmatrix sum4 = A + A * 3.0;
+   vmatrix vprod4 = V * V;
+
+   // An exception thrown by any chunk reaches the caller, once all are done.
+   atomic<int> chunksDone(0);
+   bool caught = false;
+
+   try {
+      parallel_for(0, 64, 1, [&chunksDone](int b, int e) {
+
+         if (b <= 40 && 40 < e)
+            throw runtime_error("chunk failed");
+
+         chunksDone += e - b;
+      });
+   } catch (const runtime_error&) {
+      caught = true;
+   }
+
+   set_num_threads(saved_threads);
+
+   if (prod1 != prod4 || tr1 != tr4 || sum1 != sum4 || vprod1 != vprod4) {
+      cout << "[FAIL]\n";
+      return;
+   }
+
+   if (!caught || chunksDone.load() >= 64) {
+      cout << "[FAIL]\n";
+      cout << "The exception of a parallel_for() chunk must be rethrown\n";
+      return;
+   }
+
+   cout << "[PASS]\n";
+}
+
+void testing_lu_factorization()
+{
+   cout << "Solving systems with LU factorization... ";
+   cout.flush();
+
+   for (int i = 0; i < 200; i++) {
+
+      vmatrix A = vmatrix::random(5, 5, -9, 9, 0, 0.3);
+      vmatrix B = vmatrix::random(5, 3, -9, 9, 0, 0.3);
+      lu_factorization<vmatrix::number_type> lu(A);
+
+      if (lu.determinant() != A.determinant()) {
+         cout << "[FAIL]\n";
+         cout << "Wrong determinant for A:\n";
+         A.pretty_print();
+         return;
+      }
+
+      if (lu.is_singular())
+         continue;
+
+      vmatrix X = lu.solve_many(B);
+
+      if (A * X != B) {
+         cout << "[FAIL]\n";
+         cout << "A*X != B for A:\n";
+         A.pretty_print();
+         return;
+      }
+   }
+
+   fast_vmatrix A = fast_vmatrix::random(120, 120, -10, 10, 3, 0.0);
+   fast_vmatrix B = fast_vmatrix::random(120, 7, -10, 10, 3, 0.0);
+   lu_factorization<double> lu(A);
+   fast_vmatrix R = A * lu.solve_many(B) - B;
+
+   for (int i = 0; i < R.size(); i++) {
+      if (fabs(R(i)) > 1e-8) {
+         cout << "[FAIL]\n";
+         printf("Residual too big: %e\n", R(i));
+         return;
+      }
+   }
+
+   cout << "[PASS]\n";
+}
+
+void testing_matrix_expressions()
+{
+   cout << "Evaluating matrix expressions... ";
+   cout.flush();
+
+   vmatrix A = vmatrix::random(7, 9, -20, 20, 1, 0.3);
+   vmatrix B = vmatrix::random(7, 9, -20, 20, 1, 0.3);
+   vmatrix D = vmatrix::random(7, 9, -20, 20, 1, 0.3);
+   const vmatrix::number_type two(2, 1);
+
+   vmatrix C = A + B * two - D;
+   vmatrix E = A;
+   E = two * (E - D) + E;
+
+   for (int i = 0; i < A.size(); i++) {
+
+      if (C(i) != A(i) + B(i) * two - D(i) ||
+          E(i) != two * (A(i) - D(i)) + A(i))
+      {
+         cout << "[FAIL]\n";
+         return;
+      }
+   }
+
+   cout << "[PASS]\n";
+}
+
+void testing_matrix_views()
+{
+   cout << "Using matrix views... ";
+   cout.flush();
+
+   fast_vmatrix A = fast_vmatrix::random(90, 70, -10, 10, 2, 0.1);
+   fast_vmatrix B = fast_vmatrix::random(80, 50, -10, 10, 2, 0.1);
+
+   fast_vmatrix P1 = A.block(5, 3, 40, 30) * B.block(2, 4, 30, 20);
+   fast_vmatrix P2 = fast_vmatrix(A.block(5, 3, 40, 30)) *
+                     fast_vmatrix(B.block(2, 4, 30, 20));
+
+   fast_vmatrix T1 = A.view().transposed() * A.view();
+   fast_vmatrix T2 = A.transpose() * A;
+
+   if (P1 != P2 || T1 != T2) {
+      cout << "[FAIL]\n";
+      cout << "Wrong product of views\n";
+      return;
+   }
+
+   vmatrix V = vmatrix::random(5, 6, -20, 20, 1, 0.0);
+
+   for (int r = -1; r < V.rows(); r++) {
+      for (int c = -1; c < V.cols(); c++) {
+
+         vmatrix S = V.sub_matrix_erasing_row_col(r, c);
+
+         for (int i = 0; i < S.rows(); i++) {
+            for (int j = 0; j < S.cols(); j++) {
+
+               const int vi = (r != -1 && i >= r) ? i + 1 : i;
+               const int vj = (c != -1 && j >= c) ? j + 1 : j;
+
+               if (S(i, j) != V(vi, vj)) {
+                  cout << "[FAIL]\n";
+                  printf("Wrong sub_matrix_erasing_row_col(%i, %i)\n", r, c);
+                  return;
+               }
+            }
+         }
+      }
+   }
+
+   V.block(1, 2, 3, 2) = V.block(0, 0, 2, 3).transposed() * V(0, 0);
+
+   for (int i = 0; i < 3; i++) {
+      for (int j = 0; j < 2; j++) {
+         if (V(1 + i, 2 + j) != V(j, i) * V(0, 0)) {
+            cout << "[FAIL]\n";
+            cout << "Wrong assignment through a view\n";
+            return;
+         }
+      }
+   }
+
+   // Views of the matrix being assigned: evaluated into a temporary.
+   fast_vmatrix Q = fast_vmatrix::random(3, 3, -10, 10, 2, 0.0);
+   fast_vmatrix R = fast_vmatrix::random(2, 3, -10, 10, 2, 0.0);
+   fast_vmatrix W = fast_vmatrix::random(50, 40, -10, 10, 2, 0.0);
+   const fast_vmatrix Qt = Q.transpose(), Rt = R.transpose();
+   const fast_vmatrix Wb = fast_vmatrix(W.block(3, 5, 30, 20)) * 2.0;
+
+   Q = Q.view().transposed();
+   R = R.view().transposed();
+   W = W.block(3, 5, 30, 20) * 2.0;
+
+   if (Q != Qt || R != Rt || W != Wb) {
+      cout << "[FAIL]\n";
+      cout << "Wrong assignment of a view of the same matrix\n";
+      return;
+   }
+
+   cout << "[PASS]\n";
+}
+
+void testing_allocation_free_chains()
+{
+   cout << "Checking that rvalue chains don't allocate... ";
+   cout.flush();
+
+   fast_vmatrix A = fast_vmatrix::random(60, 60, -10, 10, 2, 0.0);
+   fast_vmatrix B = fast_vmatrix::random(60, 60, -10, 10, 2, 0.0);
+   fast_vmatrix C(60, 60);
+   vmatrix V = vmatrix::random(6, 6, -10, 10, 0, 0.2);
+   const vmatrix::number_type expectedDet = V.determinant();
+
+   const long before = allocations_count;
+
+   fast_vmatrix R = std::move(A).transpose().make_triangular();
+   C = R + B * 2.0 - R;
+   C -= B;
+   const vmatrix::number_type det = std::move(V).determinant();
+   fast_vmatrix RR = std::move(B).row_reduce();
+
+   const long allocs = allocations_count - before;
+
+   if (allocs != 0 || det != expectedDet || A.size() != 0 ||
+       !R.has_row_echelon_form() || RR.rank() != 60)
+   {
+      cout << "[FAIL]\n";
+      printf("%li allocations\n", allocs);
+      return;
+   }
+
+   cout << "[PASS]\n";
+}
+
+void testing_bigfrac()
+{
+   cout << "Exact rank and null space with bigfrac... ";
+   cout.flush();
+
+   random_device rdev;
+   default_random_engine e(rdev());
+   uniform_int_distribution<long long> dist(-(1LL << 62), 1LL << 62);
+
+   for (int i = 0; i < 2000; i++) {
+
+      const bigint n = bigint(dist(e)) * bigint(dist(e)) * bigint(dist(e));
+      const bigint d = bigint(dist(e)) * bigint(dist(e) >> (i % 62));
+
+      if (d.is_zero())
+         continue;
+
+      const bigint q = n / d, r = n % d;
+
+      if (q * d + r != n || r.abs() >= d.abs() ||
+          (!r.is_zero() && r.sign() != n.sign()))
+      {
+         cout << "[FAIL]\n";
+         cout << n.to_string() << " / " << d.to_string() << "\n";
+         return;
+      }
+   }
+
+   // -2^63 computed through the limbs is the inline INT64_MIN.
+   const bigint big = bigint(INT64_MAX) + bigint(1);
+
+   if (-big != bigint(INT64_MIN) || (-big) / bigint(INT64_MIN) != bigint(1) ||
+       !((-big) / bigint(INT64_MIN)).is_one())
+   {
+      cout << "[FAIL]\n";
+      cout << "-2^63 has two representations\n";
+      return;
+   }
+
+   // Rank k by construction: (n x k) * (k x n).
+   const int n = 50, k = 37;
+   exact_vmatrix A =
+      exact_vmatrix::random(n, k, -9, 9, 0, 0.0) *
+      exact_vmatrix::random(k, n, -9, 9, 0, 0.0);
+
+   const exact_vmatrix N = A.null_space();
+   const exact_vmatrix Z = A * N;
+   bool zero = true;
+
+   for (int i = 0; i < Z.size(); i++)
+      zero = zero && Z(i) == 0;
+
+   if (A.rank() != k || N.cols() != n - k || !zero) {
+      cout << "[FAIL]\n";
+      cout << "rank: " << A.rank() << ", null space dim: " << N.cols() << "\n";
+      return;
+   }
+
+   cout << "[PASS]\n";
+}
+
+void testing_fraction_free_elimination()
+{
+   cout << "Fraction-free determinant, rank and row reduction... ";
+   cout.flush();
+
+   random_device rdev;
+   default_random_engine e(rdev());
+   uniform_int_distribution<long long> dist(-99, 99);
+
+   for (int i = 0; i < 200; i++) {
+
+      // The same rational matrix, with both fraction types.
+      vmatrix A = vmatrix::random(6, 6, -9, 9, 1, 0.3);
+      exact_vmatrix E(6, 6);
+
+      for (int k = 0; k < A.size(); k++) {
+         const auto re = A(k).real_part();
+         E(k) = bigfrac(bigint(re.int_numerator()),
+                        bigint(re.int_denominator()));
+      }
+
+      lu_factorization<exact_vmatrix::number_type> lu(E);
+
+      // Integer types are eliminated exactly too.
+      matrix<long long> I(5, 5);
+      exact_vmatrix EI(5, 5);
+
+      for (int k = 0; k < I.size(); k++)
+         EI(k) = bigfrac(I(k) = dist(e));
+
+      if (E.determinant() != lu.determinant() ||
+          to_string(A.determinant()) != to_string(E.determinant()) ||
+          EI.determinant() != bigfrac(I.determinant()))
+      {
+         cout << "[FAIL]\n";
+         cout << "Wrong determinant for A:\n";
+         A.pretty_print();
+         return;
+      }
+
+      // Rank 3 by construction.
+      vmatrix B = vmatrix::random(7, 3, -9, 9, 1, 0.0) *
+                  vmatrix::random(3, 8, -9, 9, 1, 0.0);
+      vmatrix R = B.row_reduce();
+      vmatrix N = B.null_space();
+
+      if (B.rank() != 3 || R.rank() != 3 || N.cols() != 5 ||
+          B * N != vmatrix(7, 5) || !R.has_row_echelon_form())
+      {
+         cout << "[FAIL]\n";
+         cout << "Wrong row reduction for B:\n";
+         B.pretty_print();
+         return;
+      }
+   }
+
+   // (LLONG_MIN * 1 - 0) / -1 overflows: rejected, not trapped.
+   long long q = 0;
+
+   if (fraction_free_int_step(LLONG_MIN, 0LL, 1LL, 0LL, -1LL, &q) ||
+       !fraction_free_int_step(6LL, 2LL, 5LL, 3LL, -4LL, &q) || q != -6)
+   {
+      cout << "[FAIL]\n";
+      cout << "Wrong overflow check in fraction_free_int_step()\n";
+      return;
+   }
+
+   cout << "[PASS]\n";
+}
+
+void testing_compact_matrix()
+{
+   typedef frac<long long, long double> fr;
+   typedef vmatrix::number_type cfrac;
+
+   cout << "Converting to and from compact storage... ";
+   cout.flush();
+
+   vmatrix A = vmatrix::random(100, 100, -50, 50, 2, 0.2);
+   compact_vmatrix C = A;
+
+   if (vmatrix(C) != A || !C.is_real() || C.is_using_fp() ||
+       C.memory_bytes() * 3 > A.size() * sizeof(cfrac))
+   {
+      cout << "[FAIL]\n";
+      printf("Wrong real matrix, %zu bytes\n", C.memory_bytes());
+      return;
+   }
+
+   // Complex and floating point elements, then back to real and exact.
+   const cfrac z(fr(1LL, 3LL), fr(-2LL, 7LL));
+   const cfrac w(fr::make_dec_frac(1.5e30L), fr::make_dec_frac(-2.5L));
+
+   C.set(3, 4, z);
+   C.set(5, 6, w);
+   A(3, 4) = z;
+   A(5, 6) = w;
+
+   if (C.get(3, 4) != z || C(5, 6) != w || vmatrix(C) != A ||
+       C.is_real() || !C.is_using_fp())
+   {
+      cout << "[FAIL]\n";
+      cout << "Wrong complex or fp elements\n";
+      return;
+   }
+
+   C.set(3, 4, cfrac(fr(2LL, 1LL)));
+   C.set(5, 6, cfrac());
+   C.shrink();
+
+   if (C(3, 4) != cfrac(fr(2LL, 1LL)) || C(5, 6) != 0 ||
+       !C.is_real() || C.is_using_fp())
+   {
+      cout << "[FAIL]\n";
+      cout << "shrink() didn't release the arrays\n";
+      return;
+   }
+
+   // Freed fp slots are reused: the pool doesn't grow.
+   size_t bytes = 0;
+
+   for (int i = 0; i < 1000; i++) {
+
+      C.set(5, 6, w);
+      C.set(5, 6, cfrac(fr(1LL, 2LL)));
+
+      if (i == 1)
+         bytes = C.memory_bytes();
+   }
+
+   if (C.memory_bytes() != bytes) {
+      cout << "[FAIL]\n";
+      cout << "The fp pool grows\n";
+      return;
+   }
+
+   C.set(5, 6, cfrac());
+   C.shrink();
+
+   // Kernels on the compact arrays give the matrix<T> results.
+   const vmatrix P = vmatrix::random(40, 30, -9, 9, 1, 0.3);
+   const vmatrix Q = vmatrix::random(30, 35, -9, 9, 1, 0.3);
+   const vmatrix R = vmatrix::random(12, 8, -9, 9, 0, 0.2) *
+                     vmatrix::random(8, 12, -9, 9, 0, 0.2);
+   vmatrix S = vmatrix::random(10, 10, -9, 9, 0, 0.2);
+   S(2, 3) = z;
+   S(7, 1) = cfrac(fr(0LL, 1LL), fr(-3LL, 1LL));
+
+   const compact_vmatrix cP = P, cQ = Q, cR = R, cS = S;
+
+   if (vmatrix(cP * cQ) != P * Q || vmatrix(cS * cS) != S * S ||
+       vmatrix(cR.make_triangular()) != R.make_triangular() ||
+       cR.rank() != R.rank() || cR.determinant() != 0 ||
+       cS.determinant() != S.determinant() || cS.rank() != S.rank() ||
+       (cP * cQ).memory_bytes() * 3 > P.rows() * Q.cols() * sizeof(cfrac))
+   {
+      cout << "[FAIL]\n";
+      cout << "Wrong product or elimination on the compact arrays\n";
+      return;
+   }
+
+   // Expressions mixing compact and regular matrices.
+   const vmatrix B = vmatrix::random(100, 100, -50, 50, 2, 0.2);
+   const vmatrix before = C;
+   C = C + B * cfrac(2);
+
+   if (vmatrix(C) != vmatrix(before + B * cfrac(2))) {
+      cout << "[FAIL]\n";
+      cout << "Wrong expression result\n";
+      return;
+   }
+
+   cout << "[PASS]\n";
+}
+
+void testing_real_only_kernels()
+{
+   typedef vmatrix::number_type cfrac;
+
+   cout << "Running real complex matrices on real-only kernels... ";
+   cout.flush();
+
+   for (int i = 0; i < 100; i++) {
+
+      vmatrix A = vmatrix::random(7, 7, -9, 9, 1, 0.3);
+      vmatrix B = vmatrix::random(7, 5, -9, 9, 1, 0.3);
+
+      // A complex matrix, which must keep using the general kernels.
+      vmatrix C = A;
+      C(i % 7, 3) = cfrac(C(i % 7, 3).real_part(), 2);
+
+      // The rvalue overloads and views never use the real-only kernels.
+      if (!A.is_real() || C.is_real() ||
+          A.determinant() != vmatrix(A).determinant() ||
+          C.determinant() != vmatrix(C).determinant() ||
+          A.rank() != vmatrix(A).rank() ||
+          A.row_reduce() != vmatrix(A).row_reduce() ||
+          A.make_triangular() != vmatrix(A).make_triangular() ||
+          A * B != vmatrix(A.view() * B.view()) ||
+          C * B != vmatrix(C.view() * B.view()))
+      {
+         cout << "[FAIL]\n";
+         cout << "Different results for A:\n";
+         A.pretty_print();
+         return;
+      }
+
+      // Small integers: the inverse must not fall back to floating point.
+      vmatrix S = vmatrix::random(5, 5, -9, 9, 0, 0.3);
+      vmatrix I(5, 5);
+      I.make_identity();
+
+      if (S.determinant() == 0)
+         continue;
+
+      if (S * S.compute_inverse() != I) {
+         cout << "[FAIL]\n";
+         cout << "Wrong inverse for S:\n";
+         S.pretty_print();
+         return;
+      }
+   }
+
+   // A tiny fp imaginary part isn't real, and sums keep it.
+   typedef frac<long long, long double> fr;
+   const cfrac tiny(fr(1LL, 2LL), fr::make_dec_frac(1e-20L));
+   const cfrac sum = tiny + cfrac(fr(1LL, 3LL));
+
+   if (tiny.is_real() || sum.is_real() || to_float(sum.imag_part()) != 1e-20L) {
+      cout << "[FAIL]\n";
+      cout << "A tiny imaginary part was dropped\n";
+      return;
+   }
+
+   cout << "[PASS]\n";
+}
+
+void testing_sparse_matrix()
+{
+   typedef sparse_matrix<vmatrix::number_type> sparse_vmatrix;
+
+   cout << "Testing sparse matrices... ";
+   cout.flush();
+
+   for (int i = 0; i < 100; i++) {
+
+      vmatrix A = vmatrix::random(8, 11, -9, 9, 0, 0.7);
+      vmatrix B = vmatrix::random(11, 6, -9, 9, 0, 0.7);
+      sparse_vmatrix SA(A);
+      sparse_vmatrix SB(B, sparse_layout::csc);
+
+      matrix<vmatrix::number_type> x(11, 1), y(8, 1);
+
+      for (int k = 0; k < 11; k++)
+         x(k, 0) = B(k, 0);
+
+      SA.spmv(&x(0, 0), &y(0, 0));
+
+      if (SA.to_dense() != A || SB.to_csr().to_dense() != B ||
+          SA.transpose().to_dense() != A.transpose() ||
+          SA.get(i % 8, i % 11) != A(i % 8, i % 11) ||
+          SA * B != A * B || A.transpose() * SA != A.transpose() * A ||
+          (SA * SB).to_dense() != A * B || y != A * x)
+      {
+         cout << "[FAIL]\n";
+         cout << "Wrong sparse products for A:\n";
+         A.pretty_print();
+         return;
+      }
+
+      sparse_vmatrix N = SA.null_space();
+
+      if (SA.rank() != A.rank() || N.cols() != 11 - A.rank() ||
+          SA * N.to_dense() != vmatrix(8, N.cols()))
+      {
+         cout << "[FAIL]\n";
+         cout << "Wrong rank or null space for A:\n";
+         A.pretty_print();
+         return;
+      }
+
+      vmatrix S = vmatrix::random(6, 6, -9, 9, 0, 0.6);
+      sparse_lu<vmatrix::number_type> lu((sparse_vmatrix(S)));
+
+      vmatrix b(6, 1);
+
+      for (int k = 0; k < 6; k++)
+         b(k, 0) = B(k, 1);
+
+      if (lu.determinant() != S.determinant() ||
+          (!lu.is_singular() && S * lu.solve(b) != b))
+      {
+         cout << "[FAIL]\n";
+         cout << "Wrong sparse LU for S:\n";
+         S.pretty_print();
+         return;
+      }
+   }
+
+   /*
+    * A big arrow matrix: eliminating its dense first row and column first
+    * fills everything in, the Markowitz ordering must leave them last.
+    */
+   const int n = 20000;
+   vector<sparse_triplet<double>> t;
+
+   for (int k = 0; k < n; k++) {
+
+      t.push_back(sparse_triplet<double>{ k, k, 4.0 });
+
+      if (k > 0) {
+         t.push_back(sparse_triplet<double>{ 0, k, 1.0 });
+         t.push_back(sparse_triplet<double>{ k, 0, 1.0 });
+      }
+   }
+
+   sparse_matrix<double> M = sparse_matrix<double>::from_triplets(n, n, t);
+   sparse_lu<double> lu(M);
+   fast_vmatrix b(n, 1);
+
+   for (int k = 0; k < n; k++)
+      b(k, 0) = k % 7 - 3;
+
+   fast_vmatrix r = M * lu.solve(b) - b;
+
+   if (lu.factors_nnz() > 4 * n) {
+      cout << "[FAIL]\n";
+      cout << "Too much fill-in: " << lu.factors_nnz() << " elements\n";
+      return;
+   }
+
+   for (int k = 0; k < n; k++) {
+      if (fabs(r(k, 0)) > 1e-8) {
+         cout << "[FAIL]\n";
+         printf("Residual too big: %e\n", r(k, 0));
+         return;
+      }
+   }
+
+   cout << "[PASS]\n";
+}
+
+void testing_iterative_solvers()
+{
+   cout << "Solving systems with iterative methods... ";
+   cout.flush();
+
+   /*
+    * Convection-diffusion on a 60x60 grid: with c = 0 the matrix is the
+    * (symmetric positive definite) 5-point Laplacian, for CG.
+    */
+   const int m = 60, n = m * m;
+
+   auto grid = [m, n](double c) {
+
+      vector<sparse_triplet<double>> t;
+
+      for (int i = 0; i < m; i++) {
+         for (int j = 0; j < m; j++) {
+
+            const int k = i * m + j;
+            t.push_back(sparse_triplet<double>{ k, k, 4.0 });
+
+            if (i > 0)     t.push_back(sparse_triplet<double>{ k, k - m, -1.0 - c });
+            if (i < m - 1) t.push_back(sparse_triplet<double>{ k, k + m, -1.0 + c });
+            if (j > 0)     t.push_back(sparse_triplet<double>{ k, k - 1, -1.0 - c });
+            if (j < m - 1) t.push_back(sparse_triplet<double>{ k, k + 1, -1.0 + c });
+         }
+      }
+
+      return sparse_matrix<double>::from_triplets(n, n, t);
+   };
+
+   const sparse_matrix<double> L = grid(0.0);
+   const sparse_matrix<double> C = grid(0.4);
+   fast_vmatrix b(n, 1);
+
+   for (int k = 0; k < n; k++)
+      b(k, 0) = sin(k * 0.01) + 1.0;
+
+   iterative_options opts;
+   opts.tolerance = 1e-10;
+   opts.max_iterations = 2000;
+
+   struct {
+      const char *name;
+      const sparse_matrix<double> *a;
+      function<iterative_result(fast_vmatrix&)> solve;
+   } runs[] = {
+      { "CG", &L, [&](fast_vmatrix& x) { return conjugate_gradient(L, b, x, opts); } },
+      { "CG + Jacobi", &L, [&](fast_vmatrix& x) {
+         return conjugate_gradient(L, b, x, jacobi_preconditioner<double>(L), opts); } },
+      { "CG + ILU(0)", &L, [&](fast_vmatrix& x) {
+         return conjugate_gradient(L, b, x, ilu0_preconditioner<double>(L), opts); } },
+      { "GMRES", &C, [&](fast_vmatrix& x) { return gmres(C, b, x, opts); } },
+      { "GMRES + ILU(0)", &C, [&](fast_vmatrix& x) {
+         return gmres(C, b, x, ilu0_preconditioner<double>(C), opts); } },
+      { "BiCGSTAB", &C, [&](fast_vmatrix& x) { return bicgstab(C, b, x, opts); } },
+      { "BiCGSTAB + Jacobi", &C, [&](fast_vmatrix& x) {
+         return bicgstab(C, b, x, jacobi_preconditioner<double>(C), opts); } },
+   };
+
+   for (auto& run : runs) {
+
+      fast_vmatrix x(n, 1);
+      const iterative_result res = run.solve(x);
+      fast_vmatrix r = (*run.a) * x - b;
+      double rnorm = 0, bnorm = 0;
+
+      for (int k = 0; k < n; k++) {
+         rnorm += r(k, 0) * r(k, 0);
+         bnorm += b(k, 0) * b(k, 0);
+      }
+
+      if (!res.converged || sqrt(rnorm / bnorm) > 1e-9) {
+         cout << "[FAIL]\n";
+         printf("%s: converged = %d after %d iterations, residual %e\n",
+                run.name, res.converged, res.iterations, sqrt(rnorm / bnorm));
+         return;
+      }
+   }
+
+   // A rotation: BiCGSTAB breaks down at once and must leave x alone.
+   fast_vmatrix rot(2, 2), e1(2, 1), x0(2, 1);
+   rot(0, 1) = 1;
+   rot(1, 0) = -1;
+   e1(0, 0) = 1;
+
+   const iterative_result br = bicgstab(rot, e1, x0);
+
+   if (br.converged || br.residual != 1.0 || x0(0, 0) != 0 || x0(1, 0) != 0) {
+      cout << "[FAIL]\n";
+      printf("BiCGSTAB breakdown: converged = %d, residual %e, x = (%e, %e)\n",
+             br.converged, br.residual, x0(0, 0), x0(1, 0));
+      return;
+   }
+
+   // A dense, diagonally dominant system.
+   fast_vmatrix A = fast_vmatrix::random(150, 150, -1, 1, 3, 0.0);
+   fast_vmatrix d = fast_vmatrix::random(150, 1, -10, 10, 3, 0.0);
+   fast_vmatrix x(150, 1);
+
+   for (int k = 0; k < 150; k++)
+      A(k, k) += 200;
+
+   const iterative_result res = gmres(A, d, x, jacobi_preconditioner<double>(A));
+   fast_vmatrix R = A * x - d;
+
+   for (int k = 0; k < 150; k++) {
+      if (!res.converged || fabs(R(k, 0)) > 1e-8) {
+         cout << "[FAIL]\n";
+         printf("Dense GMRES: residual too big: %e\n", R(k, 0));
+         return;
+      }
+   }
+
+   cout << "[PASS]\n";
+}
+
+void testing_qr_factorization()
+{
+   cout << "Testing QR factorization and least squares... ";
+   cout.flush();
+
+   auto max_abs = [](const fast_vmatrix& M) {
+
+      double res = 0;
+
+      for (int i = 0; i < M.size(); i++)
+         res = max(res, fabs(M(i)));
+
+      return res;
+   };
+
+   // Bigger than a panel, to exercise the blocked algorithm.
+   fast_vmatrix A = fast_vmatrix::random(90, 70, -10, 10, 3, 0.1);
+   fast_vmatrix b = fast_vmatrix::random(90, 2, -10, 10, 3, 0.0);
+   qr_factorization<double> qr(A);
+   fast_vmatrix Q = qr.q();
+   fast_vmatrix FQ = qr.q(false);
+   fast_vmatrix I(70, 70), FI(90, 90);
+
+   I.make_identity();
+   FI.make_identity();
+
+   if (max_abs(Q * qr.r() - A) > 1e-10 || max_abs(FQ * qr.r(false) - A) > 1e-10 ||
+       max_abs(Q.transpose() * Q - I) > 1e-12 ||
+       max_abs(FQ.transpose() * FQ - FI) > 1e-12 || qr.rank() != 70)
+   {
+      cout << "[FAIL]\n";
+      cout << "Q*R != A or Q not orthogonal\n";
+      return;
+   }
+
+   // The least squares solution satisfies the normal equations.
+   fast_vmatrix x = qr.solve_least_squares(b);
+
+   if (max_abs(A.transpose() * (A * x - b)) > 1e-8) {
+      cout << "[FAIL]\n";
+      cout << "Least squares: A^T * (A*x - b) != 0\n";
+      return;
+   }
+
+   /*
+    * A rank 7 matrix, also scaled down to where a fixed epsilon would call
+    * everything zero.
+    */
+   fast_vmatrix X = fast_vmatrix::random(60, 7, -10, 10, 3, 0.0);
+   fast_vmatrix Y = fast_vmatrix::random(7, 40, -10, 10, 3, 0.0);
+   fast_vmatrix D = X * Y;
+   fast_vmatrix d = fast_vmatrix::random(60, 1, -10, 10, 3, 0.0);
+   fast_vmatrix small = D;
+
+   for (int i = 0; i < small.size(); i++)
+      small(i) *= 1e-14;
+
+   qr_factorization<double> pqr(D, qr_pivoting::columns);
+   fast_vmatrix DP(60, 40);
+
+   for (int i = 0; i < 60; i++)
+      for (int j = 0; j < 40; j++)
+         DP(i, j) = D(i, pqr.permutation()[j]);
+
+   if (pqr.rank() != 7 || D.rank() != 7 || small.rank() != 7 ||
+       max_abs(pqr.q() * pqr.r() - DP) > 1e-9)
+   {
+      cout << "[FAIL]\n";
+      cout << "Wrong rank or A*P != Q*R, rank: " << pqr.rank() << "\n";
+      return;
+   }
+
+   fast_vmatrix y = pqr.solve_least_squares(d);
+
+   if (max_abs(D.transpose() * (D * y - d)) > 1e-7) {
+      cout << "[FAIL]\n";
+      cout << "Rank-deficient least squares: D^T * (D*y - d) != 0\n";
+      return;
+   }
+
+   cout << "[PASS]\n";
+}
+
+void testing_cholesky_factorization()
+{
+   cout << "Testing Cholesky and LDL^T factorizations... ";
+   cout.flush();
+
+   for (int i = 0; i < 100; i++) {
+
+      vmatrix A = vmatrix::random(6, 6, -9, 9, 0, 0.3);
+      vmatrix B = vmatrix::random(6, 2, -9, 9, 0, 0.3);
+
+      // Symmetric, with the lower triangle of A.
+      for (int r = 0; r < 6; r++)
+         for (int c = r + 1; c < 6; c++)
+            A(r, c) = A(c, r);
+
+      ldlt_factorization<vmatrix::number_type> ldlt(A);
+
+      if (ldlt.has_zero_pivot())
+         continue;
+
+      const vmatrix L = ldlt.lower();
+
+      if (L * ldlt.diagonal() * L.transpose() != A ||
+          ldlt.determinant() != A.determinant() ||
+          A * ldlt.solve_many(B) != B)
+      {
+         cout << "[FAIL]\n";
+         cout << "Wrong LDL^T for A:\n";
+         A.pretty_print();
+         return;
+      }
+   }
+
+   // Positive definite: X * X^T + n * I, bigger than a few blocks.
+   const int n = 300;
+   fast_vmatrix X = fast_vmatrix::random(n, n, -1, 1, 3, 0.0);
+   fast_vmatrix S = X * X.transpose();
+   fast_vmatrix b = fast_vmatrix::random(n, 3, -10, 10, 3, 0.0);
+
+   for (int k = 0; k < n; k++)
+      S(k, k) += n;
+
+   cholesky_factorization<double> chol(S);
+   ldlt_factorization<double> ldlt(S);
+
+   // A smaller one for the determinant, which would overflow.
+   fast_vmatrix X2 = X.block(0, 0, 40, 40);
+   fast_vmatrix S2 = X2 * X2.transpose();
+
+   for (int k = 0; k < 40; k++)
+      S2(k, k) += 1;
+
+   lu_factorization<double> lu(S2);
+
+   fast_vmatrix L = chol.lower();
+   fast_vmatrix R1 = L * L.transpose() - S;
+   fast_vmatrix R2 = S * chol.solve_many(b) - b;
+   fast_vmatrix R3 = S * ldlt.solve_many(b) - b;
+   double maxErr = 0;
+
+   for (int k = 0; k < R1.size(); k++)
+      maxErr = max(maxErr, fabs(R1(k)));
+
+   for (int k = 0; k < R2.size(); k++)
+      maxErr = max(maxErr, max(fabs(R2(k)), fabs(R3(k))));
+
+   if (!chol.is_positive_definite() || maxErr > 1e-8 ||
+       fabs(cholesky_factorization<double>(S2).determinant() / lu.determinant() - 1) > 1e-9)
+   {
+      cout << "[FAIL]\n";
+      printf("Cholesky: error %e\n", maxErr);
+      return;
+   }
+
+   S(n / 2, n / 2) = -1;
+
+   if (cholesky_factorization<double>(S).is_positive_definite()) {
+      cout << "[FAIL]\n";
+      cout << "Indefinite matrix taken for positive definite\n";
+      return;
+   }
+
+   cout << "[PASS]\n";
+}
+
+void testing_spectral_decomposition()
+{
+   cout << "Testing eigenvalues and singular values... ";
+   cout.flush();
+
+   auto max_abs = [](const fast_vmatrix& M) {
+
+      double res = 0;
+
+      for (int i = 0; i < M.size(); i++)
+         res = max(res, fabs(M(i)));
+
+      return res;
+   };
+
+   auto diag = [](const vector<double>& d) {
+
+      fast_vmatrix D(static_cast<int>(d.size()), static_cast<int>(d.size()));
+
+      for (int i = 0; i < D.rows(); i++)
+         D(i, i) = d[i];
+
+      return D;
+   };
+
+   const int n = 50;
+   fast_vmatrix A = fast_vmatrix::random(n, n, -10, 10, 3, 0.2);
+   fast_vmatrix I(n, n);
+
+   I.make_identity();
+
+   for (int r = 0; r < n; r++)
+      for (int c = r + 1; c < n; c++)
+         A(r, c) = A(c, r);
+
+   symmetric_eigen_decomposition<double> eig(A);
+   symmetric_eigen_decomposition<double> eigValues(A, spectral_output::values);
+   fast_vmatrix V = eig.vectors();
+
+   if (max_abs(A * V - V * diag(eig.values())) > 1e-9 ||
+       max_abs(V.transpose() * V - I) > 1e-12 ||
+       !is_sorted(eig.values().begin(), eig.values().end()) ||
+       eigValues.has_vectors() ||
+       max_abs(diag(eig.values()) - diag(eigValues.values())) > 1e-10)
+   {
+      cout << "[FAIL]\n";
+      cout << "A*V != V*D or V not orthogonal\n";
+      return;
+   }
+
+   // Tall and wide, the latter of rank 7.
+   fast_vmatrix T = fast_vmatrix::random(70, 30, -10, 10, 3, 0.1);
+   fast_vmatrix W = fast_vmatrix::random(20, 7, -10, 10, 3, 0.0) *
+                    fast_vmatrix::random(7, 45, -10, 10, 3, 0.0);
+
+   for (const fast_vmatrix *M : { &T, &W }) {
+
+      svd_decomposition<double> svd(*M);
+      svd_decomposition<double> svdValues(*M, spectral_output::values);
+      const int k = min(M->rows(), M->cols());
+      fast_vmatrix Ik(k, k);
+
+      Ik.make_identity();
+
+      if (max_abs(svd.u() * diag(svd.values()) * svd.v().transpose() - *M) > 1e-9 ||
+          max_abs(svd.v().transpose() * svd.v() - Ik) > 1e-12 ||
+          max_abs(diag(svd.values()) - diag(svdValues.values())) > 1e-9 ||
+          svd.rank() != M->rank() ||
+          !is_sorted(svd.values().rbegin(), svd.values().rend()))
+      {
+         cout << "[FAIL]\n";
+         cout << "Wrong SVD of a " << M->rows() << "x" << M->cols() << " matrix\n";
+         return;
+      }
+   }
+
+   // The singular values of A are the square roots of the eigenvalues of A^T*A.
+   svd_decomposition<double> svd(T, spectral_output::values);
+   symmetric_eigen_decomposition<double> ata(T.transpose() * T, spectral_output::values);
+
+   for (int i = 0; i < 30; i++) {
+      const double s = svd.values()[i];
+      if (fabs(s * s - ata.values()[29 - i]) > 1e-8 * s * s) {
+         cout << "[FAIL]\n";
+         cout << "Singular values don't match the eigenvalues of A^T*A\n";
+         return;
+      }
+   }
+
+   cout << "[PASS]\n";
+}
+
+void testing_packed_matrices()
+{
+   cout << "Testing packed triangular and symmetric matrices... ";
+   cout.flush();
+
+   for (int i = 0; i < 100; i++) {
+
+      vmatrix A = vmatrix::random(7, 7, -9, 9, 0, 0.2);
+      vmatrix A2 = vmatrix::random(7, 7, -9, 9, 0, 0.2);
+      vmatrix B = vmatrix::random(7, 3, -9, 9, 0, 0.3);
+
+      for (triangle t : { triangle::lower, triangle::upper }) {
+
+         triangular_matrix<vmatrix::number_type> T(A, t), T2(A2, t);
+         vmatrix D = T.to_dense();
+         vmatrix D2 = T2.to_dense();
+
+         const bool shape = t == triangle::lower ? D.is_lower_triangular()
+                                                 : D.is_upper_triangular();
+
+         if (!shape || T.determinant() != D.determinant() ||
+             T * B != D * B || (T * T2).to_dense() != D * D2 ||
+             T(i % 7, 3) != D(i % 7, 3) ||
+             (T.determinant() != 0 && D * T.solve(B) != B))
+         {
+            cout << "[FAIL]\n";
+            cout << "Wrong triangular matrix from A:\n";
+            A.pretty_print();
+            return;
+         }
+      }
+
+      symmetric_matrix<vmatrix::number_type> S(A);
+      vmatrix SD = S.to_dense();
+
+      if (SD != SD.transpose() || S * B != SD * B ||
+          S(i % 7, 2) != A(max(i % 7, 2), min(i % 7, 2)))
+      {
+         cout << "[FAIL]\n";
+         cout << "Wrong symmetric matrix from A:\n";
+         A.pretty_print();
+         return;
+      }
+   }
+
+   // Half the memory, plus the diagonal.
+   triangular_matrix<double> L(1000, triangle::lower);
+
+   if (L.memory_bytes() > sizeof(L) + 1000 * 1001 / 2 * sizeof(double)) {
+      cout << "[FAIL]\n";
+      cout << "Triangular matrix not packed: " << L.memory_bytes() << " bytes\n";
+      return;
+   }
+
+   // A diagonal of 0.5: the determinant underflows, the system is fine.
+   const int n = 1200;
+   triangular_matrix<double> L2(n, triangle::lower);
+   fast_vmatrix x(n, 1), b(n, 1);
+
+   for (int i = 0; i < n; i++) {
+
+      L2.set(i, i, 0.5);
+
+      if (i)
+         L2.set(i, i - 1, 0.25);
+
+      x(i, 0) = i % 7 - 3;
+   }
+
+   b = L2 * x;
+   const fast_vmatrix diff = L2.solve(b) - x;
+
+   for (int i = 0; i < n; i++) {
+      if (fabs(diff(i, 0)) > 1e-9) {
+         cout << "[FAIL]\n";
+         cout << "Wrong solution of a large double system\n";
+         return;
+      }
+   }
+
+   triangular_matrix<double> singular = L2;
+   singular.set(n / 2, n / 2, 0.0);
+
+   try {
+      singular.solve(b);
+      cout << "[FAIL]\n";
+      cout << "A singular system must be rejected\n";
+      return;
+   } catch (const runtime_error&) { }
+
+   cout << "[PASS]\n";
+}
+
+void testing_transpose()
+{
+   cout << "Testing blocked and in-place transposes... ";
+   cout.flush();
+
+   const int shapes[][2] = {
+      { 1, 1 }, { 1, 9 }, { 9, 1 }, { 3, 5 }, { 37, 53 }, { 64, 64 },
+      { 100, 3 }, { 129, 257 }, { 300, 300 }, { 2, 1000 }
+   };
+
+   for (const auto& s : shapes) {
+
+      fast_vmatrix A = fast_vmatrix::random(s[0], s[1], -10, 10, 3, 0.0);
+      fast_vmatrix E(s[1], s[0]);
+
+      for (int i = 0; i < s[0]; i++)
+         for (int j = 0; j < s[1]; j++)
+            E(j, i) = A(i, j);
+
+      fast_vmatrix T = A.transpose();
+      fast_vmatrix M = fast_vmatrix(A).transpose();
+      fast_vmatrix P = A;
+
+      P.in_place_transpose();
+
+      if (T != E || M != E || P != E || P.rows() != s[1]) {
+         cout << "[FAIL]\n";
+         cout << "Wrong transpose of a " << s[0] << "x" << s[1] << " matrix\n";
+         return;
+      }
+   }
+
+   vmatrix V = vmatrix::random(7, 4, -9, 9, 1, 0.2);
+   vmatrix W = V;
+
+   W.in_place_transpose();
+
+   if (W != V.transpose() || vmatrix(V).transpose() != V.transpose()) {
+      cout << "[FAIL]\n";
+      cout << "Wrong transpose of V:\n";
+      V.pretty_print();
+      return;
+   }
+
+   cout << "[PASS]\n";
+}
+
+void testing_in_place_mul()
+{
+   cout << "Testing in-place products against operator*... ";
+   cout.flush();
+
+   // Heights below, at and above a stripe, widths around the tile sizes.
+   const int shapes[][2] = {
+      { 1, 1 }, { 5, 3 }, { 96, 40 }, { 97, 64 }, { 250, 33 }, { 130, 130 }
+   };
+
+   for (const auto& s : shapes) {
+
+      fast_vmatrix A = fast_vmatrix::random(s[0], s[1], -10, 10, 3, 0.1);
+      fast_vmatrix B = fast_vmatrix::random(s[1], s[1], -10, 10, 3, 0.1);
+      fast_vmatrix E = A * B;
+
+      A.in_place_mul(B);
+
+      if (A.rows() != E.rows() || A.cols() != E.cols()) {
+         cout << "[FAIL]\n";
+         cout << "Wrong size of an in-place product\n";
+         return;
+      }
+
+      for (int i = 0; i < E.size(); i++) {
+
+         if (fabs(A(i) - E(i)) > 1e-9 * (1 + fabs(E(i)))) {
+            cout << "[FAIL]\n";
+            cout << "Wrong in-place product of a " << s[0] << "x" << s[1] << " matrix\n";
+            return;
+         }
+      }
+   }
+
+   vmatrix V = vmatrix::random(7, 4, -9, 9, 1, 0.2);
+   vmatrix W = vmatrix::random(4, 4, -9, 9, 1, 0.2);
+   vmatrix P = V;
+   vmatrix Q = W;
+
+   P.in_place_mul(W);
+   Q.in_place_mul(Q);
+
+   if (P != V * W || Q != W * W) {
+      cout << "[FAIL]\n";
+      cout << "Wrong in-place product of V:\n";
+      V.pretty_print();
+      return;
+   }
+
+   try {
+      P.in_place_mul(V);
+      cout << "[FAIL]\n";
+      cout << "A non-square right operand must be rejected\n";
+      return;
+   } catch (const domain_error&) { }
+
+   cout << "[PASS]\n";
+}
+
+void testing_random_generation()
+{
+   cout << "Testing seeded and structured random matrices... ";
+   cout.flush();
+
+   // Known answers of Philox4x32-10, from the Random123 distribution.
+   const philox_block kat[][3] = {
+      { { { 0, 0, 0, 0 } }, { { 0, 0 } },
+        { { 0x6627e8d5, 0xe169c58d, 0xbc57ac4c, 0x9b00dbd8 } } },
+      { { { 0xffffffff, 0xffffffff, 0xffffffff, 0xffffffff } },
+        { { 0xffffffff, 0xffffffff } },
+        { { 0x408f276d, 0x41c83b0e, 0xa20bc7c6, 0x6d5451fd } } },
+      { { { 0x243f6a88, 0x85a308d3, 0x13198a2e, 0x03707344 } },
+        { { 0xa4093822, 0x299f31d0 } },
+        { { 0xd16cfe09, 0x94fdcceb, 0x5001e420, 0x24126ea1 } } }
+   };
+
+   for (const auto& k : kat) {
+
+      const philox_block r = philox4x32_10(k[0], k[1].v[0], k[1].v[1]);
+
+      if (memcmp(r.v, k[2].v, sizeof(r.v))) {
+         cout << "[FAIL]\n";
+         cout << "Wrong Philox block: " << hex << r.v[0] << dec << "\n";
+         return;
+      }
+   }
+
+   philox_engine e1(7, 3), e2(7, 3);
+
+   for (int i = 0; i < 11; i++)
+      e1();
+
+   e2.discard(11);
+
+   if (e1() != e2() || e1() != e2()) {
+      cout << "[FAIL]\n";
+      cout << "discard() doesn't skip the right count of numbers\n";
+      return;
+   }
+
+   const fast_vmatrix R1 = fast_vmatrix::random(300, 200, -10, 10, 3, 0.2, 42);
+   const vmatrix V1 = vmatrix::random(9, 7, -9, 9, 1, 0.2, 42);
+
+   mt19937 m1(5), m2(5);
+
+   const int threads = get_num_threads();
+   set_num_threads(1);
+
+   const bool repeatable =
+      R1 == fast_vmatrix::random(300, 200, -10, 10, 3, 0.2, 42) &&
+      V1 == vmatrix::random(9, 7, -9, 9, 1, 0.2, 42) &&
+      fast_vmatrix::random(5, 5, -10, 10, 3, 0.2, m1) ==
+      fast_vmatrix::random(5, 5, -10, 10, 3, 0.2, m2);
+
+   set_num_threads(threads);
+
+   if (!repeatable || R1 == fast_vmatrix::random(300, 200, -10, 10, 3, 0.2, 43)) {
+      cout << "[FAIL]\n";
+      cout << "The same seed must give the same matrix, another seed another one\n";
+      return;
+   }
+
+   const fast_vmatrix G = random_gaussian_matrix<double>(200, 200, 1, 2.0, 3.0);
+   double mean = 0, var = 0;
+
+   for (int i = 0; i < G.size(); i++)
+      mean += G(i) / G.size();
+
+   for (int i = 0; i < G.size(); i++)
+      var += (G(i) - mean) * (G(i) - mean) / G.size();
+
+   if (fabs(mean - 2.0) > 0.05 || fabs(var - 9.0) > 0.3) {
+      cout << "[FAIL]\n";
+      cout << "Gaussian matrix with mean " << mean << " and variance " << var << "\n";
+      return;
+   }
+
+   const fast_vmatrix S = random_spd_matrix<double>(150, 2);
+
+   if (S != S.transpose() || !cholesky_factorization<double>(S).is_positive_definite()) {
+      cout << "[FAIL]\n";
+      cout << "The SPD matrix is not symmetric positive definite\n";
+      return;
+   }
+
+   // Any number type, with no order needed: the diagonal is the same.
+   const vmatrix VS = random_spd_matrix<vmatrix::number_type>(150, 2);
+
+   for (int i = 0; i < S.rows(); i++) {
+      if (fabsl(to_float(real_part(VS(i, i))) - S(i, i)) > 1e-5 || VS(i, 0) != VS(0, i)) {
+         cout << "[FAIL]\n";
+         cout << "Different SPD matrix for vmatrix\n";
+         return;
+      }
+   }
+
+   const fast_vmatrix B = random_banded_matrix<double>(60, 50, 2, 3, 3);
+
+   for (int i = 0; i < B.rows(); i++) {
+      for (int j = 0; j < B.cols(); j++) {
+
+         if ((j < i - 2 || j > i + 3) != (B(i, j) == 0)) {
+            cout << "[FAIL]\n";
+            cout << "Wrong band at (" << i << ", " << j << ")\n";
+            return;
+         }
+      }
+   }
+
+   if (random_low_rank_matrix<double>(80, 60, 7, 4).rank() != 7) {
+      cout << "[FAIL]\n";
+      cout << "The low-rank matrix has the wrong rank\n";
+      return;
+   }
+
+   const fast_vmatrix P = fast_vmatrix::random(40, 30, -1, 1, 0, 0.7, 5);
+   const fast_vmatrix D = random_with_pattern<double>(P, 6);
+   const sparse_matrix<double> SP = random_with_pattern(sparse_matrix<double>(P), 6);
+
+   for (int i = 0; i < P.size(); i++) {
+
+      if ((P(i) == 0) != (D(i) == 0)) {
+         cout << "[FAIL]\n";
+         cout << "The dense pattern is not followed\n";
+         return;
+      }
+   }
+
+   if (SP.indices() != sparse_matrix<double>(P).indices() ||
+       sparse_matrix<double>(SP.to_dense()).nnz() != SP.nnz())
+   {
+      cout << "[FAIL]\n";
+      cout << "The sparse pattern is not followed\n";
+      return;
+   }
+
+   cout << "[PASS]\n";
+}
+
+void testing_matrix_files()
+{
+   cout << "Testing binary and memory-mapped matrix files... ";
+   cout.flush();
+
+   const char *path = "vmatrixlib_test.bin";
+   const fast_vmatrix A = fast_vmatrix::random(37, 23, -10, 10, 3, 0.1, 11);
+
+   write_matrix_file(path, A);
+
+   if (read_matrix_file<double>(path) != A) {
+      cout << "[FAIL]\n";
+      cout << "Wrong matrix read back from a file\n";
+      return;
+   }
+
+   // Column major, from a block.
+   write_matrix_file(path, A.block(3, 2, 20, 15), matrix_layout::col_major);
+
+   {
+      const mapped_matrix_file<double> mapped(path);
+      const fast_vmatrix B = read_matrix_file<double>(path);
+
+      if (mapped.layout() != matrix_layout::col_major ||
+          fast_vmatrix(mapped.view()) != fast_vmatrix(A.block(3, 2, 20, 15)) ||
+          B != fast_vmatrix(A.block(3, 2, 20, 15)))
+      {
+         cout << "[FAIL]\n";
+         cout << "Wrong column major matrix file\n";
+         return;
+      }
+   }
+
+   // Written through the mapping, then read back.
+   {
+      mapped_matrix_file<int32_t> created =
+         mapped_matrix_file<int32_t>::create(path, 50, 40);
+      matrix_view<int32_t> v = created.mutable_view();
+
+      for (int i = 0; i < v.rows(); i++)
+         for (int j = 0; j < v.cols(); j++)
+            v(i, j) = i * 1000 + j;
+
+      created.flush();
+   }
+
+   const matrix<int32_t> I = read_matrix_file<int32_t>(path);
+
+   if (I.rows() != 50 || I.cols() != 40 || I(49, 39) != 49039 || I(7, 3) != 7003) {
+      cout << "[FAIL]\n";
+      cout << "Wrong matrix written through a mapping\n";
+      return;
+   }
+
+   int rejected = 0;
+
+   try {
+      read_matrix_file<double>(path);
+   } catch (const runtime_error&) {
+      rejected++;
+   }
+
+   try {
+      mapped_matrix_file<int32_t> readOnly(path);
+      readOnly.mutable_view();
+   } catch (const runtime_error&) {
+      rejected++;
+   }
+
+   // A corrupted data offset, which would wrap around the end of the file.
+   {
+      matrix_file_header h;
+      FILE *f = fopen(path, "r+b");
+
+      if (fread(&h, sizeof(h), 1, f) == 1) {
+         h.data_offset = 0xFFFFFFFFFFFFFFF0ULL;
+         fseek(f, 0, SEEK_SET);
+         fwrite(&h, sizeof(h), 1, f);
+      }
+
+      fclose(f);
+   }
+
+   try {
+      mapped_matrix_file<int32_t> corrupted(path);
+   } catch (const runtime_error&) {
+      rejected++;
+   }
+
+   remove(path);
+
+   if (rejected != 3) {
+      cout << "[FAIL]\n";
+      cout << "A wrong element type, a read-only mapping or a corrupted header must be rejected\n";
+      return;
+   }
+
+   cout << "[PASS]\n";
+}
+
+void testing_text_writers()
+{
+   cout << "Testing streaming text writers... ";
+   cout.flush();
+
+   fast_vmatrix A = fast_vmatrix::random(30, 20, -1000, 1000, 6, 0.1, 8);
+   A(0, 0) = 1.0 / 3;
+   A(1, 1) = -2.5e-300;
+   A(2, 2) = 6.02214076e23;
+
+   // CSV doubles read back exactly.
+   ostringstream csv;
+   {
+      text_writer w(csv);
+      write_csv(w, A);
+   }
+
+   istringstream in(csv.str());
+   string line;
+
+   for (int i = 0; i < A.rows(); i++) {
+
+      getline(in, line);
+      const char *p = line.c_str();
+
+      for (int j = 0; j < A.cols(); j++) {
+
+         char *end;
+
+         if (strtod(p, &end) != A(i, j) || (*end != ',' && *end != 0)) {
+            cout << "[FAIL]\n";
+            cout << "CSV element (" << i << ", " << j << ") doesn't read back: " << line << "\n";
+            return;
+         }
+
+         p = end + 1;
+      }
+   }
+
+   // The same text through an ostream or a buffer.
+   vector<char> buf(1 << 16);
+   ostringstream pretty;
+   {
+      text_writer w(pretty);
+      write_pretty(w, A, 4);
+   }
+   {
+      text_writer w(buf.data(), buf.size());
+      write_pretty(w, A, 4);
+      w.flush();
+
+      if (w.truncated() || pretty.str() != buf.data()) {
+         cout << "[FAIL]\n";
+         cout << "Different text in a buffer and in an ostream\n";
+         return;
+      }
+   }
+
+   typedef frac<int32_t, double> fr;
+   matrix<fr> F(2, 2);
+   F(0, 0) = fr(1, 3);
+   F(0, 1) = fr(-6, 4);
+   F(1, 0) = fr(7, 1);
+   char small[32];
+   {
+      text_writer w(small, sizeof(small));
+      write_mathematica(w, F);
+      w.flush();
+
+      if (w.truncated() || string(small) != "{{1/3,-3/2},\n{7,0}}\n") {
+         cout << "[FAIL]\n";
+         cout << "Wrong text for fractions: " << small << "\n";
+         return;
+      }
+   }
+   {
+      text_writer w(small, 8);
+      write_matlab(w, A);
+      w.flush();
+
+      if (!w.truncated() || strlen(small) != 7) {
+         cout << "[FAIL]\n";
+         cout << "The text must be truncated to the buffer\n";
+         return;
+      }
+   }
+   {
+      // Nothing to write into: buf is never touched.
+      small[0] = 'x';
+      text_writer w(small, 0), wn(nullptr, 0);
+      write_matlab(w, A);
+      write_matlab(wn, A);
+      w.flush();
+      wn.flush();
+
+      if (!w.truncated() || !wn.truncated() || w.written() || small[0] != 'x') {
+         cout << "[FAIL]\n";
+         cout << "A zero-size buffer must not be written\n";
+         return;
+      }
+   }
+
+   // Complex fractions, formatted in place, as their to_string().
+   typedef frac<long long, long double> lfr;
+   typedef vmatrix::number_type cf;
+
+   vmatrix C(3, 3);
+   C(0, 0) = cf(lfr(1LL, 3LL), lfr(-2LL, 1LL));
+   C(0, 1) = cf(lfr(0LL, 1LL), lfr(-1LL, 1LL));
+   C(0, 2) = cf(lfr(1LL, 4LL), lfr(1LL, 1LL));
+   C(1, 0) = cf(lfr(1LL, 3LL), lfr(-1LL, 2LL));
+   C(1, 1) = cf(lfr(-7LL, 1LL), lfr(-1LL, 1LL));
+   C(1, 2) = cf(lfr(0LL, 1LL), lfr(5LL, 4LL));
+   C(2, 0) = cf(lfr(7LL, 1LL));
+   C(2, 1) = cf(lfr(0LL, 1LL), lfr(3LL, 1LL));
+
+   for (int i = 0; i < C.rows(); i++) {
+      for (int j = 0; j < C.cols(); j++) {
+
+         ostringstream s;
+         {
+            text_writer w(s);
+            write_element(w, C(i, j), 6);
+         }
+
+         if (s.str() != to_string(C(i, j), 6)) {
+            cout << "[FAIL]\n";
+            cout << "Complex element written as " << s.str()
+                 << " instead of " << to_string(C(i, j), 6) << "\n";
+            return;
+         }
+      }
+   }
+
+   ostringstream ccsv;
+   {
+      text_writer w(ccsv);
+      write_csv(w, C);
+   }
+
+   if (ccsv.str().compare(0, 16, "1/3-2i,-i,1/4+i\n") || read_csv<cf>(ccsv.str()) != C) {
+      cout << "[FAIL]\n";
+      cout << "Complex fractions don't read back from CSV:\n" << ccsv.str();
+      return;
+   }
+
+   cout << "[PASS]\n";
+}
+
+void testing_text_parsers()
+{
+   cout << "Testing text parsers... ";
+   cout.flush();
+
+   // Large enough for the rows to be parsed in parallel.
+   fast_vmatrix A = fast_vmatrix::random(3000, 40, -1000, 1000, 6, 0.1, 9);
+   A(0, 0) = 1.0 / 3;
+   A(1, 1) = -2.5e-300;
+   A(2, 2) = 6.02214076e23;
+
+   ostringstream csv;
+   {
+      text_writer w(csv);
+      write_csv(w, A);
+   }
+
+   if (read_csv<double>(csv.str()) != A) {
+      cout << "[FAIL]\n";
+      cout << "CSV doubles don't read back exactly\n";
+      return;
+   }
+
+   const char *path = "vmatrixlib_test.csv";
+   FILE *f = fopen(path, "wb");
+   {
+      text_writer w(f);
+      write_csv(w, A);
+   }
+   fclose(f);
+
+   const fast_vmatrix B = read_csv_file<double>(path);
+   remove(path);
+
+   if (B != A) {
+      cout << "[FAIL]\n";
+      cout << "A mapped CSV file doesn't read back exactly\n";
+      return;
+   }
+
+   typedef frac<long long, long double> fr;
+   typedef vmatrix::number_type cf;
+
+   vmatrix C(3, 3);
+   C(0, 0) = cf(fr(1LL, 3LL), fr(2LL, 1LL));
+   C(0, 1) = cf(fr(0LL, 1LL), fr(-1LL, 1LL));
+   C(0, 2) = cf(fr(0LL, 1LL), fr(1LL, 2LL));
+   C(1, 0) = cf(fr(1LL, 3LL), fr(-1LL, 2LL));
+   C(1, 1) = cf(fr(-7LL, 1LL), fr(1LL, 1LL));
+   C(1, 2) = cf(fr(5LL, 4LL));
+   C(2, 0) = cf(fr(0LL, 1LL), fr(-3LL, 2LL));
+
+   ostringstream mathematica;
+   {
+      text_writer w(mathematica);
+      write_mathematica(w, C);
+   }
+
+   if (read_mathematica<cf>(mathematica.str()) != C) {
+      cout << "[FAIL]\n";
+      cout << "Complex fractions don't read back:\n" << mathematica.str();
+      return;
+   }
+
+   const matrix<fr> D = read_matlab<fr>("[1 -3/2, 0.25;\n 4e3  7/21 -0]");
+   const fr expected[] = { fr(1LL, 1LL), fr(-3LL, 2LL), fr(1LL, 4LL),
+                           fr(4000LL, 1LL), fr(1LL, 3LL), fr(0LL, 1LL) };
+
+   if (D.rows() != 2 || D.cols() != 3 || !equal(expected, expected + 6, &D(0, 0))) {
+      cout << "[FAIL]\n";
+      cout << "Wrong Matlab fractions\n";
+      return;
+   }
+
+   // Decimals aren't rounded: exact if they fit, the value read otherwise.
+   const matrix<fr> E = read_csv<fr>("1.5E-09,3.14159265358979,0.1234567890123456789012\n");
+   const long double pi = 3.14159265358979L;
+   const long double longDec = strtold("0.1234567890123456789012", nullptr);
+
+   if (E(0, 0).is_using_fp() || E(0, 0) != fr(3LL, 2000000000LL) ||
+       E(0, 1).is_using_fp() || fabsl(to_float(E(0, 1)) - pi) > 1e-17L ||
+       !E(0, 2).is_using_fp() || to_float(E(0, 2)) != longDec) {
+      cout << "[FAIL]\n";
+      cout << "Wrong decimal fractions: " << to_string(E(0, 0)) << " "
+           << to_string(E(0, 1), 15) << " " << to_string(E(0, 2), 20) << "\n";
+      return;
+   }
+
+   if (read_csv<bigfrac>("1.5e-9,-0.125")(0, 0) != bigfrac(bigint(3), bigint(2000000000)) ||
+       read_csv<bigfrac>("1.5e-9,-0.125")(0, 1) != bigfrac(bigint(-1), bigint(8))) {
+      cout << "[FAIL]\n";
+      cout << "Wrong decimal bigfracs\n";
+      return;
+   }
+
+   // Complex values with floating point parts keep both.
+   const cf tiny = read_csv<cf>("1.500E-09-22500000000000i")(0, 0);
+
+   if (fabsl(to_float(tiny.real_part()) - 1.5e-9L) > 1e-24L ||
+       to_float(tiny.imag_part()) != -2.25e13L) {
+      cout << "[FAIL]\n";
+      cout << "Wrong complex decimal: " << to_string(tiny) << "\n";
+      return;
+   }
+
+   vmatrix G(1, 2);
+   G(0, 0) = cf(fr::make_dec_frac(1.0L / 3), fr::make_dec_frac(-2.5e-30L));
+   G(0, 1) = cf(fr(1LL, 7LL), fr::make_dec_frac(6.02214076e23L));
+
+   ostringstream gcsv;
+   {
+      text_writer w(gcsv);
+      write_csv(w, G);
+   }
+
+   if (read_csv<cf>(gcsv.str()) != G) {
+      cout << "[FAIL]\n";
+      cout << "Complex floating point parts don't read back from CSV: " << gcsv.str();
+      return;
+   }
+
+   const char *bad[] = { "[1 2; 3]", "[1 2; 3 x]", "[1 2", "{{1,2},{3,4}", "{{1,2}{3,4}}" };
+   int rejected = 0;
+
+   for (const char *text : bad) {
+      try {
+         if (text[0] == '[')
+            read_matlab<double>(text);
+         else
+            read_mathematica<double>(text);
+      } catch (const runtime_error&) {
+         rejected++;
+      }
+   }
+
+   if (rejected != 5 || read_mathematica<double>(" {}\n").size() != 0) {
+      cout << "[FAIL]\n";
+      cout << "Malformed text must be rejected\n";
+      return;
+   }
+
    cout << "[PASS]\n";
 }
 
@@ -117,8 +2034,31 @@ int main(int argc, char ** argv) {
    //m.print_matlab_style();
 
    testing_float_to_frac();
+   testing_frac_arithmetic();
    testing_triang_matrix();
    testing_inv_matrix();
+   testing_matrix_product();
+   testing_parallel_ops();
+   testing_lu_factorization();
+   testing_matrix_expressions();
+   testing_matrix_views();
+   testing_allocation_free_chains();
+   testing_bigfrac();
+   testing_fraction_free_elimination();
+   testing_compact_matrix();
+   testing_real_only_kernels();
+   testing_sparse_matrix();
+   testing_iterative_solvers();
+   testing_qr_factorization();
+   testing_cholesky_factorization();
+   testing_spectral_decomposition();
+   testing_packed_matrices();
+   testing_transpose();
+   testing_in_place_mul();
+   testing_random_generation();
+   testing_matrix_files();
+   testing_text_writers();
+   testing_text_parsers();
 
    //getchar();
    return 0;
@@ -0,0 +1,331 @@
+
+#pragma once
+
+#include <cstdlib>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <exception>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include <condition_variable>
+
+namespace vmatrixlib {
+
+/*
+ * A small work-stealing thread pool owned by the library.
+ *
+ * Every worker has its own task deque: it pops from the back of its own
+ * deque and, when that is empty, steals from the front of the others.
+ * The thread calling parallel_for() does not sit idle either: it steals
+ * tasks until its own job is complete, which also makes nested
+ * parallel_for() calls (from inside a task) safe.
+ *
+ * The number of threads of the global pool defaults to the number of
+ * hardware threads and can be overridden with the VMATRIXLIB_NUM_THREADS
+ * environment variable or, at runtime, with set_num_threads().
+ */
+
+class thread_pool {
+
+public:
+
+   typedef std::function<void()> task;
+
+   explicit thread_pool(int threads);
+   ~thread_pool();
+
+   thread_pool(const thread_pool&) = delete;
+   thread_pool& operator=(const thread_pool&) = delete;
+
+   // Number of threads working on a parallel_for(), the caller included.
+   int size() const { return static_cast<int>(_workers.size()) + 1; }
+
+   /*
+    * Calls fn(b, e) on disjoint sub-ranges [b, e) covering [begin, end),
+    * each one (except possibly the last) at least 'grain' long, and
+    * returns when all of them have completed. If some fn() throws, the
+    * others still run to completion, then the first exception is rethrown.
+    */
+   template <class F>
+   void parallel_for(int begin, int end, int grain, F&& fn);
+
+   static int default_thread_count();
+
+private:
+
+   struct queue {
+      std::mutex lock;
+      std::deque<task> tasks;
+   };
+
+   struct job {
+      std::atomic<int> pending;
+      std::mutex lock;
+      std::condition_variable done;
+      std::exception_ptr error;
+   };
+
+   std::vector<std::thread> _workers;
+   std::vector<std::unique_ptr<queue>> _queues;
+
+   std::mutex _sleep_lock;
+   std::condition_variable _wakeup;
+   std::atomic<int> _queued;
+   std::atomic<unsigned> _next_queue;
+   bool _stopping;
+
+   bool try_pop(int q, task& t);
+   bool try_steal(int self, task& t);
+   void push(task t);
+   void worker_loop(int id);
+};
+
+
+inline thread_pool::thread_pool(int threads)
+   : _queued(0), _next_queue(0), _stopping(false)
+{
+   const int workers = std::max(0, threads - 1);
+
+   for (int i = 0; i < workers; i++)
+      _queues.emplace_back(new queue);
+
+   for (int i = 0; i < workers; i++)
+      _workers.emplace_back(&thread_pool::worker_loop, this, i);
+}
+
+inline thread_pool::~thread_pool()
+{
+   {
+      std::lock_guard<std::mutex> guard(_sleep_lock);
+      _stopping = true;
+   }
+
+   _wakeup.notify_all();
+
+   for (auto& w : _workers)
+      w.join();
+}
+
+inline int thread_pool::default_thread_count()
+{
+   const char *env = std::getenv("VMATRIXLIB_NUM_THREADS");
+
+   if (env) {
+
+      const int n = atoi(env);
+
+      if (n > 0)
+         return n;
+   }
+
+   return std::max(1u, std::thread::hardware_concurrency());
+}
+
+inline bool thread_pool::try_pop(int q, task& t)
+{
+   queue& qu = *_queues[q];
+   std::lock_guard<std::mutex> guard(qu.lock);
+
+   if (qu.tasks.empty())
+      return false;
+
+   t = std::move(qu.tasks.back());
+   qu.tasks.pop_back();
+   _queued--;
+   return true;
+}
+
+inline bool thread_pool::try_steal(int self, task& t)
+{
+   const int n = static_cast<int>(_queues.size());
+
+   for (int i = 1; i <= n; i++) {
+
+      queue& qu = *_queues[(self + i) % n];
+      std::lock_guard<std::mutex> guard(qu.lock);
+
+      if (qu.tasks.empty())
+         continue;
+
+      t = std::move(qu.tasks.front());
+      qu.tasks.pop_front();
+      _queued--;
+      return true;
+   }
+
+   return false;
+}
+
+inline void thread_pool::push(task t)
+{
+   const int q = _next_queue++ % _queues.size();
+
+   {
+      std::lock_guard<std::mutex> guard(_queues[q]->lock);
+      _queues[q]->tasks.push_back(std::move(t));
+      _queued++;
+   }
+
+   {
+      // Taking the lock avoids losing the wakeup of a worker that has
+      // just found all the queues empty and is about to sleep.
+      std::lock_guard<std::mutex> guard(_sleep_lock);
+   }
+
+   _wakeup.notify_one();
+}
+
+inline void thread_pool::worker_loop(int id)
+{
+   task t;
+
+   while (true) {
+
+      if (try_pop(id, t) || try_steal(id, t)) {
+         t();
+         t = nullptr;
+         continue;
+      }
+
+      std::unique_lock<std::mutex> guard(_sleep_lock);
+      _wakeup.wait(guard, [this] { return _stopping || _queued > 0; });
+
+      if (_stopping && _queued == 0)
+         return;
+   }
+}
+
+template <class F>
+void thread_pool::parallel_for(int begin, int end, int grain, F&& fn)
+{
+   const int len = end - begin;
+
+   if (len <= 0)
+      return;
+
+   grain = std::max(1, grain);
+
+   if (_workers.empty() || len <= grain) {
+      fn(begin, end);
+      return;
+   }
+
+   // A few chunks per thread, so that stealing can balance the load.
+   const int chunks = std::min((len + grain - 1) / grain, 4 * size());
+   const int chunk_len = (len + chunks - 1) / chunks;
+
+   job j;
+   j.pending = (len + chunk_len - 1) / chunk_len;
+
+   // The chunks of a job must all complete before returning, even if one
+   // throws: the tasks still queued reference this stack frame.
+   auto run = [&j, &fn](int b, int e) {
+
+      std::exception_ptr error;
+
+      try {
+         fn(b, e);
+      } catch (...) {
+         error = std::current_exception();
+      }
+
+      std::lock_guard<std::mutex> guard(j.lock);
+
+      if (error && !j.error)
+         j.error = error;
+
+      if (--j.pending == 0)
+         j.done.notify_all();
+   };
+
+   // The caller keeps the first chunk for itself.
+   for (int b = begin + chunk_len; b < end; b += chunk_len) {
+      const int e = std::min(end, b + chunk_len);
+      push([&run, b, e] { run(b, e); });
+   }
+
+   run(begin, std::min(end, begin + chunk_len));
+
+   task t;
+
+   while (try_steal(0, t)) {
+      t();
+      t = nullptr;
+   }
+
+   // Nothing left to steal: our remaining chunks are running elsewhere.
+   // Waiting under j.lock also guarantees that no task still touches 'j'
+   // once we return.
+   std::unique_lock<std::mutex> guard(j.lock);
+   j.done.wait(guard, [&j] { return j.pending == 0; });
+
+   if (j.error)
+      std::rethrow_exception(j.error);
+}
+
+
+inline std::unique_ptr<thread_pool>& global_thread_pool_ptr()
+{
+   static std::unique_ptr<thread_pool> pool;
+   return pool;
+}
+
+inline std::mutex& global_thread_pool_lock()
+{
+   static std::mutex lock;
+   return lock;
+}
+
+/*
+ * Returns the library-wide pool, creating it on first use with
+ * thread_pool::default_thread_count() threads.
+ */
+inline thread_pool& global_thread_pool()
+{
+   std::lock_guard<std::mutex> guard(global_thread_pool_lock());
+   std::unique_ptr<thread_pool>& pool = global_thread_pool_ptr();
+
+   if (!pool)
+      pool.reset(new thread_pool(thread_pool::default_thread_count()));
+
+   return *pool;
+}
+
+/*
+ * Replaces the global pool with a new one having 'n' threads (n <= 0 means
+ * the default). It must not be called while other threads use the library.
+ */
+inline void set_num_threads(int n)
+{
+   std::lock_guard<std::mutex> guard(global_thread_pool_lock());
+
+   global_thread_pool_ptr().reset(
+      new thread_pool(n > 0 ? n : thread_pool::default_thread_count())
+   );
+}
+
+inline int get_num_threads()
+{
+   return global_thread_pool().size();
+}
+
+template <class F>
+inline void parallel_for(int begin, int end, int grain, F&& fn)
+{
+   // Small ranges don't need to touch the pool (and its lock) at all.
+   if (end - begin <= std::max(1, grain)) {
+
+      if (end > begin)
+         fn(begin, end);
+
+      return;
+   }
+
+   global_thread_pool().parallel_for(begin, end, grain, std::forward<F>(fn));
+}
+
+} // namespace vmatrixlib
@@ -0,0 +1,166 @@
+
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <utility>
+#include <algorithm>
+
+#include "gemm.h"
+
+namespace vmatrixlib {
+
+/*
+ * Transpose kernels on row-major buffers.
+ *
+ * A naive transpose reads one of the two matrices along its columns, so
+ * for big matrices every access of that side is a cache (and TLB) miss.
+ * transpose_copy() splits the matrix recursively along its longer side
+ * (cache-oblivious) down to transpose_tile x transpose_tile tiles, which
+ * fit in L1 on both sides. With AVX2, 4x4 blocks of doubles are
+ * transposed in registers.
+ *
+ * transpose_in_place_square() swaps tiles across the diagonal, and
+ * transpose_in_place() handles any shape following the cycles of the
+ * permutation: the element at position p of a (rows x cols) buffer moves
+ * to p * rows mod (rows * cols - 1).
+ */
+
+constexpr const int transpose_tile = 32;
+
+
+template <class T>
+inline void transpose_tile_copy(int rows, int cols, const T *src, int lds,
+                                T *dst, int ldd)
+{
+   for (int i=0; i < rows; i++)
+      for (int j=0; j < cols; j++)
+         dst[j * ldd + i] = src[i * lds + j];
+}
+
+#if VMATRIXLIB_GEMM_AVX2
+
+inline void transpose_4x4(const double *src, int lds, double *dst, int ldd)
+{
+   const __m256d r0 = _mm256_loadu_pd(src);
+   const __m256d r1 = _mm256_loadu_pd(src + lds);
+   const __m256d r2 = _mm256_loadu_pd(src + 2 * lds);
+   const __m256d r3 = _mm256_loadu_pd(src + 3 * lds);
+
+   const __m256d t0 = _mm256_unpacklo_pd(r0, r1);  // a0 b0 a2 b2
+   const __m256d t1 = _mm256_unpackhi_pd(r0, r1);  // a1 b1 a3 b3
+   const __m256d t2 = _mm256_unpacklo_pd(r2, r3);  // c0 d0 c2 d2
+   const __m256d t3 = _mm256_unpackhi_pd(r2, r3);  // c1 d1 c3 d3
+
+   _mm256_storeu_pd(dst,           _mm256_permute2f128_pd(t0, t2, 0x20));
+   _mm256_storeu_pd(dst + ldd,     _mm256_permute2f128_pd(t1, t3, 0x20));
+   _mm256_storeu_pd(dst + 2 * ldd, _mm256_permute2f128_pd(t0, t2, 0x31));
+   _mm256_storeu_pd(dst + 3 * ldd, _mm256_permute2f128_pd(t1, t3, 0x31));
+}
+
+template <>
+inline void transpose_tile_copy<double>(int rows, int cols, const double *src,
+                                        int lds, double *dst, int ldd)
+{
+   const int r4 = rows & ~3;
+   const int c4 = cols & ~3;
+
+   for (int i=0; i < r4; i += 4)
+      for (int j=0; j < c4; j += 4)
+         transpose_4x4(src + i * lds + j, lds, dst + j * ldd + i, ldd);
+
+   // The borders, which are less than 4 wide.
+   for (int i=0; i < rows; i++) {
+      for (int j=(i < r4 ? c4 : 0); j < cols; j++)
+         dst[j * ldd + i] = src[i * lds + j];
+   }
+}
+
+#endif // VMATRIXLIB_GEMM_AVX2
+
+// dst (cols x rows) = src (rows x cols)^T
+template <class T>
+void transpose_copy(int rows, int cols, const T *src, int lds, T *dst, int ldd)
+{
+   if (rows <= transpose_tile && cols <= transpose_tile) {
+      transpose_tile_copy(rows, cols, src, lds, dst, ldd);
+      return;
+   }
+
+   if (rows >= cols) {
+      const int h = rows / 2;
+      transpose_copy(h, cols, src, lds, dst, ldd);
+      transpose_copy(rows - h, cols, src + h * lds, lds, dst + h, ldd);
+   } else {
+      const int h = cols / 2;
+      transpose_copy(rows, h, src, lds, dst, ldd);
+      transpose_copy(rows, cols - h, src + h, lds, dst + h * ldd, ldd);
+   }
+}
+
+/*
+ * Square n x n: the tiles on the diagonal are transposed in place, the
+ * others are swapped with their mirror tile. Both tiles of a pair stay in
+ * L1 meanwhile, and nothing is allocated.
+ */
+template <class T>
+void transpose_in_place_square(int n, T *a, int lda)
+{
+   const int ts = transpose_tile;
+
+   for (int ib=0; ib < n; ib += ts) {
+
+      const int ih = std::min(ts, n - ib);
+
+      for (int i=0; i < ih; i++)
+         for (int j=i+1; j < ih; j++)
+            std::swap(a[(ib + i) * lda + ib + j], a[(ib + j) * lda + ib + i]);
+
+      for (int jb=ib+ts; jb < n; jb += ts) {
+
+         const int jw = std::min(ts, n - jb);
+
+         for (int i=0; i < ih; i++)
+            for (int j=0; j < jw; j++)
+               std::swap(a[(ib + i) * lda + jb + j], a[(jb + j) * lda + ib + i]);
+      }
+   }
+}
+
+/*
+ * Any shape, on a contiguous (rows x cols) buffer. Unless it's square, it
+ * allocates one bit per element to mark the cycles already followed.
+ */
+template <class T>
+void transpose_in_place(int rows, int cols, T *a)
+{
+   if (rows == cols) {
+      transpose_in_place_square(rows, a, cols);
+      return;
+   }
+
+   if (rows <= 1 || cols <= 1)
+      return;
+
+   const int64_t last = static_cast<int64_t>(rows) * cols - 1;
+   std::vector<bool> moved(last + 1, false);
+
+   // The first and the last elements never move.
+   for (int64_t start=1; start < last; start++) {
+
+      if (moved[start])
+         continue;
+
+      // The element at p goes to p * rows mod last.
+      T carried = std::move(a[start]);
+      int64_t p = start;
+
+      do {
+         p = p * rows % last;
+         std::swap(carried, a[p]);
+         moved[p] = true;
+      } while (p != start);
+   }
+}
+
+} // namespace vmatrixlib
@@ -17,6 +17,115 @@ inline bool num_out_of_range(float_type val)
 }
 
 
+/*
+ * Overflow-checked integer arithmetic: each function stores the result in
+ * 'res' and returns true if the operation overflowed.
+ */
+
+template <class integer_type>
+inline bool add_overflow(integer_type a, integer_type b, integer_type *res)
+{
+#if defined(__GNUC__) || defined(__clang__)
+   return __builtin_add_overflow(a, b, res);
+#else
+   typedef std::numeric_limits<integer_type> lim;
+
+   if ((b > 0 && a > lim::max() - b) || (b < 0 && a < lim::min() - b))
+      return true;
+
+   *res = a + b;
+   return false;
+#endif
+}
+
+template <class integer_type>
+inline bool sub_overflow(integer_type a, integer_type b, integer_type *res)
+{
+#if defined(__GNUC__) || defined(__clang__)
+   return __builtin_sub_overflow(a, b, res);
+#else
+   typedef std::numeric_limits<integer_type> lim;
+
+   if ((b < 0 && a > lim::max() + b) || (b > 0 && a < lim::min() + b))
+      return true;
+
+   *res = a - b;
+   return false;
+#endif
+}
+
+template <class integer_type>
+inline bool mul_overflow(integer_type a, integer_type b, integer_type *res)
+{
+#if defined(__GNUC__) || defined(__clang__)
+   return __builtin_mul_overflow(a, b, res);
+#else
+   typedef std::numeric_limits<integer_type> lim;
+
+   if (a != 0 && b != 0) {
+
+      if (a > 0) {
+
+         if (b > 0 ? a > lim::max() / b : b < lim::min() / a)
+            return true;
+
+      } else {
+
+         if (b > 0 ? a < lim::min() / b : b < lim::max() / a)
+            return true;
+      }
+   }
+
+   *res = a * b;
+   return false;
+#endif
+}
+
+/*
+ * Exact (a*p - b*f) / d, as used by fraction-free elimination: returns
+ * false on overflow or when d doesn't divide a*p - b*f. When 128-bit
+ * integers are available, the products can't overflow for 64-bit types.
+ */
+template <class integer_type>
+inline bool fraction_free_int_step(integer_type a, integer_type b,
+                                   integer_type p, integer_type f,
+                                   integer_type d, integer_type *res)
+{
+   typedef std::numeric_limits<integer_type> lim;
+
+#ifdef __SIZEOF_INT128__
+   if (sizeof(integer_type) <= sizeof(int64_t)) {
+
+      const __int128 n =
+         static_cast<__int128>(a) * p - static_cast<__int128>(b) * f;
+
+      if (n % d != 0)
+         return false;
+
+      const __int128 q = n / d;
+
+      if (q <= lim::min() || q > lim::max())
+         return false;
+
+      *res = static_cast<integer_type>(q);
+      return true;
+   }
+#endif
+
+   integer_type ap, bf, n;
+
+   // n == min would make n % d and n / d undefined for d == -1.
+   if (mul_overflow(a, p, &ap) || mul_overflow(b, f, &bf) ||
+       sub_overflow(ap, bf, &n) || n == lim::min() || n % d != 0)
+   {
+      return false;
+   }
+
+   *res = n / d;
+   return *res != lim::min();
+}
+
+
 template <class integer_type>
 integer_type gcd(integer_type a, integer_type b)
 {
@@ -171,11 +280,51 @@ auto to_float(const T& t) {
    return static_cast<typename fp_type_of<T>::type>(t);
 }
 
+/*
+ * The type of the real part of T, and the real part of a value: for all
+ * the types but the complex ones, T and the value itself.
+ */
+template <class T>
+struct real_type_of {
+   typedef T type;
+};
+
+template <class T>
+inline T real_part(const T& t) {
+   return t;
+}
+
+template <class T>
+inline bool is_real(const T&) {
+   return true;
+}
+
 template <class T>
 inline T to_frac_in_decimal_form(const T& t) {
    return t;
 }
 
+/*
+ * One step of fraction-free elimination: (a*p - b*f) / d, where the
+ * division is known to be exact. Number types can overload it to avoid
+ * the intermediate growth or the cost of a generic division.
+ */
+template <class T>
+inline T fraction_free_step(const T& a, const T& b,
+                            const T& p, const T& f, const T& d)
+{
+   return (a * p - b * f) / d;
+}
+
+/*
+ * lcm(l, denominator of x) for the number types having a denominator, l
+ * for all the others: used to scale rational matrices to integer ones.
+ */
+template <class T>
+inline T denominators_lcm(const T& l, const T& /* x */) {
+   return l;
+}
+
 template <class T>
 T numerator(const T& val) {
    return val;